@@ -0,0 +1,241 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "AudioOutput.h"
+
+const double PI = 3.14159265358979323846;
+
+/* Frames moved from the ring to the resampler at once. */
+const size_t POP_FRAMES = 256;
+
+AudioRing::AudioRing(size_t frames) {
+    size_t capacity = 1;
+    while (capacity < frames)
+        capacity <<= 1;
+
+    data.resize(capacity * 2);
+    mask = capacity - 1;
+}
+
+size_t AudioRing::push(const int16_t* frames, size_t count) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    size_t n = std::min(count, capacity() - (h - t));
+
+    /* At most two pieces, before and after the end of the buffer. */
+    size_t start = h & mask;
+    size_t first = std::min(n, capacity() - start);
+    std::memcpy(&data[start * 2], frames, first * 4);
+    std::memcpy(&data[0], frames + first * 2, (n - first) * 4);
+
+    head.store(h + n, std::memory_order_release);
+    return n;
+}
+
+size_t AudioRing::pop(int16_t* frames, size_t count) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t n = std::min(count, h - t);
+
+    size_t start = t & mask;
+    size_t first = std::min(n, capacity() - start);
+    std::memcpy(frames, &data[start * 2], first * 4);
+    std::memcpy(frames + first * 2, &data[0], (n - first) * 4);
+
+    tail.store(t + n, std::memory_order_release);
+    return n;
+}
+
+std::unique_ptr<WavSink> WavSink::create(const std::string& path, uint32_t rate) {
+    auto sink = std::unique_ptr<WavSink>(new WavSink());
+    sink->file.open(path, std::ios::binary);
+    if (!sink->file) {
+        printf("[AUDIO] Could not create wav file: %s\n", path.c_str());
+        return nullptr;
+    }
+
+    sink->sample_rate = rate;
+    sink->write_header(0);
+    return sink;
+}
+
+WavSink::~WavSink() {
+    if (!file)
+        return;
+
+    uint64_t bytes = std::min<uint64_t>(frames_written * 4, UINT32_MAX - 36);
+    file.seekp(0);
+    write_header((uint32_t)bytes);
+}
+
+void WavSink::write_header(uint32_t data_bytes) {
+    auto put32 = [this](uint32_t value) { file.write(reinterpret_cast<const char*>(&value), 4); };
+    auto put16 = [this](uint16_t value) { file.write(reinterpret_cast<const char*>(&value), 2); };
+
+    file.write("RIFF", 4);
+    put32(36 + data_bytes);
+    file.write("WAVE", 4);
+
+    file.write("fmt ", 4);
+    put32(16);
+    put16(1); /* PCM */
+    put16(2);
+    put32(sample_rate);
+    put32(sample_rate * 4);
+    put16(4);
+    put16(16);
+
+    file.write("data", 4);
+    put32(data_bytes);
+}
+
+void WavSink::write(const int16_t* frames, size_t count) {
+    file.write(reinterpret_cast<const char*>(frames), count * 4);
+    frames_written += count;
+}
+
+ToneSource::ToneSource(double frequency, uint32_t rate, int16_t amplitude) :
+    step(2 * PI * frequency / rate), amplitude(amplitude) {}
+
+void ToneSource::generate(int16_t* frames, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int16_t value = (int16_t)std::lrint(amplitude * std::sin(phase));
+        frames[i * 2] = value;
+        frames[i * 2 + 1] = value;
+
+        phase += step;
+        if (phase >= 2 * PI)
+            phase -= 2 * PI;
+    }
+}
+
+AudioOutput::AudioOutput(std::unique_ptr<AudioSink> output, uint32_t in_rate, bool realtime) :
+    resampler(in_rate, output->rate()), sink(std::move(output)), ring(RING_FRAMES), realtime(realtime),
+    worker(&AudioOutput::run, this) {}
+
+AudioOutput::~AudioOutput() {
+    stop();
+    dump_stats();
+}
+
+size_t AudioOutput::push(const int16_t* frames, size_t count) {
+    size_t n = ring.push(frames, count);
+
+    stats.frames_pushed += n;
+    if (n < count) {
+        stats.frames_dropped += count - n;
+        stats.overflows++;
+    }
+
+    return n;
+}
+
+void AudioOutput::stop() {
+    quit = true;
+    if (worker.joinable())
+        worker.join();
+}
+
+void AudioOutput::run() {
+    if (realtime)
+        run_realtime();
+    else
+        run_offline();
+}
+
+void AudioOutput::run_realtime() {
+    const size_t period = sink->rate() * PERIOD_MS / 1000;
+    std::vector<int16_t> input(POP_FRAMES * 2);
+    std::vector<int16_t> output(period * 2);
+
+    double fill = TARGET_FILL;
+    auto next = std::chrono::steady_clock::now();
+
+    while (!quit) {
+        next += std::chrono::milliseconds(PERIOD_MS);
+        std::this_thread::sleep_until(next);
+
+        /* Too full: consume input a little faster, too empty: slower. */
+        /* The fill level is smoothed so the pitch does not wobble.    */
+        size_t level = ring.size();
+        fill += (level - fill) * 0.05;
+
+        double adjust = std::clamp((fill - TARGET_FILL) / TARGET_FILL * MAX_ADJUST, -MAX_ADJUST, MAX_ADJUST);
+        resampler.set_adjust(adjust);
+
+        stats.min_fill = std::min(stats.min_fill, level);
+        stats.max_fill = std::max(stats.max_fill, level);
+        stats.min_adjust = std::min(stats.min_adjust, adjust);
+        stats.max_adjust = std::max(stats.max_adjust, adjust);
+
+        size_t produced = 0;
+        while (produced < period) {
+            produced += resampler.process(&output[produced * 2], period - produced);
+            if (produced == period)
+                break;
+
+            size_t n = ring.pop(input.data(), POP_FRAMES);
+            if (n == 0) {
+                /* Ran dry, play silence for the rest of the period. */
+                std::fill(output.begin() + produced * 2, output.end(), 0);
+                stats.underrun_frames += period - produced;
+                stats.underruns++;
+                break;
+            }
+            resampler.feed(input.data(), n);
+        }
+
+        sink->write(output.data(), period);
+        stats.frames_played += period;
+    }
+}
+
+void AudioOutput::run_offline() {
+    std::vector<int16_t> input(POP_FRAMES * 2);
+    std::vector<int16_t> output(POP_FRAMES * 4);
+
+    while (true) {
+        /* Read quit first, whatever was pushed before stop() is then in the ring. */
+        bool stopping = quit;
+
+        size_t n = ring.pop(input.data(), POP_FRAMES);
+        if (n == 0) {
+            if (stopping)
+                break;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        resampler.feed(input.data(), n);
+
+        size_t produced;
+        while ((produced = resampler.process(output.data(), output.size() / 2)) > 0) {
+            sink->write(output.data(), produced);
+            stats.frames_played += produced;
+        }
+    }
+}
+
+void AudioOutput::dump_stats() const {
+    printf("[AUDIO] pushed %llu, dropped %llu in %llu overflows, played %llu, %llu underruns (%llu frames)\n",
+           (unsigned long long)stats.frames_pushed, (unsigned long long)stats.frames_dropped,
+           (unsigned long long)stats.overflows, (unsigned long long)stats.frames_played,
+           (unsigned long long)stats.underruns, (unsigned long long)stats.underrun_frames);
+
+    if (realtime && stats.max_fill > 0) {
+        printf("[AUDIO] ring fill %zu..%zu of %zu, rate adjust %+.3f%%..%+.3f%%\n",
+               stats.min_fill, stats.max_fill, ring.capacity(),
+               stats.min_adjust * 100, stats.max_adjust * 100);
+    }
+}
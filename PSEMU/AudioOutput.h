@@ -0,0 +1,159 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Resampler.h"
+
+/* Single producer, single consumer ring of stereo frames. Lock free: */
+/* each side only writes its own index.                               */
+class AudioRing {
+public:
+    explicit AudioRing(size_t frames);
+
+    /* Both return the frames actually copied. */
+    size_t push(const int16_t* frames, size_t count);
+    size_t pop(int16_t* frames, size_t count);
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    size_t capacity() const { return mask + 1; }
+    size_t space() const { return capacity() - size(); }
+
+private:
+    std::vector<int16_t> data;
+    size_t mask;
+
+    /* Frame counters, on their own cache lines. */
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+};
+
+/* Where the resampled audio ends up. */
+class AudioSink {
+public:
+    virtual ~AudioSink() = default;
+
+    virtual uint32_t rate() const = 0;
+    virtual void write(const int16_t* frames, size_t count) = 0;
+};
+
+/* Throws the audio away, for running without an output. */
+class NullSink : public AudioSink {
+public:
+    explicit NullSink(uint32_t rate) : sample_rate(rate) {}
+
+    uint32_t rate() const override { return sample_rate; }
+    void write(const int16_t* /*frames*/, size_t count) override { written += count; }
+
+    uint64_t written = 0;
+
+private:
+    uint32_t sample_rate;
+};
+
+/* 16 bit stereo PCM .wav file, the sizes are filled in when it is closed. */
+class WavSink : public AudioSink {
+public:
+    static std::unique_ptr<WavSink> create(const std::string& path, uint32_t rate);
+    ~WavSink();
+
+    uint32_t rate() const override { return sample_rate; }
+    void write(const int16_t* frames, size_t count) override;
+
+private:
+    void write_header(uint32_t data_bytes);
+
+    std::ofstream file;
+    uint32_t sample_rate = 0;
+    uint64_t frames_written = 0;
+};
+
+/* Sine wave, to drive the pipeline without the emulator. */
+class ToneSource {
+public:
+    ToneSource(double frequency, uint32_t rate, int16_t amplitude = 8000);
+
+    void generate(int16_t* frames, size_t count);
+
+private:
+    double phase = 0;
+    double step;
+    int16_t amplitude;
+};
+
+/* Back-pressure counters. The producer ones belong to the emulation */
+/* thread, the rest to the output thread; read them once it stopped. */
+struct AudioStats {
+    uint64_t frames_pushed = 0;
+    uint64_t frames_dropped = 0; /* The ring was full. */
+    uint64_t overflows = 0; /* Pushes that dropped something. */
+
+    uint64_t frames_played = 0; /* At the sink rate. */
+    uint64_t underrun_frames = 0; /* Silence played because the ring ran dry. */
+    uint64_t underruns = 0;
+    size_t min_fill = SIZE_MAX;
+    size_t max_fill = 0;
+    double min_adjust = 0;
+    double max_adjust = 0;
+};
+
+/*
+ * The emulation thread pushes frames into the ring and never waits. An
+ * output thread drains it through the resampler into the sink.
+ *
+ * In real time mode the output thread wakes every PERIOD_MS and plays
+ * one period, slightly speeding up or slowing down the resampling so the
+ * ring stays near TARGET_FILL. Otherwise it plays everything as fast as
+ * it arrives, which is what offline rendering and tests want.
+ */
+class AudioOutput {
+public:
+    static const size_t RING_FRAMES = 8192;
+    static const size_t TARGET_FILL = 2048;
+    static const uint32_t PERIOD_MS = 10;
+
+    /* Largest rate change the fill level may ask for, 0.5%. */
+    static constexpr double MAX_ADJUST = 0.005;
+
+    AudioOutput(std::unique_ptr<AudioSink> sink, uint32_t in_rate, bool realtime = true);
+    ~AudioOutput();
+
+    /* Emulation thread. What does not fit is dropped and counted. */
+    size_t push(const int16_t* frames, size_t count);
+
+    /* Frames push can take right now. */
+    size_t space() const { return ring.space(); }
+
+    /* Plays what is queued (unless real time) and stops the thread. */
+    void stop();
+
+    const AudioStats& get_stats() const { return stats; }
+    void dump_stats() const;
+
+    Resampler resampler;
+
+private:
+    void run();
+    void run_realtime();
+    void run_offline();
+
+    std::unique_ptr<AudioSink> sink;
+    AudioRing ring;
+    bool realtime;
+
+    AudioStats stats;
+    std::atomic<bool> quit = false;
+    std::thread worker;
+};
@@ -0,0 +1,382 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "CDDrive.h"
+
+/* Delays in CPU cycles (33.8688 MHz). */
+const int32_t FIRST_RESPONSE_CYCLES = 25000;
+const int32_t SECOND_RESPONSE_CYCLES = 50000;
+const int32_t SECTOR_CYCLES_1X = 33868800 / 75;
+
+/* Sectors the read-ahead thread keeps ahead of the drive. */
+const uint32_t READ_AHEAD_SECTORS = 64;
+
+/* XA audio nobody consumed is dropped past this many stereo samples. */
+const size_t XA_BUFFER_LIMIT = 8 * XA_MAX_SAMPLES * 2;
+
+static uint8_t to_bcd(uint32_t value) {
+    return (uint8_t)(((value / 10) << 4) | (value % 10));
+}
+
+static uint32_t from_bcd(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0xf);
+}
+
+CDDrive::CDDrive() {
+    status.raw = 0;
+    mode.raw = 0;
+}
+
+bool CDDrive::insert_disc(const std::string& path, bool use_read_ahead) {
+    eject_disc();
+
+    disc = DiscImage::open(path);
+    if (!disc)
+        return false;
+
+    if (use_read_ahead)
+        read_ahead = std::make_unique<ReadAhead>(disc.get(), READ_AHEAD_SECTORS);
+
+    drive_stat = STAT_MOTOR_ON;
+    return true;
+}
+
+void CDDrive::eject_disc() {
+    /* The thread has to stop before the image goes away. */
+    read_ahead.reset();
+    disc.reset();
+
+    reading = false;
+    sector = nullptr;
+    data = nullptr;
+    data_size = 0;
+    data_pos = 0;
+    drive_stat = 0;
+}
+
+uint8_t CDDrive::stat() const {
+    return disc ? drive_stat : (uint8_t)STAT_SHELL_OPEN;
+}
+
+uint8_t CDDrive::read(uint32_t offset) {
+    switch (offset) {
+        case 0:
+            status.param_empty = params.empty();
+            status.param_ready = params.size() < 16;
+            status.response_ready = response_pos < response.size();
+            status.data_ready = data_pos < data_size;
+            status.busy = false;
+            return status.raw;
+        case 1:
+            return response_pos < response.size() ? response[response_pos++] : 0;
+        case 2:
+            return data_pos < data_size ? data[data_pos++] : 0;
+        case 3:
+            /* Upper bits always read as set. */
+            if (status.index & 1)
+                return int_flag | 0xe0;
+            return int_enable | 0xe0;
+        default:
+            return 0;
+    }
+}
+
+void CDDrive::write(uint32_t offset, uint8_t value) {
+    if (offset == 0) {
+        status.index = value & 3;
+        return;
+    }
+
+    switch (offset << 4 | status.index) {
+        case 0x10:
+            execute(value);
+            break;
+        case 0x20:
+            if (params.size() < 16)
+                params.push_back(value);
+            break;
+        case 0x21:
+            int_enable = value & 0x1f;
+            break;
+        case 0x30:
+            /* Request register, bit 7 moves the sector into the data fifo. */
+            if (value & 0x80) {
+                if (data_pos >= data_size && sector != nullptr) {
+                    data = mode.whole_sector ? sector + 12 : sector + 24;
+                    data_size = mode.whole_sector ? 0x924 : 0x800;
+                    data_pos = 0;
+                }
+            }
+            else {
+                data_size = 0;
+                data_pos = 0;
+            }
+            break;
+        case 0x31:
+            int_flag &= ~(value & 0x1f);
+            if (value & 0x40)
+                params.clear();
+            break;
+        default:
+            /* Sound map and audio volume registers, no CD audio yet. */
+            break;
+    }
+}
+
+void CDDrive::push_response(uint8_t irq, std::vector<uint8_t> bytes, int32_t delay) {
+    pending.push_back({ irq, std::move(bytes), delay });
+}
+
+void CDDrive::execute(uint8_t command) {
+    uint8_t s = stat();
+
+    switch (command) {
+        case 0x01: /* GetStat */
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            break;
+        case 0x02: { /* Setloc */
+            if (params.size() < 3) {
+                push_response(5, { (uint8_t)(s | STAT_ERROR), 0x20 }, FIRST_RESPONSE_CYCLES);
+                break;
+            }
+
+            uint32_t msf = (from_bcd(params[0]) * 60 + from_bcd(params[1])) * 75 + from_bcd(params[2]);
+            seek_lba = msf >= LEAD_IN_SECTORS ? msf - LEAD_IN_SECTORS : 0;
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            break;
+        }
+        case 0x06: /* ReadN */
+        case 0x1b: /* ReadS */
+            if (!disc) {
+                push_response(5, { (uint8_t)(s | STAT_ERROR), 0x80 }, FIRST_RESPONSE_CYCLES);
+                break;
+            }
+
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            read_lba = seek_lba;
+            reading = true;
+            read_timer = SECTOR_CYCLES_1X / (mode.double_speed ? 2 : 1);
+            drive_stat = STAT_MOTOR_ON | STAT_READING;
+            break;
+        case 0x07: /* MotorOn */
+            drive_stat |= STAT_MOTOR_ON;
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            push_response(2, { stat() }, SECOND_RESPONSE_CYCLES);
+            break;
+        case 0x08: /* Stop */
+            reading = false;
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            drive_stat = 0;
+            push_response(2, { stat() }, SECOND_RESPONSE_CYCLES);
+            break;
+        case 0x09: /* Pause */
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            reading = false;
+            drive_stat &= ~STAT_READING;
+            push_response(2, { stat() }, SECOND_RESPONSE_CYCLES);
+            break;
+        case 0x0a: /* Init */
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            mode.raw = 0;
+            reading = false;
+            drive_stat = disc ? STAT_MOTOR_ON : 0;
+            push_response(2, { stat() }, SECOND_RESPONSE_CYCLES);
+            break;
+        case 0x0b: /* Mute */
+        case 0x0c: /* Demute */
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            break;
+        case 0x0d: /* Setfilter */
+            if (params.size() >= 2) {
+                filter_file = params[0];
+                filter_channel = params[1];
+            }
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            break;
+        case 0x0e: /* Setmode */
+            if (!params.empty())
+                mode.raw = params[0];
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            break;
+        case 0x0f: /* Getparam */
+            push_response(3, { s, mode.raw, 0, filter_file, filter_channel }, FIRST_RESPONSE_CYCLES);
+            break;
+        case 0x10: { /* GetlocL, header and subheader of the last sector. */
+            std::vector<uint8_t> header(8, 0);
+            if (sector != nullptr)
+                std::memcpy(header.data(), sector + 12, 8);
+            push_response(3, header, FIRST_RESPONSE_CYCLES);
+            break;
+        }
+        case 0x11: { /* GetlocP */
+            uint32_t lba = read_lba;
+            uint8_t track = 1;
+            uint32_t track_start = 0;
+            if (disc) {
+                for (const Track& t : disc->get_tracks()) {
+                    if (lba >= t.start) {
+                        track = (uint8_t)t.number;
+                        track_start = t.start;
+                    }
+                }
+            }
+
+            uint32_t rel = lba - track_start;
+            uint32_t abs = lba + LEAD_IN_SECTORS;
+            push_response(3, {
+                to_bcd(track), 0x01,
+                to_bcd(rel / 75 / 60), to_bcd(rel / 75 % 60), to_bcd(rel % 75),
+                to_bcd(abs / 75 / 60), to_bcd(abs / 75 % 60), to_bcd(abs % 75)
+            }, FIRST_RESPONSE_CYCLES);
+            break;
+        }
+        case 0x13: { /* GetTN */
+            uint32_t last = disc ? (uint32_t)disc->get_tracks().size() : 1;
+            push_response(3, { s, 0x01, to_bcd(last) }, FIRST_RESPONSE_CYCLES);
+            break;
+        }
+        case 0x14: { /* GetTD, track 0 is the lead-out. */
+            uint32_t track = params.empty() ? 0 : from_bcd(params[0]);
+            uint32_t lba = 0;
+            if (disc) {
+                const std::vector<Track>& tracks = disc->get_tracks();
+                lba = (track == 0 || track > tracks.size()) ? disc->sector_count() : tracks[track - 1].start;
+            }
+
+            uint32_t abs = lba + LEAD_IN_SECTORS;
+            push_response(3, { s, to_bcd(abs / 75 / 60), to_bcd(abs / 75 % 60) }, FIRST_RESPONSE_CYCLES);
+            break;
+        }
+        case 0x15: /* SeekL */
+        case 0x16: /* SeekP */
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            reading = false;
+            read_lba = seek_lba;
+            drive_stat = (drive_stat & ~STAT_READING) | STAT_MOTOR_ON;
+            push_response(2, { stat() }, SECOND_RESPONSE_CYCLES);
+            break;
+        case 0x19: /* Test */
+            if (!params.empty() && params[0] == 0x20)
+                push_response(3, { 0x94, 0x09, 0x19, 0xc0 }, FIRST_RESPONSE_CYCLES);
+            else
+                push_response(5, { (uint8_t)(s | STAT_ERROR), 0x10 }, FIRST_RESPONSE_CYCLES);
+            break;
+        case 0x1a: /* GetID */
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            if (disc)
+                push_response(2, { 0x02, 0x00, 0x20, 0x00, 'S', 'C', 'E', 'A' }, SECOND_RESPONSE_CYCLES);
+            else
+                push_response(5, { 0x08, 0x40, 0, 0, 0, 0, 0, 0 }, SECOND_RESPONSE_CYCLES);
+            break;
+        case 0x1e: /* ReadTOC */
+            push_response(3, { s }, FIRST_RESPONSE_CYCLES);
+            push_response(2, { stat() }, SECOND_RESPONSE_CYCLES);
+            break;
+        default:
+            printf("[CDROM] Unhandled command: 0x%x\n", command);
+            push_response(5, { (uint8_t)(s | STAT_ERROR), 0x40 }, FIRST_RESPONSE_CYCLES);
+            break;
+    }
+
+    params.clear();
+}
+
+void CDDrive::load_sector() {
+    sector = disc->read_sector(read_lba);
+
+    /* The drive only reads forwards. */
+    if (read_ahead)
+        read_ahead->hint(read_lba, 1);
+    read_lba++;
+
+    /* XA audio goes to the decoder instead of the data fifo. */
+    if (mode.xa_adpcm && play_xa_sector())
+        return;
+
+    /* If the last sector was not taken yet it is simply replaced. */
+    for (const CDROMResponse& r : pending) {
+        if (r.irq == 1)
+            return;
+    }
+    push_response(1, { stat() }, 0);
+}
+
+bool CDDrive::play_xa_sector() {
+    XASectorInfo info;
+    if (!XAADPCM::parse_header(sector, info))
+        return false;
+
+    /* Sectors of other streams are skipped, not delivered. */
+    if (mode.xa_filter && (info.file != filter_file || info.channel != filter_channel))
+        return true;
+
+    int16_t pcm[XA_MAX_SAMPLES];
+    size_t frames = xa_decoder.decode_sector(sector, pcm);
+
+    xa_sample_rate = info.sample_rate;
+    for (size_t i = 0; i < frames; i++) {
+        int16_t left = info.stereo ? pcm[i * 2] : pcm[i];
+        int16_t right = info.stereo ? pcm[i * 2 + 1] : pcm[i];
+        xa_samples.push_back(left);
+        xa_samples.push_back(right);
+    }
+
+    if (xa_samples.size() > XA_BUFFER_LIMIT)
+        xa_samples.erase(xa_samples.begin(), xa_samples.end() - XA_BUFFER_LIMIT);
+
+    return true;
+}
+
+bool CDDrive::tick(uint32_t cycles) {
+    if (reading) {
+        read_timer -= (int32_t)cycles;
+        if (read_timer <= 0) {
+            read_timer += SECTOR_CYCLES_1X / (mode.double_speed ? 2 : 1);
+            load_sector();
+        }
+    }
+
+    /* The next interrupt waits until the previous one is acknowledged. */
+    if (int_flag != 0 || pending.empty())
+        return false;
+
+    CDROMResponse& next = pending.front();
+    next.delay -= (int32_t)cycles;
+    if (next.delay > 0)
+        return false;
+
+    int_flag = next.irq;
+    response = std::move(next.data);
+    response_pos = 0;
+    pending.pop_front();
+
+    return (int_flag & int_enable) != 0;
+}
+
+uint32_t CDDrive::read_word() {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= (uint32_t)read(2) << (8 * i);
+
+    return value;
+}
+
+void CDDrive::dma_read(uint8_t* dst, size_t bytes) {
+    size_t available = std::min(bytes, data_size - data_pos);
+    if (available > 0) {
+        std::memcpy(dst, data + data_pos, available);
+        data_pos += available;
+    }
+
+    /* Reading past the end of the fifo gives zeroes. */
+    if (available < bytes)
+        std::memset(dst + available, 0, bytes - available);
+}
@@ -0,0 +1,125 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "DiscImage.h"
+#include "XAADPCM.h"
+
+union CDROMStatus {
+    uint8_t raw;
+
+    struct {
+        uint8_t index : 2;
+        uint8_t adpcm_busy : 1;
+        uint8_t param_empty : 1;
+        uint8_t param_ready : 1; /* Parameter fifo not full. */
+        uint8_t response_ready : 1; /* Response fifo not empty. */
+        uint8_t data_ready : 1; /* Data fifo not empty. */
+        uint8_t busy : 1;
+    };
+};
+
+union CDROMMode {
+    uint8_t raw;
+
+    struct {
+        uint8_t cdda : 1;
+        uint8_t auto_pause : 1;
+        uint8_t report : 1;
+        uint8_t xa_filter : 1;
+        uint8_t ignore_bit : 1;
+        uint8_t whole_sector : 1; /* 0x924 bytes instead of 0x800. */
+        uint8_t xa_adpcm : 1;
+        uint8_t double_speed : 1;
+    };
+};
+
+/* Drive status byte returned by most commands. */
+enum CDROMStat : uint8_t {
+    STAT_ERROR = 1 << 0,
+    STAT_MOTOR_ON = 1 << 1,
+    STAT_SEEK_ERROR = 1 << 2,
+    STAT_ID_ERROR = 1 << 3,
+    STAT_SHELL_OPEN = 1 << 4,
+    STAT_READING = 1 << 5,
+    STAT_SEEKING = 1 << 6,
+    STAT_PLAYING = 1 << 7
+};
+
+struct CDROMResponse {
+    uint8_t irq;
+    std::vector<uint8_t> data;
+    int32_t delay; /* CPU cycles after the previous interrupt was acknowledged. */
+};
+
+class CDDrive {
+public:
+    CDDrive();
+
+    bool insert_disc(const std::string& path, bool read_ahead = true);
+    void eject_disc();
+
+    /* Byte registers at 0x1f801800 - 0x1f801803. */
+    uint8_t read(uint32_t offset);
+    void write(uint32_t offset, uint8_t data);
+
+    /* DMA channel 3. dma_read copies straight from the loaded sector. */
+    uint32_t read_word();
+    void dma_read(uint8_t* dst, size_t bytes);
+
+    /* Returns true when an enabled interrupt was raised. */
+    bool tick(uint32_t cycles);
+
+    /* Decoded XA audio, stereo interleaved at xa_sample_rate. The */
+    /* consumer (the SPU) removes what it used from the front.      */
+    std::vector<int16_t> xa_samples;
+    uint32_t xa_sample_rate = 37800;
+
+private:
+    void execute(uint8_t command);
+    void push_response(uint8_t irq, std::vector<uint8_t> data, int32_t delay);
+    void load_sector();
+    bool play_xa_sector();
+    uint8_t stat() const;
+
+    CDROMStatus status;
+    CDROMMode mode;
+    uint8_t int_enable = 0;
+    uint8_t int_flag = 0;
+    uint8_t drive_stat = 0;
+
+    std::vector<uint8_t> params;
+    std::vector<uint8_t> response;
+    size_t response_pos = 0;
+    std::deque<CDROMResponse> pending;
+
+    /* Seek target set by Setloc and the current read position. */
+    uint32_t seek_lba = 0;
+    uint32_t read_lba = 0;
+    bool reading = false;
+    int32_t read_timer = 0;
+
+    /* Last sector delivered by the drive and the data fifo view of it. */
+    const uint8_t* sector = nullptr;
+    const uint8_t* data = nullptr;
+    size_t data_size = 0;
+    size_t data_pos = 0;
+
+    /* Setfilter selection for XA audio. */
+    uint8_t filter_file = 0;
+    uint8_t filter_channel = 0;
+    XAADPCM xa_decoder;
+
+    std::unique_ptr<DiscImage> disc;
+    std::unique_ptr<ReadAhead> read_ahead;
+};
@@ -0,0 +1,284 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "CompressedImage.h"
+#include "LZ.h"
+
+static const char magic[8] = { 'P', 'S', 'E', 'M', 'U', 'C', 'D', 'Z' };
+const uint32_t FORMAT_VERSION = 1;
+const size_t HEADER_SIZE = 8 + 6 * 4;
+const size_t TRACK_SIZE = 4 * 4;
+
+static uint32_t get32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, 4);
+    return value;
+}
+
+static uint64_t get64(const uint8_t* p) {
+    uint64_t value;
+    std::memcpy(&value, p, 8);
+    return value;
+}
+
+static void put32(std::ofstream& out, uint32_t value) {
+    out.write(reinterpret_cast<const char*>(&value), 4);
+}
+
+static void put64(std::ofstream& out, uint64_t value) {
+    out.write(reinterpret_cast<const char*>(&value), 8);
+}
+
+HunkCache& HunkCache::instance() {
+    static HunkCache cache;
+    return cache;
+}
+
+uint32_t HunkCache::image_id(const std::string& path) {
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::canonical(path, error);
+    auto size = std::filesystem::file_size(path, error);
+    auto time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+
+    std::string key = (error ? std::filesystem::path(path) : canonical).string() +
+                      "|" + std::to_string(size) + "|" + std::to_string(time);
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = ids.find(key);
+    if (it != ids.end())
+        return it->second;
+
+    uint32_t id = (uint32_t)ids.size();
+    ids[key] = id;
+    return id;
+}
+
+Hunk HunkCache::find(uint32_t image, uint32_t hunk) {
+    uint64_t key = ((uint64_t)image << 32) | hunk;
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        misses++;
+        return nullptr;
+    }
+
+    hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->data;
+}
+
+void HunkCache::insert(uint32_t image, uint32_t hunk, Hunk data) {
+    uint64_t key = ((uint64_t)image << 32) | hunk;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    /* Another thread may have decoded the same hunk meanwhile. */
+    if (entries.count(key))
+        return;
+
+    bytes += data->size();
+    lru.push_front({ key, std::move(data) });
+    entries[key] = lru.begin();
+    evict();
+}
+
+void HunkCache::set_capacity(size_t size) {
+    std::lock_guard<std::mutex> guard(lock);
+    capacity = size;
+    evict();
+}
+
+void HunkCache::evict() {
+    /* Images keep their pinned hunks alive, dropping them here is safe. */
+    while (bytes > capacity && !lru.empty()) {
+        bytes -= lru.back().data->size();
+        entries.erase(lru.back().key);
+        lru.pop_back();
+    }
+}
+
+bool CompressedImage::open_file(const std::string& path) {
+    if (!file.open(path)) {
+        printf("[CDROM] Could not map compressed image: %s\n", path.c_str());
+        return false;
+    }
+
+    const uint8_t* base = file.data();
+    size_t size = file.size();
+
+    if (size < HEADER_SIZE || std::memcmp(base, magic, 8) != 0 || get32(base + 8) != FORMAT_VERSION) {
+        printf("[CDROM] Not a compressed disc image: %s\n", path.c_str());
+        return false;
+    }
+
+    hunk_sectors = get32(base + 12);
+    sectors = get32(base + 16);
+    uint32_t track_count = get32(base + 20);
+    hunk_count = get32(base + 24);
+
+    size_t index_offset = HEADER_SIZE + (size_t)track_count * TRACK_SIZE;
+    size_t data_offset = index_offset + ((size_t)hunk_count + 1) * 8;
+    if (hunk_sectors == 0 || data_offset > size ||
+        hunk_count != (sectors + hunk_sectors - 1) / hunk_sectors) {
+        printf("[CDROM] Corrupt compressed image header: %s\n", path.c_str());
+        return false;
+    }
+
+    for (uint32_t i = 0; i < track_count; i++) {
+        const uint8_t* t = base + HEADER_SIZE + i * TRACK_SIZE;
+        tracks.push_back({ get32(t), (TrackType)get32(t + 4), get32(t + 8), get32(t + 12) });
+    }
+
+    index = base + index_offset;
+    if (get64(index + (size_t)hunk_count * 8) > size) {
+        printf("[CDROM] Compressed image is truncated: %s\n", path.c_str());
+        return false;
+    }
+
+    id = HunkCache::instance().image_id(path);
+    return true;
+}
+
+Hunk CompressedImage::load_hunk(uint32_t hunk) {
+    HunkCache& cache = HunkCache::instance();
+    Hunk data = cache.find(id, hunk);
+    if (data)
+        return data;
+
+    /* The last hunk may be short. */
+    uint32_t first = hunk * hunk_sectors;
+    size_t raw_size = (size_t)std::min(hunk_sectors, sectors - first) * SECTOR_SIZE;
+
+    uint64_t begin = get64(index + (size_t)hunk * 8);
+    uint64_t end = get64(index + ((size_t)hunk + 1) * 8);
+
+    auto buffer = std::make_shared<std::vector<uint8_t>>(raw_size, 0);
+    if (end < begin || end > file.size()) {
+        printf("[CDROM] Corrupt hunk index entry %u\n", hunk);
+    }
+    else if (end - begin == raw_size) {
+        /* Stored as is, compressing it did not help. */
+        std::memcpy(buffer->data(), file.data() + begin, raw_size);
+    }
+    else if (!lz::decompress(file.data() + begin, (size_t)(end - begin), buffer->data(), raw_size)) {
+        printf("[CDROM] Corrupt compressed hunk %u\n", hunk);
+        std::fill(buffer->begin(), buffer->end(), 0);
+    }
+
+    cache.insert(id, hunk, buffer);
+    return buffer;
+}
+
+const uint8_t* CompressedImage::read_sector(uint32_t lba) {
+    static const uint8_t zero_sector[SECTOR_SIZE] = {};
+    if (lba >= sectors)
+        return zero_sector;
+
+    uint32_t hunk = lba / hunk_sectors;
+    const uint8_t* base = nullptr;
+
+    for (int i = 0; i < 2; i++) {
+        if (pinned_hunk[i] == hunk)
+            base = pinned[i]->data();
+    }
+
+    if (base == nullptr) {
+        pinned[next_pin] = load_hunk(hunk);
+        pinned_hunk[next_pin] = hunk;
+        base = pinned[next_pin]->data();
+        next_pin ^= 1;
+    }
+
+    return base + (size_t)(lba % hunk_sectors) * SECTOR_SIZE;
+}
+
+void CompressedImage::prefetch(uint32_t lba) {
+    if (lba >= sectors)
+        return;
+
+    /* Only the first sector of a hunk needs to do the work, the */
+    /* hunk the drive is in right now is already decoded. */
+    if (lba % hunk_sectors == 0)
+        load_hunk(lba / hunk_sectors);
+}
+
+bool CompressedImage::create(DiscImage& source, const std::string& path, uint32_t hunk_sectors) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        printf("[CDROM] Could not create compressed image: %s\n", path.c_str());
+        return false;
+    }
+
+    uint32_t sectors = source.sector_count();
+    uint32_t hunk_count = (sectors + hunk_sectors - 1) / hunk_sectors;
+    const std::vector<Track>& tracks = source.get_tracks();
+
+    out.write(magic, 8);
+    put32(out, FORMAT_VERSION);
+    put32(out, hunk_sectors);
+    put32(out, sectors);
+    put32(out, (uint32_t)tracks.size());
+    put32(out, hunk_count);
+    put32(out, 0);
+
+    for (const Track& track : tracks) {
+        put32(out, track.number);
+        put32(out, (uint32_t)track.type);
+        put32(out, track.start);
+        put32(out, track.length);
+    }
+
+    /* The index is written once all hunk sizes are known. */
+    std::streampos index_pos = out.tellp();
+    std::vector<uint64_t> offsets(hunk_count + 1, 0);
+    for (uint32_t i = 0; i <= hunk_count; i++)
+        put64(out, 0);
+
+    std::vector<uint8_t> raw(hunk_sectors * SECTOR_SIZE);
+    std::vector<uint8_t> packed(lz::max_compressed_size(raw.size()));
+
+    for (uint32_t hunk = 0; hunk < hunk_count; hunk++) {
+        uint32_t first = hunk * hunk_sectors;
+        uint32_t count = std::min(hunk_sectors, sectors - first);
+        size_t raw_size = (size_t)count * SECTOR_SIZE;
+
+        for (uint32_t i = 0; i < count; i++)
+            std::memcpy(raw.data() + i * SECTOR_SIZE, source.read_sector(first + i), SECTOR_SIZE);
+
+        offsets[hunk] = (uint64_t)out.tellp();
+
+        /* A compressed hunk must never be exactly raw sized, that means stored. */
+        size_t size = lz::compress(raw.data(), raw_size, packed.data(), packed.size());
+        if (size == 0 || size >= raw_size)
+            out.write(reinterpret_cast<const char*>(raw.data()), raw_size);
+        else
+            out.write(reinterpret_cast<const char*>(packed.data()), size);
+    }
+    offsets[hunk_count] = (uint64_t)out.tellp();
+
+    out.seekp(index_pos);
+    for (uint64_t offset : offsets)
+        put64(out, offset);
+
+    if (!out) {
+        printf("[CDROM] Failed writing compressed image: %s\n", path.c_str());
+        return false;
+    }
+
+    uint64_t raw_total = (uint64_t)sectors * SECTOR_SIZE;
+    printf("[CDROM] Compressed %u sectors: %llu -> %llu bytes (%.1f%%)\n", sectors,
+           (unsigned long long)raw_total, (unsigned long long)offsets[hunk_count],
+           raw_total ? 100.0 * offsets[hunk_count] / raw_total : 0.0);
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "DiscImage.h"
+
+typedef std::shared_ptr<const std::vector<uint8_t>> Hunk;
+
+/* Decompressed hunks, shared by every image opened in the process. */
+/* Images of the same file share entries, the least recently used go first. */
+class HunkCache {
+public:
+    static HunkCache& instance();
+
+    /* Same file (path, size and modification time) -> same id. */
+    uint32_t image_id(const std::string& path);
+
+    Hunk find(uint32_t image, uint32_t hunk);
+    void insert(uint32_t image, uint32_t hunk, Hunk data);
+
+    void set_capacity(size_t bytes);
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+private:
+    struct Entry {
+        uint64_t key;
+        Hunk data;
+    };
+
+    void evict();
+
+    std::mutex lock;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::list<Entry> lru; /* Most recently used first. */
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+    size_t bytes = 0;
+    size_t capacity = 64 * 1024 * 1024;
+};
+
+/*
+ * .pcz images: the disc is cut in hunks of a few sectors, each compressed on
+ * its own with the LZ codec (or stored raw when that does not help). A table
+ * with the file offset of every hunk gives O(1) access to any sector.
+ *
+ * Layout (little endian):
+ *   char magic[8] = "PSEMUCDZ", u32 version, u32 hunk_sectors, u32 sectors,
+ *   u32 track_count, u32 hunk_count, u32 reserved,
+ *   Track tracks[track_count] (4 x u32 each),
+ *   u64 offsets[hunk_count + 1], hunk data.
+ */
+class CompressedImage : public DiscImage {
+public:
+    bool open_file(const std::string& path);
+
+    /* Writes source as a compressed image. */
+    static bool create(DiscImage& source, const std::string& path, uint32_t hunk_sectors = 8);
+
+    const uint8_t* read_sector(uint32_t lba) override;
+    void prefetch(uint32_t lba) override;
+
+private:
+    Hunk load_hunk(uint32_t hunk);
+
+    MappedFile file;
+    const uint8_t* index = nullptr;
+    uint32_t hunk_sectors = 0;
+    uint32_t hunk_count = 0;
+    uint32_t id = 0;
+
+    /* The two last hunks handed out stay alive, the drive may still */
+    /* be reading the previous sector when it loads the next one. */
+    Hunk pinned[2];
+    uint32_t pinned_hunk[2] = { UINT32_MAX, UINT32_MAX };
+    int next_pin = 0;
+};
@@ -6,8 +6,19 @@
  PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
 
 */
+#include <algorithm>
+#include <chrono>
 #include "Memory.h"
 
+static const char* dma_channel_names[7] = {
+    "MDECin", "MDECout", "GPU", "CDROM", "SPU", "PIO", "OTC"
+};
+
+static uint64_t host_ns_since(std::chrono::steady_clock::time_point begin) {
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
 uint32_t set_bit(uint32_t num, int b, bool v) {
     if (v) num |= (1 << b);
     else num &= ~(1 << b);
@@ -36,15 +47,41 @@ void Memory::transfer_finished(DMAChannels dma_channel) {
 
 void Memory::start(DMAChannels dma_channel) {
     DMAChannel& channel = channels[(uint32_t)dma_channel];
-    if (channel.control.sync_mode == SyncType::Linked_List)
+
+    /* MDECout has to wait for its data request, which comes */
+    /* once MDECin delivered the macroblocks. */
+    if (dma_channel == DMAChannels::MDECout && mdec.busy() &&
+        mdec.output_available() < channel.block.block_size * (uint32_t)channel.block.block_count) {
+        mdec_out_pending = true;
+        return;
+    }
+
+    DMAStats& stats = dma_stats[(uint32_t)dma_channel];
+    auto begin = std::chrono::steady_clock::now();
+
+    stats.transfers++;
+    stats.sync_mode[(uint32_t)channel.control.sync_mode]++;
+
+    if (channel.control.sync_mode == SyncType::Linked_List) {
         /* Start linked list copy routine. */
+        /* NOTE: the list is walked in slices from tick(), the transfer */
+        /* is completed by list_finished() once the end marker is seen. */
         list_copy(dma_channel);
-    else
-        /* Start block copy routine. */
-        block_copy(dma_channel);
+        stats.host_ns += host_ns_since(begin);
+        return;
+    }
+
+    /* Start block copy routine. */
+    block_copy(dma_channel);
+    stats.host_ns += host_ns_since(begin);
 
     /* Complete the transfer. */
     transfer_finished(dma_channel);
+
+    if (dma_channel == DMAChannels::MDECin && mdec_out_pending) {
+        mdec_out_pending = false;
+        start(DMAChannels::MDECout);
+    }
 }
 void Memory::block_copy(DMAChannels dma_channel) {
     DMAChannel& channel = channels[(uint32_t)dma_channel];
@@ -69,6 +106,53 @@ void Memory::block_copy(DMAChannels dma_channel) {
     if (sync_mode == SyncType::Request)
         block_size *= channel.block.block_count;
 
+    DMAStats& stats = dma_stats[(uint32_t)dma_channel];
+    if (trans_dir == 0)
+        stats.words_to_ram += block_size;
+    else
+        stats.words_from_ram += block_size;
+
+    /* CD sectors are copied straight from the disc image into RAM. */
+    if (dma_channel == DMAChannels::CDROM && trans_dir == 0 && increment > 0) {
+        uint32_t addr = base_addr & 0x1ffffc;
+        uint32_t bytes = block_size * 4;
+
+        while (bytes > 0) {
+            uint32_t chunk = std::min(bytes, (uint32_t)RAM.length - addr);
+            cddrive.dma_read(&MainRAM[addr], chunk);
+
+            addr = (addr + chunk) & 0x1ffffc;
+            bytes -= chunk;
+        }
+        block_size = 0;
+    }
+
+    /* GP0 words go over in runs, so VRAM uploads are copied a row at a time. */
+    if (dma_channel == DMAChannels::GPU && trans_dir == 1 && increment > 0) {
+        uint32_t addr = base_addr & 0x1ffffc;
+
+        while (block_size > 0) {
+            uint32_t words = std::min(block_size, ((uint32_t)RAM.length - addr) / 4);
+            gpu.write_gp0_block(reinterpret_cast<const uint32_t*>(&MainRAM[addr]), words);
+
+            addr = (addr + words * 4) & 0x1ffffc;
+            block_size -= words;
+        }
+    }
+
+    /* VRAM downloads are packed already, copy them out in runs as well. */
+    if (dma_channel == DMAChannels::GPU && trans_dir == 0 && increment > 0) {
+        uint32_t addr = base_addr & 0x1ffffc;
+
+        while (block_size > 0) {
+            uint32_t words = std::min(block_size, ((uint32_t)RAM.length - addr) / 4);
+            gpu.read_gpuread_block(reinterpret_cast<uint32_t*>(&MainRAM[addr]), words);
+
+            addr = (addr + words * 4) & 0x1ffffc;
+            block_size -= words;
+        }
+    }
+
     while (block_size > 0) {
         uint32_t addr = base_addr & 0x1ffffc;
 
@@ -84,9 +168,14 @@ void Memory::block_copy(DMAChannels dma_channel) {
                     case DMAChannels::GPU:
                         data = gpu.get_gpuread();
                         break;
+                    case DMAChannels::MDECout:
+                        data = mdec.read_data();
+                        break;
                     case DMAChannels::CDROM:
-                        //data = bus->cddrive->read_word();
-                        printf("PLEASE IMPLEMENT THE CD DRIVE!!!\n");
+                        data = cddrive.read_word();
+                        break;
+                    case DMAChannels::SPU:
+                        data = spu.dma_read();
                         break;
                     default:
                         printf("Unhandled DMA source channel: 0x%x\n", dma_channel);
@@ -102,6 +191,12 @@ void Memory::block_copy(DMAChannels dma_channel) {
                     case DMAChannels::GPU:
                         gpu.write_gp0(command);
                         break;
+                    case DMAChannels::MDECin:
+                        mdec.write_command(command);
+                        break;
+                    case DMAChannels::SPU:
+                        spu.dma_write(command);
+                        break;
                     default:
                         break;
                 }
@@ -118,22 +213,44 @@ void Memory::block_copy(DMAChannels dma_channel) {
 }
 void Memory::list_copy(DMAChannels dma_channel) {
     DMAChannel& channel = channels[(uint32_t)dma_channel];
-    uint addr = channel.base & 0x1ffffe;
 
     /* TODO: implement Device to Ram DMA transfer. */
     if (channel.control.trans_dir == 0) {
         printf("Not supported DMA direction!\n");
     }
 
-    /* While not reached the end. */
-    while (true) {
+    /* Forget the nodes seen by the previous list. */
+    std::fill(list_visited.begin(), list_visited.end(), 0);
+
+    list_state.active = true;
+    list_state.channel = dma_channel;
+    list_state.addr = channel.base & 0x1ffffc;
+
+    /* Walk the first slice right away, the rest is done by tick(). */
+    list_step();
+}
+void Memory::list_step() {
+    DMAStats& stats = dma_stats[(uint32_t)list_state.channel];
+    uint addr = list_state.addr;
+
+    for (uint32_t packets = 0; packets < LIST_PACKETS_PER_TICK; packets++) {
+        /* A node we already walked means the list is circular. */
+        uint node = addr >> 2;
+        uint64_t bit = 1ULL << (node & 63);
+        if (list_visited[node >> 6] & bit) {
+            printf("[DMA] list_copy: cycle detected at 0x%x, terminating list\n", addr);
+            list_finished();
+            return;
+        }
+        list_visited[node >> 6] |= bit;
+
         /* Get the list packet header. */
         ListPacket packet;
         packet.raw = readWord(addr);
         uint count = packet.size;
 
-        /*if (count > 0)
-            printf("Packet size: %d\n", count);*/
+        stats.list_packets++;
+        stats.words_from_ram += count;
 
         /* Read words of the packet. */
         while (count > 0) {
@@ -150,17 +267,29 @@ void Memory::list_copy(DMAChannels dma_channel) {
 
         /* If address is 0xffffff then we are done. */
         /* NOTE: mednafen only checks for the MSB, but I do no know why. */
-
-        if (packet.next_addr & (1 << 23))
-            break;
+        if (packet.next_addr & (1 << 23)) {
+            list_finished();
+            return;
+        }
 
         /* Mask address. */
         addr = packet.next_addr & 0x1ffffc;
     }
 
+    /* Out of budget, resume from here on the next tick. */
+    list_state.addr = addr;
+}
+void Memory::list_finished() {
+    DMAChannels dma_channel = list_state.channel;
+    DMAChannel& channel = channels[(uint32_t)dma_channel];
+
+    list_state.active = false;
+
     /* Complete DMA Transfer */
     channel.control.enable = false;
     channel.control.trigger = false;
+
+    transfer_finished(dma_channel);
 }
 
 uint32_t Memory::DMAread(uint32_t address) {
@@ -258,7 +387,55 @@ void Memory::write(uint32_t address, uint32_t val) {
         start((DMAChannels)active_channel);
 }
 
+const DMAStats& Memory::get_dma_stats(DMAChannels channel) const {
+    return dma_stats[(uint32_t)channel];
+}
+
+void Memory::dump_dma_stats() const {
+    printf("[DMA] channel   transfers  manual  request  list  words_to_ram  words_from_ram  packets   host_ms\n");
+
+    for (int i = 0; i < 7; i++) {
+        const DMAStats& stats = dma_stats[i];
+        printf("[DMA] %-8s %10llu %7llu %8llu %5llu %13llu %15llu %8llu %9.3f\n",
+               dma_channel_names[i],
+               (unsigned long long)stats.transfers,
+               (unsigned long long)stats.sync_mode[(uint32_t)SyncType::Manual],
+               (unsigned long long)stats.sync_mode[(uint32_t)SyncType::Request],
+               (unsigned long long)stats.sync_mode[(uint32_t)SyncType::Linked_List],
+               (unsigned long long)stats.words_to_ram,
+               (unsigned long long)stats.words_from_ram,
+               (unsigned long long)stats.list_packets,
+               stats.host_ns / 1e6);
+    }
+}
+
 void Memory::tick() {
+    cycles += CYCLES_PER_TICK;
+
+    /* The root counters only need a look once the earliest IRQ is due. */
+    if (cycles >= timers.next_deadline) {
+        set_timer_video();
+        regs->i_stat |= timers.update(cycles);
+    }
+
+    if (cycles >= gpu.next_vblank() && gpu.tick(cycles))
+        regs->i_stat |= 1;
+
+    /* Continue a linked list transfer that ran out of budget. */
+    if (list_state.active) {
+        auto begin = std::chrono::steady_clock::now();
+        DMAStats& stats = dma_stats[(uint32_t)list_state.channel];
+
+        list_step();
+        stats.host_ns += host_ns_since(begin);
+    }
+
+    if (cddrive.tick(CYCLES_PER_TICK))
+        regs->i_stat |= (1 << (uint32_t)2);
+
+    if (spu.tick(CYCLES_PER_TICK, cddrive.xa_samples, cddrive.xa_sample_rate))
+        regs->i_stat |= (1 << (uint32_t)9);
+
     if (irq_pending) {
         irq_pending = false;
         regs->i_stat |= (1 << (uint32_t)3);
@@ -0,0 +1,321 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "DiscImage.h"
+#include "CompressedImage.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint8_t zero_sector[SECTOR_SIZE] = {};
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        close();
+        return false;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        close();
+        return false;
+    }
+
+    base = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (base == nullptr) {
+        close();
+        return false;
+    }
+
+    length = (size_t)file_size.QuadPart;
+    return true;
+}
+
+void MappedFile::close() {
+    if (base != nullptr)
+        UnmapViewOfFile(base);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+    if (file != nullptr)
+        CloseHandle(file);
+
+    base = nullptr;
+    mapping = nullptr;
+    file = nullptr;
+    length = 0;
+}
+#else
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    /* The mapping keeps the file alive, the descriptor is not needed. */
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (view == MAP_FAILED)
+        return false;
+
+    base = static_cast<const uint8_t*>(view);
+    length = (size_t)info.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (base != nullptr)
+        munmap(const_cast<uint8_t*>(base), length);
+
+    base = nullptr;
+    length = 0;
+}
+#endif
+
+std::unique_ptr<DiscImage> DiscImage::open(const std::string& path) {
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    if (ext == ".pcz") {
+        auto image = std::make_unique<CompressedImage>();
+        if (!image->open_file(path))
+            return nullptr;
+
+        return image;
+    }
+
+    auto image = std::make_unique<BinCueImage>();
+    bool ok = (ext == ".cue") ? image->open_cue(path) : image->open_bin(path);
+
+    if (!ok)
+        return nullptr;
+
+    return image;
+}
+
+static uint32_t parse_msf(const std::string& msf) {
+    uint32_t mm = 0, ss = 0, ff = 0;
+    if (sscanf(msf.c_str(), "%u:%u:%u", &mm, &ss, &ff) != 3)
+        return 0;
+
+    return (mm * 60 + ss) * 75 + ff;
+}
+
+bool BinCueImage::open_cue(const std::string& path) {
+    std::ifstream cue(path);
+    if (!cue) {
+        printf("[CDROM] Could not open cue sheet: %s\n", path.c_str());
+        return false;
+    }
+
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    std::string line;
+
+    while (std::getline(cue, line)) {
+        std::istringstream in(line);
+        std::string keyword;
+        in >> keyword;
+
+        if (keyword == "FILE") {
+            /* FILE "name.bin" BINARY, the name may contain spaces. */
+            size_t first = line.find('"');
+            size_t last = line.rfind('"');
+            std::string name = (first != std::string::npos && last > first) ?
+                line.substr(first + 1, last - first - 1) :
+                line.substr(5, line.rfind(' ') - 5);
+
+            BinFile file;
+            file.map = std::make_unique<MappedFile>();
+            if (!file.map->open((dir / name).string())) {
+                printf("[CDROM] Could not map track file: %s\n", name.c_str());
+                return false;
+            }
+
+            file.start = files.empty() ? 0 : files.back().start + files.back().sectors;
+            file.sectors = (uint32_t)(file.map->size() / SECTOR_SIZE);
+            files.push_back(std::move(file));
+        }
+        else if (keyword == "TRACK") {
+            uint32_t number = 0;
+            std::string type;
+            in >> number >> type;
+
+            Track track = {};
+            track.number = number;
+            track.type = (type == "AUDIO") ? TrackType::Audio :
+                         (type.rfind("MODE1", 0) == 0) ? TrackType::Mode1 : TrackType::Mode2;
+
+            if (type.find("/2352") == std::string::npos && type != "AUDIO")
+                printf("[CDROM] Only raw 2352 byte tracks are supported, got %s\n", type.c_str());
+
+            tracks.push_back(track);
+        }
+        else if (keyword == "PREGAP") {
+            std::string msf;
+            in >> msf;
+
+            /* The gap is not stored in the file, so it starts that much later. */
+            /* NOTE: only right for the first track of a file, like every */
+            /* PREGAP we have seen in the wild. */
+            if (!files.empty())
+                files.back().start += parse_msf(msf);
+        }
+        else if (keyword == "INDEX") {
+            uint32_t index = 0;
+            std::string msf;
+            in >> index >> msf;
+
+            if (index == 1 && !tracks.empty() && !files.empty())
+                tracks.back().start = files.back().start + parse_msf(msf);
+        }
+    }
+
+    if (files.empty() || tracks.empty()) {
+        printf("[CDROM] Cue sheet has no tracks: %s\n", path.c_str());
+        return false;
+    }
+
+    sectors = files.back().start + files.back().sectors;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        uint32_t end = (i + 1 < tracks.size()) ? tracks[i + 1].start : sectors;
+        tracks[i].length = end - tracks[i].start;
+    }
+
+    return true;
+}
+
+bool BinCueImage::open_bin(const std::string& path) {
+    BinFile file;
+    file.map = std::make_unique<MappedFile>();
+    if (!file.map->open(path)) {
+        printf("[CDROM] Could not map disc image: %s\n", path.c_str());
+        return false;
+    }
+
+    file.start = 0;
+    file.sectors = (uint32_t)(file.map->size() / SECTOR_SIZE);
+    sectors = file.sectors;
+    files.push_back(std::move(file));
+
+    tracks.push_back({ 1, TrackType::Mode2, 0, sectors });
+    return true;
+}
+
+const BinCueImage::BinFile* BinCueImage::find_file(uint32_t lba) const {
+    for (const BinFile& file : files) {
+        if (lba >= file.start && lba < file.start + file.sectors)
+            return &file;
+    }
+
+    return nullptr;
+}
+
+const uint8_t* BinCueImage::read_sector(uint32_t lba) {
+    const BinFile* file = find_file(lba);
+    if (file == nullptr)
+        return zero_sector;
+
+    return file->map->data() + (size_t)(lba - file->start) * SECTOR_SIZE;
+}
+
+void BinCueImage::prefetch(uint32_t lba) {
+    const BinFile* file = find_file(lba);
+    if (file == nullptr)
+        return;
+
+    /* Reading one byte per page is enough to fault the sector in. */
+    const volatile uint8_t* sector = file->map->data() + (size_t)(lba - file->start) * SECTOR_SIZE;
+    for (size_t offset = 0; offset < SECTOR_SIZE; offset += 4096)
+        (void)sector[offset];
+    (void)sector[SECTOR_SIZE - 1];
+}
+
+ReadAhead::ReadAhead(DiscImage* image, uint32_t sectors) :
+    image(image), sectors(sectors), worker(&ReadAhead::run, this) {}
+
+ReadAhead::~ReadAhead() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void ReadAhead::hint(uint32_t lba, int dir) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        target = lba;
+        direction = dir;
+        pending = true;
+    }
+    wake.notify_one();
+}
+
+void ReadAhead::run() {
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true) {
+        wake.wait(guard, [this] { return pending || quit; });
+        if (quit)
+            return;
+
+        uint32_t lba = target;
+        int dir = direction;
+        pending = false;
+
+        guard.unlock();
+        for (uint32_t i = 1; i <= sectors; i++) {
+            int64_t next = (int64_t)lba + (int64_t)dir * i;
+            if (next < 0 || next >= image->sector_count())
+                break;
+
+            image->prefetch((uint32_t)next);
+
+            /* The drive moved on, start again from its new position. */
+            if (pending || quit)
+                break;
+        }
+        guard.lock();
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* Raw CD sector: sync, header, subheader, data and EDC/ECC. */
+const size_t SECTOR_SIZE = 2352;
+
+/* LBA 0 is the first sector after the 2 second lead-in (MSF 00:02:00). */
+const uint32_t LEAD_IN_SECTORS = 150;
+
+enum class TrackType : uint32_t {
+    Audio,
+    Mode1,
+    Mode2
+};
+
+struct Track {
+    uint32_t number;
+    TrackType type;
+    uint32_t start; /* LBA of INDEX 01. */
+    uint32_t length; /* In sectors. */
+};
+
+/* Maps a whole file read only, sectors are then plain pointers into it. */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+class DiscImage {
+public:
+    virtual ~DiscImage() = default;
+
+    /* Opens a .cue sheet, a compressed .pcz or a bare single track .bin. */
+    static std::unique_ptr<DiscImage> open(const std::string& path);
+
+    /* Returns the raw 2352 byte sector, or a zeroed one outside the tracks. */
+    /* The pointer stays valid at least until the second call after this one. */
+    virtual const uint8_t* read_sector(uint32_t lba) = 0;
+
+    /* Brings the sector into memory without using it. Called from the */
+    /* read-ahead thread, so it has to be safe next to read_sector. */
+    virtual void prefetch(uint32_t lba) = 0;
+
+    uint32_t sector_count() const { return sectors; }
+    const std::vector<Track>& get_tracks() const { return tracks; }
+
+protected:
+    std::vector<Track> tracks;
+    uint32_t sectors = 0;
+};
+
+/* One or more BIN files described by a CUE sheet, all memory mapped. */
+class BinCueImage : public DiscImage {
+public:
+    bool open_cue(const std::string& path);
+    bool open_bin(const std::string& path);
+
+    const uint8_t* read_sector(uint32_t lba) override;
+    void prefetch(uint32_t lba) override;
+
+private:
+    struct BinFile {
+        std::unique_ptr<MappedFile> map;
+        uint32_t start; /* LBA of the first sector in the file. */
+        uint32_t sectors;
+    };
+
+    const BinFile* find_file(uint32_t lba) const;
+
+    std::vector<BinFile> files;
+};
+
+/* Touches the sectors ahead of the drive on a helper thread, so the */
+/* emulation thread does not stall on page faults from cold storage. */
+class ReadAhead {
+public:
+    ReadAhead(DiscImage* image, uint32_t sectors);
+    ~ReadAhead();
+
+    /* The drive just read lba, moving in direction (+1 or -1). */
+    void hint(uint32_t lba, int direction);
+
+private:
+    void run();
+
+    DiscImage* image;
+    uint32_t sectors;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    uint32_t target = 0;
+    int direction = 1;
+    std::atomic<bool> pending = false;
+    std::atomic<bool> quit = false;
+
+    std::thread worker;
+};
@@ -6,50 +6,161 @@
  PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
 
 */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include "GPU.h"
 
-template<int bi>
-uint32_t sl(uint32_t value) {
-    enum { mask = (1 << bi) - 1 };
-    enum { sign = 1 << (bi - 1) };
-
-    return ((value & mask) ^ sign) - sign;
-}
-
 GPU::GPU() {
     GPU_status.value = 0x14802000;
 
-    cpu_to_gpu.active = false;
-    gpu_to_cpu.active = false;
+    drawing_area_top_left = glm::u16vec2(0, 0);
+    drawing_area_bottom_right = glm::u16vec2(VRAM::WIDTH - 1, VRAM::HEIGHT - 1);
+    draw_offset = glm::i16vec2(0, 0);
+    texture_window_mask = glm::u8vec2(0, 0);
+    texture_window_offset = glm::u8vec2(0, 0);
+    textured_rectangle_flip = glm::bvec2(false, false);
 
     command = GPUCommand::None;
+    publish_status();
+}
+
+/* address is the offset from 0x1f801810. */
+uint32_t GPU::read(uint32_t address, uint64_t now) {
+    return address == 0 ? get_gpuread() : get_gpustat(now);
+}
+
+void GPU::write(uint32_t address, uint32_t data, uint64_t now) {
+    if (address == 0)
+        write_gp0(data);
+    else
+        write_gp1(data, now);
+}
+
+void GPU::write_gp0(uint32_t data) {
+    if (gp0_log.is_open())
+        gp0_log.write(reinterpret_cast<const char*>(&data), sizeof(data));
+
+    if (render_thread)
+        render_thread->push(GPUPort::GP0, data);
+    else {
+        execute_gp0(data);
+        publish_status();
+    }
+}
+
+void GPU::write_gp0_block(const uint32_t* words, size_t count) {
+    if (gp0_log.is_open())
+        gp0_log.write(reinterpret_cast<const char*>(words), count * sizeof(uint32_t));
+
+    if (render_thread) {
+        for (size_t i = 0; i < count; i++)
+            render_thread->push(GPUPort::GP0, words[i]);
+        return;
+    }
+
+    while (count > 0) {
+        size_t used = 1;
+        if (transfer.uploading())
+            used = transfer.upload(words, count);
+        else
+            execute_gp0(words[0]);
+
+        words += used;
+        count -= used;
+    }
+    publish_status();
+}
+
+void GPU::write_gp1(uint32_t data, uint64_t now) {
+    /* The display timing belongs to the CPU side and changes right away, */
+    /* the rest goes through the command processor like GP0 does.         */
+    switch (data >> 24) {
+    case 0x00:
+        display_mode = 0;
+        video.reset(now);
+        break;
+    case 0x06:
+        video.set_horizontal_range(data & 0xfff, (data >> 12) & 0xfff);
+        break;
+    case 0x07:
+        video.set_vertical_range(data & 0x3ff, (data >> 10) & 0x3ff, now);
+        break;
+    case 0x08:
+        display_mode = data & 0xff;
+        video.set_mode((data >> 3) & 1, (data >> 5) & 1, (data >> 2) & 1, now);
+        break;
+    }
+
+    if (render_thread)
+        render_thread->push(GPUPort::GP1, data);
+    else {
+        execute_gp1(data);
+        publish_status();
+    }
 }
 
-uint32_t GPU::read(uint32_t address) {
-    // Empty Implementation
-    return 0;
+void GPU::set_threaded(bool threaded) {
+    if (threaded && !render_thread)
+        render_thread = std::make_unique<GPUThread>(*this);
+    else if (!threaded)
+        render_thread.reset();
 }
 
-void GPU::write(uint32_t address, uint32_t data) {
-    // Empty Implementation
+void GPU::sync() {
+    if (render_thread)
+        render_thread->fence();
+    else
+        rasterizer.flush();
+}
+
+DirtyBlocks GPU::take_vram_dirty() {
+    sync();
+    return vram.take_dirty();
+}
+
+bool GPU::record_gp0(const std::string& path) {
+    gp0_log.open(path, std::ios::binary);
+    return gp0_log.is_open();
 }
 
 uint32_t GPU::get_gpuread() {
-    // Empty Implementation
-    return 0;
+    /* The download is packed when GP0(C0) runs, which may still be queued. */
+    sync();
+
+    uint32_t data = transfer.download_word();
+    if (GPU_status.ready_vram && !transfer.downloading())
+        publish_status();
+    return data;
 }
 
-uint32_t GPU::get_gpustat() {
-    // Empty Implementation
-    return 0;
+void GPU::read_gpuread_block(uint32_t* words, size_t count) {
+    sync();
+
+    size_t copied = transfer.download(words, count);
+    std::fill(words + copied, words + count, transfer.last_word());
+
+    if (GPU_status.ready_vram && !transfer.downloading())
+        publish_status();
 }
 
-void GPU::vram_transfer(uint16_t data) {
-    // Empty
+uint32_t GPU::get_gpustat(uint64_t now) {
+    return (status_snapshot.load(std::memory_order_acquire) & ~GPUSTAT_TIMING_BITS) | video.status_bits(now);
 }
-uint16_t GPU::vram_transfer() {
-    // Empty
-    return 0;
+
+void GPU::publish_status() {
+    GPU_status.ready_cmd = fifo.empty() && !transfer.uploading() && !polyline.active;
+    GPU_status.ready_vram = transfer.downloading();
+    GPU_status.ready_dma = fifo.size() < GP0Fifo::CAPACITY;
+
+    switch (GPU_status.dma_dir) {
+    case 0: GPU_status.dma_request = 0; break;
+    case 1: GPU_status.dma_request = fifo.size() < GP0Fifo::CAPACITY; break;
+    case 2: GPU_status.dma_request = GPU_status.ready_dma; break;
+    case 3: GPU_status.dma_request = GPU_status.ready_vram; break;
+    }
+
+    status_snapshot.store(GPU_status.value, std::memory_order_release);
 }
 
 glm::ivec3 GPU::extract_color(uint32_t color) {
@@ -75,7 +186,54 @@ glm::ivec2 GPU::extract_coord(uint32_t coord) {
     return p;
 }
 
-bool GPU::tick(uint32_t cycles) {
-    std::cout << "Warning: GPU tick is not implemented.";
-    return false;
-}
\ No newline at end of file
+bool GPU::tick(uint64_t now) {
+    return video.update(now);
+}
+
+bool bench_gp0_stream(const std::string& path, uint32_t iterations) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        printf("[GPU] Could not open GP0 stream: %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<uint32_t> words((size_t)file.tellg() / sizeof(uint32_t));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(words.data()), words.size() * sizeof(uint32_t));
+
+    const unsigned threads[] = { 1, 2, 4, 8 };
+    std::vector<uint16_t> reference;
+    double base = 0;
+    bool ok = true;
+
+    for (unsigned count : threads) {
+        auto gpu = std::make_unique<GPU>();
+        gpu->rasterizer.set_threads(count);
+
+        auto begin = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < iterations; i++) {
+            for (uint32_t word : words)
+                gpu->write_gp0(word);
+        }
+        gpu->sync();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        std::vector<uint16_t> pixels;
+        for (uint32_t y = 0; y < VRAM::HEIGHT; y++)
+            pixels.insert(pixels.end(), gpu->vram.row(y), gpu->vram.row(y) + VRAM::WIDTH);
+
+        bool match = true;
+        if (count == 1) {
+            reference = pixels;
+            base = seconds;
+        } else {
+            match = pixels == reference;
+        }
+
+        ok &= match;
+        printf("[GPU] %u thread%s %8.3f s  %5.2fx%s\n", count, count == 1 ? " " : "s", seconds,
+               base / seconds, match ? "" : "  MISMATCH");
+    }
+
+    return ok;
+}
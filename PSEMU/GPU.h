@@ -8,9 +8,28 @@
 */
 #pragma once
 #include "VRAM.h"
+#include "TiledRasterizer.h"
+#include "GPUThread.h"
+#include "VRAMTransfer.h"
+#include "VideoTiming.h"
 #include "glm/glm/glm.hpp"
 #include "glad/glad/glad.h"
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
 #include <utility>
+#include <vector>
+
+/* Sign extends the low bi bits. */
+template<int bi>
+uint32_t sl(uint32_t value) {
+    enum { mask = (1 << bi) - 1 };
+    enum { sign = 1 << (bi - 1) };
+
+    return ((value & mask) ^ sign) - sign;
+}
 
 struct Vertex {
     glm::vec3 color;
@@ -34,13 +53,8 @@ union GPUSTATUS {
         uint32_t field : 1;
         uint32_t reverse_flag : 1;
         uint32_t texture_disable : 1;
-
-        union {
-            uint32_t hres : 3;
-
-            struct { uint32_t hres2 : 1; uint32_t hres1 : 2; };
-        };
-
+        uint32_t hres2 : 1;
+        uint32_t hres1 : 2;
         uint32_t vres : 1;
         uint32_t video_mode : 1;
         uint32_t color_depth : 1;
@@ -56,11 +70,93 @@ union GPUSTATUS {
     };
 };
 
-struct DatMov {
-    uint8_t start_x, start_y;
-    uint8_t width, height;
-    uint8_t pos_x, pos_y;
-    bool active;
+static_assert(sizeof(GPUSTATUS) == 4);
+
+/* GPUSTAT bits that follow the beam rather than the command processor. */
+const uint32_t GPUSTAT_TIMING_BITS = (1u << 13) | (1u << 31);
+
+/* Words in a GP0 command, from its opcode. Polylines give their first segment. */
+constexpr uint32_t gp0_command_length(uint32_t opcode) {
+    switch (opcode >> 5) {
+    case 1: { /* Polygons: colour, vertex, [texture coordinate], then [colour] per further vertex. */
+        uint32_t vertices = (opcode & 0x08) ? 4 : 3;
+        uint32_t per_vertex = (opcode & 0x04) ? 2 : 1;
+        uint32_t colors = (opcode & 0x10) ? vertices - 1 : 0;
+        return 1 + vertices * per_vertex + colors;
+    }
+    case 2: /* Lines: colour, vertex, [colour], vertex. */
+        return (opcode & 0x10) ? 4 : 3;
+    case 3: /* Rectangles: colour, vertex, [texture coordinate], [size]. */
+        return 2 + ((opcode & 0x04) ? 1 : 0) + (((opcode >> 3) & 0x3) == 0 ? 1 : 0);
+    case 4:
+        return 4;
+    case 5:
+    case 6:
+        return 3;
+    default:
+        return opcode == 0x02 ? 3 : 1;
+    }
+}
+
+inline constexpr std::array<uint8_t, 256> GP0_COMMAND_LENGTH = [] {
+    std::array<uint8_t, 256> lengths = {};
+    for (uint32_t opcode = 0; opcode < 256; opcode++)
+        lengths[opcode] = (uint8_t)gp0_command_length(opcode);
+    return lengths;
+}();
+
+static_assert(GP0_COMMAND_LENGTH[0x3E] == 12 && GP0_COMMAND_LENGTH[0x64] == 4 && GP0_COMMAND_LENGTH[0x02] == 3);
+
+/*
+ * GP0 words waiting for the rest of their command. Like the GPU's own
+ * 16 word FIFO, words pushed while it is full are dropped; they are
+ * counted in overflows. No command is longer than 12 words, polylines
+ * are drawn a segment at a time.
+ */
+class GP0Fifo {
+public:
+    static const uint32_t CAPACITY = 16;
+
+    bool push(uint32_t word) {
+        if (count == CAPACITY) {
+            overflows++;
+            return false;
+        }
+
+        words[(head + count++) & (CAPACITY - 1)] = word;
+        return true;
+    }
+
+    uint32_t operator[](uint32_t index) const { return words[(head + index) & (CAPACITY - 1)]; }
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    void pop(uint32_t words_done) {
+        head = (head + words_done) & (CAPACITY - 1);
+        count -= words_done;
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+    uint64_t overflows = 0;
+
+private:
+    std::array<uint32_t, CAPACITY> words = {};
+    uint32_t head = 0;
+    uint32_t count = 0;
+};
+
+/* A polyline past its first segment: every further word is a colour or a vertex. */
+struct PolylineState {
+    bool active = false;
+    bool shaded = false;
+    bool want_color = false; /* Shaded polylines send a colour before each vertex. */
+    uint32_t color = 0;
+    RasterVertex from = {};
+    RasterPrim prim;
 };
 
 enum class GPUCommand : uint32_t {
@@ -80,22 +176,65 @@ class GPU {
 public:
     GPU();
 
-    uint32_t read(uint32_t address);
-    void write(uint32_t address, uint32_t data);
+    /* now is the CPU cycle count, GPUSTAT and the display timing follow it. */
+    uint32_t read(uint32_t address, uint64_t now);
+    void write(uint32_t address, uint32_t data, uint64_t now);
 
     glm::ivec3 extract_color(uint32_t color);
     glm::ivec2 extract_point(uint32_t point);
     glm::ivec2 extract_coord(uint32_t coord);
 
-    // GPU commands.
+    // GPU commands. In threaded mode the writes are queued for the render thread.
     void write_gp0(uint32_t data);
-    void write_gp1(uint32_t data);
+    void write_gp1(uint32_t data, uint64_t now);
+
+    /* A run of GP0 words, as sent by DMA. VRAM uploads take whole rows out of it. */
+    void write_gp0_block(const uint32_t* words, size_t count);
     uint32_t get_gpuread();
-    uint32_t get_gpustat();
 
-    void vram_transfer(uint16_t data);
-    uint16_t vram_transfer();
-    bool tick(uint32_t cycles);
+    /* count GPUREAD words at once, as read by DMA. */
+    void read_gpuread_block(uint32_t* words, size_t count);
+
+    /* The published snapshot with the field and odd line bits for now: no locks, no sync. */
+    uint32_t get_gpustat(uint64_t now);
+
+    /* Run the command processor on its own thread. Off by default. */
+    void set_threaded(bool threaded);
+    bool threaded() const { return render_thread != nullptr; }
+
+    /* Waits until every queued command has run and been drawn, so GPU state can be read directly. */
+    void sync();
+
+    /* VRAM blocks written since the last call, after every queued command ran. */
+    DirtyBlocks take_vram_dirty();
+
+    /* Appends every GP0 word to a file, for bench_gp0_stream. */
+    bool record_gp0(const std::string& path);
+
+    /* Command processor, on the render thread when threaded. */
+    void execute_gp0(uint32_t data);
+    void execute_gp1(uint32_t data);
+
+    /* GP1(00) and GP1(01). */
+    void reset();
+    void reset_command_buffer();
+
+    /* GP1(10): one of the GP0 registers, or the GPU version, latched for GPUREAD. */
+    uint32_t gpu_info(uint32_t index);
+
+    /* GPUSTAT as of the last executed batch, safe to read from any thread. */
+    /* Publishing fills in the ready and DMA request bits from the queues. */
+    void publish_status();
+    GPUSTATUS get_status_snapshot() const { GPUSTATUS s; s.value = status_snapshot.load(std::memory_order_acquire); return s; }
+
+    /* Called once the CPU cycle count reaches next_vblank(), true when vblank began. */
+    bool tick(uint64_t now);
+    uint64_t next_vblank() const { return video.next_deadline; }
+
+    /* Dotclock divider and video standard of the last GP1(08), for the root counters. */
+    /* Taken from the CPU's write, the status snapshot lags it when threaded.         */
+    uint32_t dot_divider() const { return dotClockDiv[(display_mode & 0x40) ? 4 : (display_mode & 3)]; }
+    bool pal() const { return display_mode & 0x08; }
 
     // GP0 commands.
     void gp0_nop();
@@ -111,10 +250,17 @@ public:
     void gp0_image_store();
     void gp0_image_transfer();
 
-    // GP0 Render Functions
-    void gp0_render_polygon();
-    void gp0_render_rect();
-    void gp0_render_line();
+    // GP0 Render Functions, one instantiation per opcode.
+    template<uint32_t opcode> void gp0_render_polygon();
+    template<uint32_t opcode> void gp0_render_rect();
+    template<uint32_t opcode> void gp0_render_line();
+    void gp0_polyline_word(uint32_t data);
+    void gp0_unknown();
+
+    /* Rasterizer state from the GP0 registers and GPUSTAT. */
+    void update_draw_env();
+    RasterPrim texpage_prim(uint32_t texpage, uint32_t clut, bool textured, bool raw);
+    RasterVertex extract_vertex(uint32_t color, uint32_t point, uint32_t coord);
 
     // GP0 registers.
     glm::u8vec2 texture_window_mask;
@@ -129,8 +275,8 @@ public:
     glm::u16vec2 display_area_bottom_right;
     glm::bvec2 textured_rectangle_flip;
 
-    DatMov cpu_to_gpu, gpu_to_cpu;
     GPUCommand command;
+    std::array<uint32_t, 256> unknown_gp0 = {}; /* Times each unknown opcode was sent. */
     GPUSTATUS GPU_status;
 
     int height[2] = { 240, 480 };
@@ -138,9 +284,21 @@ public:
     int width[7] = { 256, 368, 320, 0, 512, 0, 640 };
     int dotClockDiv[5] = { 10, 8, 5, 4, 7 };
 
-    static int command_size[16 * 16];
-
-    std::vector<uint32_t> fifo;
+    GP0Fifo fifo;
+    PolylineState polyline;
     VRAM vram;
+    TiledRasterizer rasterizer = TiledRasterizer(vram);
+    VRAMTransfer transfer = VRAMTransfer(vram);
+    VideoTiming video;
+    uint32_t display_mode = 0; /* GP1(08) as written, on the CPU side. */
     std::vector<Vertex> vertexData;
-};
\ No newline at end of file
+
+    std::atomic<uint32_t> status_snapshot = 0;
+    std::ofstream gp0_log;
+
+    /* Last, so the thread is joined before the state it draws with goes away. */
+    std::unique_ptr<GPUThread> render_thread;
+};
+
+/* Replays a recorded GP0 stream with 1, 2, 4 and 8 raster threads, false if VRAM differs. */
+bool bench_gp0_stream(const std::string& path, uint32_t iterations);
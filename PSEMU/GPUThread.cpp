@@ -0,0 +1,119 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <cstdio>
+#include "GPUThread.h"
+#include "GPU.h"
+
+/* Empty polls before the render thread goes to sleep. */
+const uint32_t SPIN_POLLS = 256;
+
+GPUThread::GPUThread(GPU& gpu) : gpu(gpu), ring(RING_WORDS), mask(RING_WORDS - 1),
+    worker(&GPUThread::run, this) {}
+
+GPUThread::~GPUThread() {
+    /* Everything queued before the quit word still runs. */
+    push(GPUPort::Quit, 0);
+    worker.join();
+
+    printf("[GPU] render thread: %llu words, %llu full waits, %llu fences (%llu waited), %llu sleeps\n",
+           (unsigned long long)stats.words, (unsigned long long)stats.full_waits,
+           (unsigned long long)stats.fences, (unsigned long long)stats.fence_waits,
+           (unsigned long long)stats.sleeps);
+}
+
+void GPUThread::push(GPUPort port, uint32_t data) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+
+    if (h - tail.load(std::memory_order_acquire) >= ring.size()) {
+        stats.full_waits++;
+        while (h - tail.load(std::memory_order_acquire) >= ring.size())
+            std::this_thread::yield();
+    }
+
+    ring[h & mask] = { data, port };
+    head.store(h + 1, std::memory_order_seq_cst);
+    stats.words++;
+
+    /* Pairs with the sleeping store in run(): either the render thread */
+    /* sees the new head before it sleeps, or we see it sleeping.       */
+    if (sleeping.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> guard(lock);
+        wake.notify_one();
+    }
+}
+
+void GPUThread::fence() {
+    stats.fences++;
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (flushed.load(std::memory_order_acquire) >= h)
+        return;
+
+    stats.fence_waits++;
+    fence_target.store(h, std::memory_order_seq_cst);
+
+    /* Same pairing as in push(), the render thread may be asleep with full bins. */
+    if (sleeping.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> guard(lock);
+        wake.notify_one();
+    }
+
+    while (flushed.load(std::memory_order_acquire) < h)
+        std::this_thread::yield();
+}
+
+void GPUThread::run() {
+    uint32_t polls = 0;
+
+    while (true) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+
+        if (t == h) {
+            /* Only a waiting fence cuts the tile batch short. */
+            if (fence_pending()) {
+                gpu.rasterizer.flush();
+                flushed.store(t, std::memory_order_release);
+                continue;
+            }
+
+            if (++polls < SPIN_POLLS) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(lock);
+            sleeping.store(true, std::memory_order_seq_cst);
+            wake.wait(guard, [&] { return head.load(std::memory_order_seq_cst) != t || fence_pending(); });
+            sleeping.store(false, std::memory_order_relaxed);
+
+            stats.sleeps++;
+            polls = 0;
+            continue;
+        }
+
+        polls = 0;
+        for (; t != h; t++) {
+            GPUWord word = ring[t & mask];
+
+            if (word.port == GPUPort::Quit) {
+                gpu.rasterizer.flush();
+                tail.store(t + 1, std::memory_order_release);
+                return;
+            }
+
+            if (word.port == GPUPort::GP0)
+                gpu.execute_gp0(word.data);
+            else
+                gpu.execute_gp1(word.data);
+        }
+
+        gpu.publish_status();
+        tail.store(t, std::memory_order_release);
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class GPU;
+
+enum class GPUPort : uint32_t {
+    GP0,
+    GP1,
+    Quit
+};
+
+/* A word for one of the GPU ports, in the order the CPU wrote them. */
+struct GPUWord {
+    uint32_t data;
+    GPUPort port;
+};
+
+struct GPUThreadStats {
+    uint64_t words = 0;
+    uint64_t full_waits = 0; /* Pushes that found the ring full. */
+    uint64_t fences = 0;
+    uint64_t fence_waits = 0; /* Fences that had to wait for the render thread. */
+    uint64_t sleeps = 0; /* Times the render thread ran dry and slept. */
+};
+
+/*
+ * Runs the GPU command processor and rasterizer on its own thread. The
+ * emulation thread pushes port writes into a single producer, single
+ * consumer ring and carries on; the render thread executes them in order.
+ *
+ * Anything that reads GPU state back (GPUREAD, VRAM to CPU transfers)
+ * calls fence() first, which waits until every pushed word was executed
+ * and drawn. Tile bins are only flushed for a fence, so a CPU trickling
+ * in commands still fills whole batches.
+ */
+class GPUThread {
+public:
+    static const size_t RING_WORDS = 1 << 16;
+
+    explicit GPUThread(GPU& gpu);
+    ~GPUThread();
+
+    /* Emulation thread. Only waits when the ring is full. */
+    void push(GPUPort port, uint32_t data);
+    void fence();
+
+    const GPUThreadStats& get_stats() const { return stats; }
+
+private:
+    void run();
+    bool fence_pending() const { return fence_target.load(std::memory_order_seq_cst) > flushed.load(std::memory_order_relaxed); }
+
+    GPU& gpu;
+    std::vector<GPUWord> ring;
+    size_t mask;
+
+    /* Words pushed and words executed, on their own cache lines. */
+    alignas(64) std::atomic<uint64_t> head = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0;
+
+    /* Words a fence waits for, and words executed with their bins flushed. */
+    alignas(64) std::atomic<uint64_t> fence_target = 0;
+    alignas(64) std::atomic<uint64_t> flushed = 0;
+
+    /* The render thread sleeps on wake once it has spun dry for a while. */
+    alignas(64) std::atomic<bool> sleeping = false;
+    std::mutex lock;
+    std::condition_variable wake;
+
+    GPUThreadStats stats;
+    std::thread worker;
+};
@@ -0,0 +1,183 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <cstring>
+#include <vector>
+#include "LZ.h"
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 0xffff;
+const int HASH_BITS = 14;
+
+/* Keep the end of the block as literals, so matches never run off it. */
+const size_t END_LITERALS = 5;
+const size_t MATCH_LIMIT = 12;
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, 4);
+    return value;
+}
+
+static uint32_t hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Writes a 4 bit length field overflow: 255 bytes until the rest fits. */
+static bool write_length(uint8_t*& op, const uint8_t* oend, size_t length) {
+    while (length >= 255) {
+        if (op >= oend)
+            return false;
+        *op++ = 255;
+        length -= 255;
+    }
+
+    if (op >= oend)
+        return false;
+    *op++ = (uint8_t)length;
+    return true;
+}
+
+static bool read_length(const uint8_t*& ip, const uint8_t* iend, size_t& length) {
+    uint8_t b;
+    do {
+        if (ip >= iend)
+            return false;
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+
+    return true;
+}
+
+size_t lz::max_compressed_size(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t lz::compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity) {
+    std::vector<uint32_t> table(1 << HASH_BITS, UINT32_MAX);
+
+    uint8_t* op = dst;
+    const uint8_t* oend = dst + capacity;
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    auto emit = [&](size_t literals, size_t offset, size_t match) -> bool {
+        if (op >= oend)
+            return false;
+
+        uint8_t* token = op++;
+        *token = (uint8_t)((literals < 15 ? literals : 15) << 4);
+        if (literals >= 15 && !write_length(op, oend, literals - 15))
+            return false;
+
+        if ((size_t)(oend - op) < literals)
+            return false;
+        std::memcpy(op, src + anchor, literals);
+        op += literals;
+
+        /* Last sequence, literals only. */
+        if (match == 0)
+            return true;
+
+        if (oend - op < 2)
+            return false;
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+
+        size_t extra = match - MIN_MATCH;
+        *token |= (uint8_t)(extra < 15 ? extra : 15);
+        if (extra >= 15 && !write_length(op, oend, extra - 15))
+            return false;
+
+        return true;
+    };
+
+    if (size > MATCH_LIMIT) {
+        size_t limit = size - MATCH_LIMIT;
+        size_t match_end = size - END_LITERALS;
+
+        while (ip < limit) {
+            uint32_t sequence = read32(src + ip);
+            uint32_t h = hash(sequence);
+            size_t ref = table[h];
+            table[h] = (uint32_t)ip;
+
+            if (ref == UINT32_MAX || ip - ref > MAX_OFFSET || read32(src + ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            size_t length = MIN_MATCH;
+            while (ip + length < match_end && src[ref + length] == src[ip + length])
+                length++;
+
+            if (!emit(ip - anchor, ip - ref, length))
+                return 0;
+
+            ip += length;
+            anchor = ip;
+        }
+    }
+
+    if (!emit(size - anchor, 0, 0))
+        return 0;
+
+    return op - dst;
+}
+
+bool lz::decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(ip, iend, literals))
+            return false;
+
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+            return false;
+        std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        /* The last sequence has no match. */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t length = token & 15;
+        if (length == 15 && !read_length(ip, iend, length))
+            return false;
+        length += MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t)(op - dst) || length > (size_t)(oend - op))
+            return false;
+
+        const uint8_t* match = op - offset;
+        if (offset >= length) {
+            std::memcpy(op, match, length);
+            op += length;
+        }
+        else {
+            /* Overlapping match, repeats the last offset bytes. */
+            for (size_t i = 0; i < length; i++)
+                *op++ = match[i];
+        }
+    }
+
+    return op == oend;
+}
@@ -0,0 +1,28 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Small LZ77 block codec used for compressed disc images.
+ * Every block is a list of sequences: a token byte (literal count in the high
+ * nibble, match length - 4 in the low one, 15 means more length bytes follow),
+ * the literals, then a 16 bit little endian match offset. The last sequence
+ * only has literals.
+ */
+namespace lz {
+    size_t max_compressed_size(size_t size);
+
+    /* Returns the compressed size, or 0 when it does not fit in capacity. */
+    size_t compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+
+    /* Returns false for corrupt data or when it does not decode to exactly dst_size bytes. */
+    bool decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size);
+}
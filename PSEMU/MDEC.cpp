@@ -0,0 +1,595 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "MDEC.h"
+#include "SIMD.h"
+
+/* Run/level codes come in zigzag order, this maps them back to raster order. */
+static const uint8_t zigzag[64] = {
+     0,  1,  5,  6, 14, 15, 27, 28,
+     2,  4,  7, 13, 16, 26, 29, 42,
+     3,  8, 12, 17, 25, 30, 41, 43,
+     9, 11, 18, 24, 31, 40, 44, 53,
+    10, 19, 23, 32, 39, 45, 52, 54,
+    20, 22, 33, 38, 46, 51, 55, 60,
+    21, 34, 37, 47, 50, 56, 59, 61,
+    35, 36, 48, 49, 57, 58, 62, 63
+};
+
+struct ZagZig {
+    uint8_t table[64];
+
+    constexpr ZagZig() : table() {
+        for (int i = 0; i < 64; i++)
+            table[zigzag[i]] = i;
+    }
+};
+static constexpr ZagZig zagzig;
+
+/* YUV -> RGB coefficients in 10 bit fixed point. */
+enum {
+    CR_TO_R = 1436, /* 1.402 */
+    CB_TO_G = 352,  /* 0.3437 */
+    CR_TO_G = 731,  /* 0.7143 */
+    CB_TO_B = 1815  /* 1.772 */
+};
+
+template<int bi>
+static int32_t sign_extend(uint32_t value) {
+    enum { mask = (1 << bi) - 1 };
+    enum { sign = 1 << (bi - 1) };
+
+    return (int32_t)((value & mask) ^ sign) - sign;
+}
+
+static int32_t clamp8(int32_t value) {
+    return std::clamp(value, -128, 127);
+}
+
+MDEC::MDEC() {
+    std::fill(std::begin(luma_qt), std::end(luma_qt), 1);
+    std::fill(std::begin(color_qt), std::end(color_qt), 1);
+
+    /* Start with the standard table, games upload the same one with command 3. */
+    for (int u = 0; u < 8; u++) {
+        double c = (u == 0) ? std::sqrt(1.0 / 8.0) : std::sqrt(2.0 / 8.0);
+        for (int x = 0; x < 8; x++) {
+            double v = c * std::cos((2 * x + 1) * u * 3.14159265358979323846 / 16.0);
+            scale_table[u * 8 + x] = (int16_t)std::lround(std::clamp(v * 65536.0, -32768.0, 32767.0));
+        }
+    }
+
+    reset();
+}
+
+void MDEC::reset() {
+    command.raw = 0;
+    status.raw = 0;
+    status.remaining = 0xffff;
+    status.current_block = 4;
+    status.data_out_empty = true;
+    remaining = 0;
+
+    enable_data_in = false;
+    enable_data_out = false;
+
+    in_fifo.clear();
+    in_pos = 0;
+    out_fifo.clear();
+    out_pos = 0;
+}
+
+uint32_t MDEC::read(uint32_t offset) {
+    switch (offset) {
+        case 0:
+            return read_data();
+        case 4:
+            return get_status();
+        default:
+            printf("[MDEC] read: unhandled offset: 0x%x\n", offset);
+            return 0;
+    }
+}
+
+void MDEC::write(uint32_t offset, uint32_t data) {
+    switch (offset) {
+        case 0:
+            write_command(data);
+            break;
+        case 4:
+            write_control(data);
+            break;
+        default:
+            printf("[MDEC] write: unhandled offset: 0x%x\n", offset);
+    }
+}
+
+size_t MDEC::output_available() const {
+    return out_fifo.size() - out_pos;
+}
+
+bool MDEC::busy() const {
+    return remaining > 0;
+}
+
+uint32_t MDEC::get_status() {
+    status.remaining = (remaining - 1) & 0xffff;
+    status.command_busy = busy();
+    status.data_in_full = false;
+    status.data_out_empty = output_available() == 0;
+    status.data_in_request = enable_data_in && busy();
+    status.data_out_request = enable_data_out && !status.data_out_empty;
+    status.output_depth = command.output_depth;
+    status.data_signed = command.data_signed;
+    status.bit15_set = command.bit15_set;
+
+    return status.raw;
+}
+
+void MDEC::write_control(uint32_t data) {
+    if (data & (1u << 31))
+        reset();
+
+    enable_data_in = (data >> 30) & 1;
+    enable_data_out = (data >> 29) & 1;
+}
+
+void MDEC::write_command(uint32_t data) {
+    /* Parameter word of the current command. */
+    if (remaining > 0) {
+        in_fifo.push_back(data);
+        if (--remaining == 0)
+            execute();
+        return;
+    }
+
+    command.raw = data;
+    in_fifo.clear();
+    in_pos = 0;
+
+    switch (command.opcode) {
+        case 1: /* Decode macroblocks. */
+            remaining = command.param_words;
+            break;
+        case 2: /* Set quant tables, luma only or luma + color. */
+            remaining = (data & 1) ? 32 : 16;
+            break;
+        case 3: /* Set scale table. */
+            remaining = 32;
+            break;
+        default: /* No function. */
+            remaining = 0;
+            break;
+    }
+
+    if (remaining == 0)
+        execute();
+}
+
+uint32_t MDEC::read_data() {
+    if (out_pos >= out_fifo.size())
+        return 0;
+
+    uint32_t data = out_fifo[out_pos++];
+
+    /* Everything was read, start over to keep the buffer small. */
+    if (out_pos == out_fifo.size()) {
+        out_fifo.clear();
+        out_pos = 0;
+    }
+
+    return data;
+}
+
+void MDEC::execute() {
+    switch (command.opcode) {
+        case 1:
+            decode_macroblocks();
+            break;
+        case 2: {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(in_fifo.data());
+            std::memcpy(luma_qt, bytes, 64);
+            if (in_fifo.size() == 32)
+                std::memcpy(color_qt, bytes + 64, 64);
+            break;
+        }
+        case 3:
+            std::memcpy(scale_table, in_fifo.data(), sizeof(scale_table));
+            break;
+        default:
+            break;
+    }
+
+    in_fifo.clear();
+    in_pos = 0;
+}
+
+bool MDEC::next_halfword(uint16_t& value) {
+    if (in_pos >= in_fifo.size() * 2)
+        return false;
+
+    uint32_t word = in_fifo[in_pos / 2];
+    value = (uint16_t)(word >> ((in_pos & 1) * 16));
+    in_pos++;
+
+    return true;
+}
+
+bool MDEC::rl_decode_block(MDECBlock blk, const uint8_t* qt) {
+    std::fill(blk, blk + 64, 0);
+
+    /* Skip the end-of-block padding between blocks. */
+    uint16_t n;
+    do {
+        if (!next_halfword(n))
+            return false;
+    } while (n == 0xfe00);
+
+    uint32_t k = 0;
+    int32_t q_scale = (n >> 10) & 0x3f;
+    int32_t val = sign_extend<10>(n) * qt[k];
+
+    while (k < 64) {
+        if (q_scale == 0)
+            val = sign_extend<10>(n) * 2;
+
+        val = std::clamp(val, -0x400, 0x3ff);
+        if (q_scale > 0)
+            blk[zagzig.table[k]] = val;
+        else
+            blk[k] = val;
+
+        if (!next_halfword(n))
+            return false;
+
+        k += ((n >> 10) & 0x3f) + 1;
+        if (k < 64)
+            val = (sign_extend<10>(n) * qt[k] * q_scale + 4) / 8;
+    }
+
+    return true;
+}
+
+/* Fixed point: the scale table is the DCT matrix times 2^16. The first pass */
+/* keeps one fractional bit, the second one brings the result back to pixels. */
+enum {
+    IDCT_SHIFT1 = 15,
+    IDCT_SHIFT2 = 17
+};
+
+/* dst = transpose(src) * scale. Wrapping 32 bit arithmetic like the vector path. */
+static void idct_pass_scalar(const int32_t* src, int32_t* dst, const int16_t* scale, int shift) {
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            uint32_t sum = 0;
+            for (int z = 0; z < 8; z++)
+                sum += (uint32_t)src[y + z * 8] * (uint32_t)(int32_t)scale[x + z * 8];
+
+            dst[x + y * 8] = ((int32_t)sum + (1 << (shift - 1))) >> shift;
+        }
+    }
+}
+
+void MDEC::idct_scalar(MDECBlock blk, const int16_t* scale) {
+    int32_t temp[64];
+    idct_pass_scalar(blk, temp, scale, IDCT_SHIFT1);
+    idct_pass_scalar(temp, blk, scale, IDCT_SHIFT2);
+
+    for (int i = 0; i < 64; i++)
+        blk[i] = clamp8(blk[i]);
+}
+
+#ifdef PSEMU_X86
+PSEMU_TARGET("avx2")
+static void idct_pass_avx2(const int32_t* src, int32_t* dst, const __m256i* rows, int shift) {
+    const __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+
+    for (int y = 0; y < 8; y++) {
+        __m256i sum = _mm256_setzero_si256();
+        for (int z = 0; z < 8; z++)
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_set1_epi32(src[y + z * 8]), rows[z]));
+
+        sum = _mm256_sra_epi32(_mm256_add_epi32(sum, round), count);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + y * 8), sum);
+    }
+}
+
+PSEMU_TARGET("avx2")
+void MDEC::idct_avx2(MDECBlock blk, const int16_t* scale) {
+    __m256i rows[8];
+    for (int z = 0; z < 8; z++)
+        rows[z] = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(scale + z * 8)));
+
+    alignas(32) int32_t temp[64];
+    idct_pass_avx2(blk, temp, rows, IDCT_SHIFT1);
+    idct_pass_avx2(temp, blk, rows, IDCT_SHIFT2);
+
+    const __m256i lo = _mm256_set1_epi32(-128);
+    const __m256i hi = _mm256_set1_epi32(127);
+    for (int i = 0; i < 64; i += 8) {
+        __m256i* p = reinterpret_cast<__m256i*>(blk + i);
+        _mm256_storeu_si256(p, _mm256_min_epi32(_mm256_max_epi32(_mm256_loadu_si256(p), lo), hi));
+    }
+}
+#else
+void MDEC::idct_avx2(MDECBlock blk, const int16_t* scale) {
+    idct_scalar(blk, scale);
+}
+#endif
+
+void MDEC::idct(MDECBlock blk) {
+    if (use_simd && simd::has_avx2())
+        idct_avx2(blk, scale_table);
+    else
+        idct_scalar(blk, scale_table);
+}
+
+/* blocks = Cr, Cb, Y1, Y2, Y3, Y4 for colour, a single Y block for mono. */
+void MDEC::yuv_to_rgb_scalar(const MDECBlock* blocks, uint8_t* out, MDECDepth depth, bool data_signed, bool bit15) {
+    int32_t bias = data_signed ? 0 : 128;
+
+    if (depth == MDECDepth::Mono8 || depth == MDECDepth::Mono4) {
+        for (int i = 0; i < 64; i++) {
+            uint8_t y = (uint8_t)(clamp8(blocks[0][i]) + bias);
+            if (depth == MDECDepth::Mono8)
+                out[i] = y;
+            else if (i & 1)
+                out[i / 2] |= (y >> 4) << 4;
+            else
+                out[i / 2] = y >> 4;
+        }
+        return;
+    }
+
+    for (int py = 0; py < 16; py++) {
+        for (int px = 0; px < 16; px++) {
+            const MDECBlock& yblk = blocks[2 + (py / 8) * 2 + (px / 8)];
+            int32_t y = yblk[(py % 8) * 8 + (px % 8)];
+            int32_t cr = blocks[0][(py / 2) * 8 + (px / 2)];
+            int32_t cb = blocks[1][(py / 2) * 8 + (px / 2)];
+
+            uint8_t r = (uint8_t)(clamp8(y + ((CR_TO_R * cr + 512) >> 10)) + bias);
+            uint8_t g = (uint8_t)(clamp8(y - ((CB_TO_G * cb + CR_TO_G * cr + 512) >> 10)) + bias);
+            uint8_t b = (uint8_t)(clamp8(y + ((CB_TO_B * cb + 512) >> 10)) + bias);
+
+            int i = py * 16 + px;
+            if (depth == MDECDepth::RGB24) {
+                out[i * 3 + 0] = r;
+                out[i * 3 + 1] = g;
+                out[i * 3 + 2] = b;
+            }
+            else {
+                uint16_t pixel = (r >> 3) | ((g >> 3) << 5) | ((b >> 3) << 10) | (bit15 << 15);
+                out[i * 2 + 0] = (uint8_t)pixel;
+                out[i * 2 + 1] = (uint8_t)(pixel >> 8);
+            }
+        }
+    }
+}
+
+#ifdef PSEMU_X86
+PSEMU_TARGET("avx2")
+void MDEC::yuv_to_rgb_avx2(const MDECBlock* blocks, uint8_t* out, MDECDepth depth, bool data_signed, bool bit15) {
+    /* Mono output is tiny, leave it to the reference code. */
+    if (depth == MDECDepth::Mono8 || depth == MDECDepth::Mono4)
+        return yuv_to_rgb_scalar(blocks, out, depth, data_signed, bit15);
+
+    const __m256i bias = _mm256_set1_epi32(data_signed ? 0 : 128);
+    const __m256i lo = _mm256_set1_epi32(-128);
+    const __m256i hi = _mm256_set1_epi32(127);
+    const __m256i round = _mm256_set1_epi32(512);
+    const __m256i byte_mask = _mm256_set1_epi32(0xff);
+    const __m256i cr_to_r = _mm256_set1_epi32(CR_TO_R);
+    const __m256i cb_to_g = _mm256_set1_epi32(CB_TO_G);
+    const __m256i cr_to_g = _mm256_set1_epi32(CR_TO_G);
+    const __m256i cb_to_b = _mm256_set1_epi32(CB_TO_B);
+    const __m256i mask15 = _mm256_set1_epi32(bit15 ? 0x8000 : 0);
+    /* Every chroma sample covers two luma pixels. */
+    const __m256i upsample = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    /* Drops the 4th byte of every pixel: 4 x RGBx -> 12 bytes of RGB. */
+    const __m128i pack24 = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    for (int py = 0; py < 16; py++) {
+        for (int half = 0; half < 2; half++) {
+            const MDECBlock& yblk = blocks[2 + (py / 8) * 2 + half];
+            int c = (py / 2) * 8 + half * 4;
+
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(yblk + (py % 8) * 8));
+            __m256i cr = _mm256_permutevar8x32_epi32(
+                _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks[0] + c))), upsample);
+            __m256i cb = _mm256_permutevar8x32_epi32(
+                _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks[1] + c))), upsample);
+
+            __m256i r = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cr, cr_to_r), round), 10);
+            __m256i g = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(
+                _mm256_mullo_epi32(cb, cb_to_g), _mm256_mullo_epi32(cr, cr_to_g)), round), 10);
+            __m256i b = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cb, cb_to_b), round), 10);
+
+            r = _mm256_and_si256(_mm256_add_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(y, r), lo), hi), bias), byte_mask);
+            g = _mm256_and_si256(_mm256_add_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(y, g), lo), hi), bias), byte_mask);
+            b = _mm256_and_si256(_mm256_add_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(y, b), lo), hi), bias), byte_mask);
+
+            int i = py * 16 + half * 8;
+            if (depth == MDECDepth::RGB24) {
+                __m256i rgb = _mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(b, 16)));
+                __m128i low = _mm_shuffle_epi8(_mm256_castsi256_si128(rgb), pack24);
+                __m128i high = _mm_shuffle_epi8(_mm256_extracti128_si256(rgb, 1), pack24);
+
+                alignas(16) uint8_t bytes[32];
+                _mm_store_si128(reinterpret_cast<__m128i*>(bytes), low);
+                _mm_store_si128(reinterpret_cast<__m128i*>(bytes + 16), high);
+                std::memcpy(out + i * 3, bytes, 12);
+                std::memcpy(out + i * 3 + 12, bytes + 16, 12);
+            }
+            else {
+                __m256i pixel = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_srli_epi32(r, 3), _mm256_slli_epi32(_mm256_srli_epi32(g, 3), 5)),
+                    _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(b, 3), 10), mask15));
+
+                __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(pixel, pixel), 0x08);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 2), _mm256_castsi256_si128(packed));
+            }
+        }
+    }
+}
+#else
+void MDEC::yuv_to_rgb_avx2(const MDECBlock* blocks, uint8_t* out, MDECDepth depth, bool data_signed, bool bit15) {
+    yuv_to_rgb_scalar(blocks, out, depth, data_signed, bit15);
+}
+#endif
+
+void MDEC::push_output(const uint8_t* data, size_t bytes) {
+    size_t words = (bytes + 3) / 4;
+    size_t at = out_fifo.size();
+
+    out_fifo.resize(at + words, 0);
+    std::memcpy(out_fifo.data() + at, data, bytes);
+}
+
+void MDEC::decode_macroblocks() {
+    MDECDepth depth = (MDECDepth)command.output_depth;
+    bool color = depth == MDECDepth::RGB24 || depth == MDECDepth::RGB15;
+
+    static const size_t output_bytes[4] = { 32, 64, 16 * 16 * 3, 16 * 16 * 2 };
+    int block_count = color ? 6 : 1;
+
+    alignas(32) MDECBlock blocks[6];
+    alignas(32) uint8_t pixels[16 * 16 * 3];
+
+    while (true) {
+        for (int i = 0; i < block_count; i++) {
+            status.current_block = color ? (i + 4) % 6 : 4;
+
+            /* Cr and Cb use the colour table, the Y blocks the luma one. */
+            const uint8_t* qt = (color && i < 2) ? color_qt : luma_qt;
+            if (!rl_decode_block(blocks[i], qt))
+                return; /* End of the input, partial macroblocks are dropped. */
+
+            idct(blocks[i]);
+        }
+
+        if (use_simd && simd::has_avx2())
+            yuv_to_rgb_avx2(blocks, pixels, depth, command.data_signed, command.bit15_set);
+        else
+            yuv_to_rgb_scalar(blocks, pixels, depth, command.data_signed, command.bit15_set);
+
+        push_output(pixels, output_bytes[(uint32_t)depth]);
+    }
+}
+
+/* Parameter words for command 1: count macroblocks of random run/level codes. */
+static std::vector<uint32_t> random_macroblocks(std::mt19937& rng, uint32_t count, bool color) {
+    std::vector<uint16_t> codes;
+
+    for (uint32_t m = 0; m < count * (color ? 6 : 1); m++) {
+        /* Quant scale (sometimes 0, the uncompressed case) and DC. */
+        codes.push_back((uint16_t)(((rng() % 64) << 10) | (rng() & 0x3ff)));
+
+        for (uint32_t run = rng() % 12, k = run + 1; k < 64; run = rng() % 12, k += run + 1)
+            codes.push_back((uint16_t)((run << 10) | (rng() & 0x3ff)));
+
+        codes.push_back(0xfe00);
+    }
+    if (codes.size() & 1)
+        codes.push_back(0xfe00);
+
+    std::vector<uint32_t> words(codes.size() / 2);
+    std::memcpy(words.data(), codes.data(), codes.size() * 2);
+    return words;
+}
+
+bool bench_mdec(uint32_t iterations) {
+    const uint32_t macroblocks = 256;
+    std::mt19937 rng(1);
+
+    /* Both quant tables, as command 2 sends them. */
+    uint8_t tables[128];
+    for (auto& q : tables)
+        q = (uint8_t)(rng() % 63 + 1);
+
+    /* The IDCT on its own. */
+    std::vector<int32_t> coefficients(64 * 1024);
+    for (auto& c : coefficients)
+        c = (int32_t)(rng() % 0x800) - 0x400;
+
+    MDEC reference;
+    std::vector<int32_t> idct_out[2];
+    bool ok = true;
+
+    for (int isa = 0; isa < 2; isa++) {
+        if (isa == 1 && !simd::has_avx2())
+            continue;
+
+        auto begin = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < iterations; i++) {
+            idct_out[isa] = coefficients;
+            for (size_t b = 0; b < idct_out[isa].size(); b += 64) {
+                if (isa == 1)
+                    MDEC::idct_avx2(idct_out[isa].data() + b, reference.get_scale_table());
+                else
+                    MDEC::idct_scalar(idct_out[isa].data() + b, reference.get_scale_table());
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        bool match = isa == 0 || idct_out[1] == idct_out[0];
+        ok &= match;
+        printf("[MDEC] idct   %-6s %12.0f blocks/s%s\n", isa ? "avx2" : "scalar",
+               (double)coefficients.size() / 64 * iterations / seconds, match ? "" : "  MISMATCH");
+    }
+
+    const char* depth_names[4] = { "mono4", "mono8", "rgb24", "rgb15" };
+    for (uint32_t depth = 0; depth < 4; depth++) {
+        bool color = depth >= (uint32_t)MDECDepth::RGB24;
+        std::vector<uint32_t> params = random_macroblocks(rng, macroblocks, color);
+
+        /* Signed output and bit 15 alternate between the depths. */
+        uint32_t decode = (1u << 29) | (depth << 27) | ((depth & 1) << 26) | ((depth & 1) << 25) | (uint32_t)params.size();
+        std::vector<uint32_t> out[2];
+
+        for (int isa = 0; isa < 2; isa++) {
+            if (isa == 1 && !simd::has_avx2())
+                continue;
+
+            MDEC mdec;
+            mdec.use_simd = isa == 1;
+            mdec.write_command((2u << 29) | 1);
+            for (uint32_t i = 0; i < 32; i++) {
+                uint32_t word;
+                std::memcpy(&word, tables + i * 4, 4);
+                mdec.write_command(word);
+            }
+
+            auto begin = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < iterations; i++) {
+                mdec.write_command(decode);
+                for (uint32_t word : params)
+                    mdec.write_command(word);
+
+                out[isa].clear();
+                while (mdec.output_available() > 0)
+                    out[isa].push_back(mdec.read_data());
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            bool match = isa == 0 || out[1] == out[0];
+            ok &= match;
+            printf("[MDEC] %-6s %-6s %12.0f macroblocks/s%s\n", depth_names[depth], isa ? "avx2" : "scalar",
+                   (double)macroblocks * iterations / seconds, match ? "" : "  MISMATCH");
+        }
+    }
+
+    return ok;
+}
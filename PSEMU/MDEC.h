@@ -0,0 +1,110 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+union MDECStatus {
+    uint32_t raw;
+
+    struct {
+        uint32_t remaining : 16; /* Parameter words remaining minus 1. */
+        uint32_t current_block : 3;
+        uint32_t not_used : 4;
+        uint32_t bit15_set : 1;
+        uint32_t data_signed : 1;
+        uint32_t output_depth : 2;
+        uint32_t data_out_request : 1;
+        uint32_t data_in_request : 1;
+        uint32_t command_busy : 1;
+        uint32_t data_in_full : 1;
+        uint32_t data_out_empty : 1;
+    };
+};
+
+union MDECCommand {
+    uint32_t raw;
+
+    struct {
+        uint32_t param_words : 16;
+        uint32_t not_used : 9;
+        uint32_t bit15_set : 1;
+        uint32_t data_signed : 1;
+        uint32_t output_depth : 2;
+        uint32_t opcode : 3;
+    };
+};
+
+enum class MDECDepth : uint32_t {
+    Mono4 = 0,
+    Mono8 = 1,
+    RGB24 = 2,
+    RGB15 = 3
+};
+
+/* One decoded 8x8 block, kept in 32 bit so the IDCT can run on 8 lanes. */
+typedef int32_t MDECBlock[64];
+
+class MDEC {
+public:
+    MDEC();
+
+    /* Register interface at 0x1f801820 (data/command) and 0x1f801824 (status/control). */
+    uint32_t read(uint32_t offset);
+    void write(uint32_t offset, uint32_t data);
+
+    void write_command(uint32_t data); /* Also fed by DMA channel 0. */
+    uint32_t read_data(); /* Also drained by DMA channel 1. */
+    uint32_t get_status();
+    void write_control(uint32_t data);
+    void reset();
+
+    size_t output_available() const;
+    bool busy() const;
+
+    /* Decode pipeline. The scalar versions are the reference the vector */
+    /* versions have to match bit for bit. */
+    bool rl_decode_block(MDECBlock blk, const uint8_t* qt);
+    static void idct_scalar(MDECBlock blk, const int16_t* scale);
+    static void idct_avx2(MDECBlock blk, const int16_t* scale);
+    static void yuv_to_rgb_scalar(const MDECBlock* blocks, uint8_t* out, MDECDepth depth, bool data_signed, bool bit15);
+    static void yuv_to_rgb_avx2(const MDECBlock* blocks, uint8_t* out, MDECDepth depth, bool data_signed, bool bit15);
+
+    const int16_t* get_scale_table() const { return scale_table; }
+
+    /* Clearing this forces the scalar reference path. */
+    bool use_simd = true;
+
+private:
+    void execute();
+    void decode_macroblocks();
+    void idct(MDECBlock blk);
+    void push_output(const uint8_t* data, size_t bytes);
+    bool next_halfword(uint16_t& value);
+
+    MDECCommand command;
+    MDECStatus status;
+    uint32_t remaining = 0;
+    bool enable_data_in = false;
+    bool enable_data_out = false;
+
+    std::vector<uint32_t> in_fifo;
+    size_t in_pos = 0;
+    std::vector<uint32_t> out_fifo;
+    size_t out_pos = 0;
+
+    uint8_t luma_qt[64];
+    uint8_t color_qt[64];
+    int16_t scale_table[64];
+};
+
+/* Decodes the same macroblocks at every output depth through the scalar and */
+/* AVX2 paths and prints macroblocks/s, false if the output differs.         */
+bool bench_mdec(uint32_t iterations);
@@ -8,6 +8,11 @@
 */
 #include "Memory.h"
 
+Memory::~Memory() {
+    /* Report where the DMA time went. */
+    dump_dma_stats();
+}
+
 uint32_t Memory::physical_addr(uint32_t addr) {
     uint index = addr >> 29;
     return (addr & region_mask[index]);
@@ -18,6 +23,8 @@ uint8_t Memory::readByte(uint32_t address) {
         return MainRAM[address];
     } else if (address < DMAEnd) {
         return (uint8_t)DMAread(address);
+    } else if (CDROM.contains(physical_addr(address))) {
+        return cddrive.read(CDROM.offset(physical_addr(address)));
     } else {
         Logging console;
         console.err(54);
@@ -30,6 +37,8 @@ void Memory::writeByte(uint32_t address, uint8_t value) {
         MainRAM[address] = value;
     } else if (address < DMAEnd) {
         return write(address, value);
+    } else if (CDROM.contains(physical_addr(address))) {
+        cddrive.write(CDROM.offset(physical_addr(address)), value);
     } else {
         Logging console;
         console.err(54);
@@ -45,6 +54,20 @@ uint32_t Memory::readWord(uint32_t address) {
         return value;
     } else if (address < DMAEnd) {
         return DMAread(address);
+    } else if (GPU_RANGE.contains(physical_addr(address))) {
+        return gpu.read(GPU_RANGE.offset(physical_addr(address)), cycles);
+    } else if (MDEC_RANGE.contains(physical_addr(address))) {
+        return mdec.read(MDEC_RANGE.offset(physical_addr(address)));
+    } else if (SPU_RANGE.contains(physical_addr(address))) {
+        /* SPU registers are 16 bit. Halfword loads come through here too, */
+        /* so an address in the upper half returns that register in both.  */
+        uint32_t offset = SPU_RANGE.offset(physical_addr(address));
+        if (offset & 2)
+            return spu.read(offset) * 0x10001u;
+        return spu.read(offset) | (spu.read(offset + 2) << 16);
+    } else if (TIMERS.contains(physical_addr(address))) {
+        set_timer_video();
+        return timers.read(TIMERS.offset(physical_addr(address)), cycles);
     } else {
         Logging console;
         console.err(54);
@@ -61,6 +84,26 @@ void Memory::writeWord(uint32_t address, uint32_t value) {
     else if (address < DMAEnd) {
         return write(address, value);
     }
+    else if (GPU_RANGE.contains(physical_addr(address))) {
+        uint32_t offset = GPU_RANGE.offset(physical_addr(address));
+        gpu.write(offset, value, cycles);
+
+        /* GP1(00) and GP1(08) move the dotclock and hblank counter deadlines. */
+        if (offset == 4)
+            set_timer_video();
+    }
+    else if (MDEC_RANGE.contains(physical_addr(address))) {
+        mdec.write(MDEC_RANGE.offset(physical_addr(address)), value);
+    }
+    else if (SPU_RANGE.contains(physical_addr(address))) {
+        uint32_t offset = SPU_RANGE.offset(physical_addr(address));
+        spu.write(offset, (uint16_t)value);
+        spu.write(offset + 2, (uint16_t)(value >> 16));
+    }
+    else if (TIMERS.contains(physical_addr(address))) {
+        set_timer_video();
+        timers.write(TIMERS.offset(physical_addr(address)), value, cycles);
+    }
     else {
         Logging console;
         console.err(54);
@@ -81,6 +124,13 @@ void Memory::writeHalfword(uint32_t address, uint16_t value) {
         else if (address < DMAEnd) {
             return write(address, value);
         }
+        else if (SPU_RANGE.contains(physical_addr(address))) {
+            spu.write(SPU_RANGE.offset(physical_addr(address)), value);
+        }
+        else if (TIMERS.contains(physical_addr(address))) {
+            set_timer_video();
+            timers.write(TIMERS.offset(physical_addr(address)), value, cycles);
+        }
         else {
             Logging console;
             console.err(56);
@@ -89,6 +139,11 @@ void Memory::writeHalfword(uint32_t address, uint16_t value) {
     }
 }
 
+/* The dotclock and scanline counter sources follow the GPU display mode. */
+void Memory::set_timer_video() {
+    timers.set_video(gpu.dot_divider(), gpu.pal(), cycles);
+}
+
 uint32_t Memory::read32(uint32_t address) {
     return readWord(address);
 }
\ No newline at end of file
@@ -12,6 +12,10 @@
 #include "Logging.h"
 #include "CPURegisters.h"
 #include "GPU.h"
+#include "MDEC.h"
+#include "CDDrive.h"
+#include "SPU.h"
+#include "Timers.h"
 
 struct Range {
     Range(uint begin, ulong size) :
@@ -112,10 +116,28 @@ union ListPacket {
     };
 };
 
+/* Per channel DMA counters, queried with Memory::get_dma_stats. */
+struct DMAStats {
+    uint64_t transfers = 0;
+    uint64_t sync_mode[4] = {}; /* Transfers started, indexed by SyncType. */
+    uint64_t words_to_ram = 0; /* Device -> RAM. */
+    uint64_t words_from_ram = 0; /* RAM -> Device. */
+    uint64_t list_packets = 0;
+    uint64_t host_ns = 0; /* Host time spent copying. */
+};
+
+/* Progress of a linked list transfer that is walked in slices by tick(). */
+struct ListCopyState {
+    bool active = false;
+    DMAChannels channel = DMAChannels::GPU;
+    uint32_t addr = 0;
+};
+
 class Memory {
 public:
     // size = kilobytes
     Memory(size_t size, CPURegisters* rega) : MainRAM((size * 8000) / sizeof(uint8_t)), regs(rega) {};
+    ~Memory();
 
     // address = bits
     uint8_t& operator[](uint32_t address) {
@@ -160,16 +182,44 @@ public:
     void start(DMAChannels channel);
     void block_copy(DMAChannels channel);
     void list_copy(DMAChannels channel);
+    void list_step();
+    void list_finished();
+
+    const DMAStats& get_dma_stats(DMAChannels channel) const;
+    void dump_dma_stats() const;
 
     uint32_t DMAread(uint32_t address);
     void write(uint32_t address, uint32_t data);
 
     void tick();
+    void set_timer_video();
     DMAControl control;
     DMAIRQReg irq;
     DMAChannel channels[7];
 
+    /* Linked list walker state. Packets per tick bounds the work done for */
+    /* a single ordering table so a broken list cannot stall the emulator, */
+    /* one visited bit per RAM word lets us break out of circular lists.   */
+    static const uint32_t LIST_PACKETS_PER_TICK = 64;
+    ListCopyState list_state;
+    DMAStats dma_stats[7];
+    std::vector<uint64_t> list_visited = std::vector<uint64_t>((2 * 1024 * 1024) / 4 / 64);
+
     GPU gpu;
+    MDEC mdec;
+    CDDrive cddrive;
+    SPU spu;
+    Timers timers;
+
+    /* Rough average of CPU cycles per executed instruction, the */
+    /* devices are ticked once per instruction. */
+    static const uint32_t CYCLES_PER_TICK = 2;
+
+    /* CPU cycles since power on, the root counters are read against it. */
+    uint64_t cycles = 0;
+
+    /* MDECout was started before its data was decoded, run it once MDECin is done. */
+    bool mdec_out_pending = false;
 
     bool irq_pending = false;
     std::vector<uint8_t> MainRAM;
@@ -190,6 +240,8 @@ public:
     const Range CACHE_CONTROL = Range(0xfffe0130, 4);
     const Range SYS_CONTROL = Range(0x1f801000, 36);
     const Range CDROM = Range(0x1f801800, 0x4);
+    const Range GPU_RANGE = Range(0x1f801810, 8);
+    const Range MDEC_RANGE = Range(0x1f801820, 8);
     const Range PAD_MEMCARD = Range(0x1f801040, 15);
     const Range DMA_RANGE = Range(0x1f801080, 0x80LL);
     const Range SCRATCHPAD = Range(0x1f800000, 1024LL);
@@ -6,10 +6,18 @@
  PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
 
 */
+#include <algorithm>
 #include <iostream>
 #include "CPU.h"
 #include "Memory.h"
 #include "Logging.h"
+#include "CompressedImage.h"
+#include "SectorVerify.h"
+#include "AudioOutput.h"
+#include "SpanKernels.h"
+#include "MDEC.h"
+#include "XAADPCM.h"
+#include "Reverb.h"
 
 /*
  * Somehow get the DMA Working.
@@ -31,19 +39,149 @@
  * Just a note, I'm not sure if it's nessairy or not but other emulators seem to be starting at a specific address but mine just starts at zero.
  * Also I think we need to use a tick
  * I think the j instruction at the end uses the DMA.
- * 
- * NOTE: The gpu tick is not implemented
  */
 
-int main() {
+// Sink sample rate and how many SPU frames are handed to the audio thread at once.
+const uint32_t AUDIO_RATE = 48000;
+const size_t AUDIO_CHUNK = 512;
+
+int main(int argc, char** argv) {
+    // PSEMU --compress <in.cue|in.bin> <out.pcz>
+    if (argc > 3 && std::string(argv[1]) == "--compress") {
+        auto source = DiscImage::open(argv[2]);
+        if (!source || !CompressedImage::create(*source, argv[3])) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // PSEMU --verify <image> [threads]
+    if (argc > 2 && std::string(argv[1]) == "--verify") {
+        VerifyReport report;
+        unsigned threads = argc > 3 ? (unsigned)std::stoul(argv[3]) : 0;
+        if (!verify_image(argv[2], threads, report)) {
+            return 1;
+        }
+
+        printf("[CDROM] %llu sectors: %llu good, %llu unchecked, %llu bad EDC, %llu corrupt, %llu bad sync\n",
+               (unsigned long long)report.sectors,
+               (unsigned long long)report.counts[(int)SectorCheck::Good],
+               (unsigned long long)report.counts[(int)SectorCheck::Unchecked],
+               (unsigned long long)report.counts[(int)SectorCheck::BadEDC],
+               (unsigned long long)report.counts[(int)SectorCheck::Corrupt],
+               (unsigned long long)report.counts[(int)SectorCheck::BadSync]);
+        for (uint32_t lba : report.bad_lbas) {
+            printf("[CDROM] Bad sector at LBA %u\n", lba);
+        }
+        printf("[CDROM] Verified in %.3f s (%.2f GB/s)\n", report.seconds, report.gigabytes_per_second);
+        return report.bad_lbas.empty() ? 0 : 2;
+    }
+
+    // PSEMU --bench-spans [iterations]: rasterizer span kernels on every ISA.
+    if (argc > 1 && std::string(argv[1]) == "--bench-spans") {
+        uint32_t iterations = argc > 2 ? (uint32_t)std::stoul(argv[2]) : 20000;
+        return bench_span_kernels(iterations) ? 0 : 1;
+    }
+
+    // PSEMU --bench-mdec [iterations]: MDEC decode, scalar against AVX2.
+    if (argc > 1 && std::string(argv[1]) == "--bench-mdec") {
+        uint32_t iterations = argc > 2 ? (uint32_t)std::stoul(argv[2]) : 200;
+        return bench_mdec(iterations) ? 0 : 1;
+    }
+
+    // PSEMU --bench-xa [iterations]: XA-ADPCM sectors, scalar against SSE4.1.
+    if (argc > 1 && std::string(argv[1]) == "--bench-xa") {
+        uint32_t iterations = argc > 2 ? (uint32_t)std::stoul(argv[2]) : 200;
+        return bench_xa_adpcm(iterations) ? 0 : 1;
+    }
+
+    // PSEMU --bench-reverb [blocks]: reverb layouts, scalar against AVX2.
+    if (argc > 1 && std::string(argv[1]) == "--bench-reverb") {
+        uint32_t blocks = argc > 2 ? (uint32_t)std::stoul(argv[2]) : 64;
+        return bench_reverb(blocks) ? 0 : 1;
+    }
+
+    // PSEMU --bench-raster <gp0 stream> [iterations]: tiled rasterizer scaling.
+    if (argc > 2 && std::string(argv[1]) == "--bench-raster") {
+        uint32_t iterations = argc > 3 ? (uint32_t)std::stoul(argv[3]) : 1;
+        return bench_gp0_stream(argv[2], iterations) ? 0 : 1;
+    }
+
+    // PSEMU --tone <out.wav> [seconds]: 440 Hz through the audio pipeline.
+    if (argc > 2 && std::string(argv[1]) == "--tone") {
+        auto wav = WavSink::create(argv[2], AUDIO_RATE);
+        if (!wav) {
+            return 1;
+        }
+
+        AudioOutput audio(std::move(wav), SPU_SAMPLE_RATE, false);
+        ToneSource tone(440.0, SPU_SAMPLE_RATE);
+
+        size_t remaining = (size_t)((argc > 3 ? std::stod(argv[3]) : 1.0) * SPU_SAMPLE_RATE);
+        int16_t frames[512 * 2];
+        while (remaining > 0) {
+            size_t count = std::min({ remaining, (size_t)512, audio.space() });
+            if (count == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            tone.generate(frames, count);
+            audio.push(frames, count);
+            remaining -= count;
+        }
+        return 0;
+    }
+
+    // PSEMU [disc image] [--wav <out.wav>] [--gpu-thread] [--raster-threads <n>] [--record-gp0 <file>]
+    std::string disc_path;
+    std::string wav_path;
+    std::string gp0_path;
+    bool gpu_thread = false;
+    unsigned raster_threads = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--wav" && i + 1 < argc) {
+            wav_path = argv[++i];
+        }
+        else if (arg == "--gpu-thread") {
+            gpu_thread = true;
+        }
+        else if (arg == "--raster-threads" && i + 1 < argc) {
+            raster_threads = (unsigned)std::stoul(argv[++i]);
+        }
+        else if (arg == "--record-gp0" && i + 1 < argc) {
+            gp0_path = argv[++i];
+        }
+        else {
+            disc_path = arg;
+        }
+    }
+
     uint32_t biosCode[] = {
         0b00111100000000010000000000000001,
         0b00000000001000010000100000100100,
     };
     size_t numInstructions = sizeof(biosCode) / sizeof(uint32_t);
 
-    CPURegisters Registers(0);
-    Memory memory(2048, &Registers); // Specify the memory size in KB
+    // Static so their destructors (DMA stats dump) also run on exit().
+    static CPURegisters Registers(0);
+    static Memory memory(2048, &Registers); // Specify the memory size in KB
+    memory.gpu.rasterizer.set_threads(raster_threads);
+    memory.gpu.set_threaded(gpu_thread);
+    if (!gp0_path.empty() && !memory.gpu.record_gp0(gp0_path)) {
+        std::cout << "Could not record GP0 to: " << gp0_path << std::endl;
+    }
+
+    // SPU output is played in real time on its own thread, or just dropped.
+    std::unique_ptr<AudioSink> sink;
+    if (!wav_path.empty()) {
+        sink = WavSink::create(wav_path, AUDIO_RATE);
+    }
+    if (!sink) {
+        sink = std::make_unique<NullSink>(AUDIO_RATE);
+    }
+    static AudioOutput audio(std::move(sink), SPU_SAMPLE_RATE);
     CPU cpu(&memory, &Registers);
 
     // Load BIOS code into the CPU's memory
@@ -53,6 +191,11 @@ int main() {
 
     memory.control = 0x07654321;
 
+    // Optional disc image (.cue or .bin).
+    if (!disc_path.empty() && !memory.cddrive.insert_disc(disc_path)) {
+        std::cout << "Could not open disc image: " << disc_path << std::endl;
+    }
+
     // Run the CPU to execute the loaded BIOS code
     while (true) {
       cpu.tick();
@@ -60,8 +203,10 @@ int main() {
       
       memory.tick(); // dMA
 
-      /*if (memory.gpu.tick(300)) {
-          // Empty
-      }  */
+      // Hand the SPU output over in chunks, push never waits.
+      if (memory.spu.samples.size() >= AUDIO_CHUNK * 2) {
+          audio.push(memory.spu.samples.data(), memory.spu.samples.size() / 2);
+          memory.spu.samples.clear();
+      }
     }
 }
@@ -0,0 +1,279 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <cstdlib>
+#include "Rasterizer.h"
+
+/* Added to the 8 bit colour before it is cut to 5 bits. */
+static const int8_t DITHER[4][4] = {
+    { -4,  0, -3,  1 },
+    {  2, -2,  3, -1 },
+    { -3,  1, -4,  0 },
+    {  3, -1,  2, -2 },
+};
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+/* Whether [a, a + a_len) and [b, b + b_len) overlap on a ring of size entries. */
+static bool ring_overlap(uint32_t a, uint32_t a_len, uint32_t b, uint32_t b_len, uint32_t size) {
+    return ((b - a) & (size - 1)) < a_len || ((a - b) & (size - 1)) < b_len;
+}
+
+/* Whether a textured span may read pixels it writes itself. */
+static bool span_samples_itself(int32_t y, int32_t x0, int32_t x1, const RasterPrim& prim) {
+    uint32_t width = x1 - x0 + 1;
+    uint32_t page_width = prim.depth == 0 ? 64 : prim.depth == 1 ? 128 : 256;
+
+    if (ring_overlap(prim.page_y, 256, y, 1, VRAM::HEIGHT) &&
+        ring_overlap(prim.page_x, page_width, x0, width, VRAM::WIDTH))
+        return true;
+
+    return prim.depth < 2 && (uint32_t)y == prim.clut_y &&
+           ring_overlap(prim.clut_x, prim.depth == 0 ? 16 : 256, x0, width, VRAM::WIDTH);
+}
+
+template<bool textured, bool raw, bool semi>
+void Rasterizer::draw_span_as(int32_t y, int32_t x0, int32_t x1, SpanSetup s, const RasterPrim& prim) {
+    alignas(32) uint16_t texels[SPAN_CHUNK];
+    alignas(32) uint16_t shaded[SPAN_CHUNK];
+    alignas(32) uint16_t blended[SPAN_CHUNK];
+
+    const uint16_t* pixels = vram.data();
+    uint16_t* row = vram.row(y);
+    const int8_t* dither = prim.dither ? DITHER[y & 3] : nullptr;
+    StoreFlags flags = { env.check_mask, env.set_mask };
+
+    /* Texels are fetched a chunk ahead of the stores. When the texture */
+    /* overlaps the span, go a pixel at a time so every fetch sees the  */
+    /* pixels drawn before it.                                          */
+    int32_t chunk = textured && span_samples_itself(y, x0, x1, prim) ? 1 : SPAN_CHUNK;
+
+    for (int32_t x = x0; x <= x1; x += chunk) {
+        uint32_t count = (uint32_t)std::min(chunk, x1 - x + 1);
+        const uint16_t* color = shaded;
+
+        if constexpr (textured) {
+            kernels->fetch(pixels, s, count, prim, env, texels);
+
+            /* Raw texels go out as they are, store drops their bit 15. */
+            if constexpr (raw)
+                color = texels;
+            else
+                kernels->modulate(texels, s, count, dither, x, shaded);
+        } else {
+            kernels->shade(s, count, dither, x, shaded);
+        }
+
+        if constexpr (semi)
+            kernels->blend(row + x, color, count, prim.semi_mode, blended);
+
+        kernels->store(row + x, color, semi ? blended : nullptr, textured ? texels : nullptr, count, flags);
+
+        s.r += s.dr * (int32_t)count;
+        s.g += s.dg * (int32_t)count;
+        s.b += s.db * (int32_t)count;
+        s.u += s.du * (int32_t)count;
+        s.v += s.dv * (int32_t)count;
+    }
+}
+
+Rasterizer::SpanFunction Rasterizer::span_function(const RasterPrim& prim) {
+    static const SpanFunction functions[8] = {
+        &Rasterizer::draw_span_as<false, false, false>, &Rasterizer::draw_span_as<false, false, true>,
+        &Rasterizer::draw_span_as<false, false, false>, &Rasterizer::draw_span_as<false, false, true>,
+        &Rasterizer::draw_span_as<true, false, false>, &Rasterizer::draw_span_as<true, false, true>,
+        &Rasterizer::draw_span_as<true, true, false>, &Rasterizer::draw_span_as<true, true, true>,
+    };
+
+    return functions[(prim.textured ? 4 : 0) | (prim.raw ? 2 : 0) | (prim.semi ? 1 : 0)];
+}
+
+void Rasterizer::draw_span(int32_t y, int32_t x0, int32_t x1, SpanSetup s, const RasterPrim& prim) {
+    (this->*span_function(prim))(y, x0, x1, s, prim);
+}
+
+void Rasterizer::triangle(const RasterVertex vertices[3], const RasterPrim& prim) {
+    const RasterVertex* v0 = &vertices[0];
+    const RasterVertex* v1 = &vertices[1];
+    const RasterVertex* v2 = &vertices[2];
+
+    int64_t area = (int64_t)(v1->x - v0->x) * (v2->y - v0->y) - (int64_t)(v1->y - v0->y) * (v2->x - v0->x);
+    if (area == 0)
+        return;
+
+    /* Wind the triangle so the inside is where the edge functions are positive. */
+    if (area < 0) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    int32_t min_x = std::min({ v0->x, v1->x, v2->x });
+    int32_t max_x = std::max({ v0->x, v1->x, v2->x });
+    int32_t min_y = std::min({ v0->y, v1->y, v2->y });
+    int32_t max_y = std::max({ v0->y, v1->y, v2->y });
+
+    if (max_x - min_x >= 1024 || max_y - min_y >= 512)
+        return;
+
+    int32_t left = std::max(min_x, env.clip_left);
+    int32_t right = std::min(max_x, env.clip_right);
+    int32_t top = std::max(min_y, env.clip_top);
+    int32_t bottom = std::min(max_y, env.clip_bottom);
+
+    if (left > right || top > bottom)
+        return;
+
+    /* Edge a->b: E(x, y) = a_x * x + c(y) >= 0 inside, c(y) = c_y * y + c0.  */
+    /* Top and left edges include their pixels, the others need E > 0.      */
+    struct Edge { int64_t a_x, c_y, c0; };
+    Edge edges[3];
+    const RasterVertex* ends[3][2] = { { v0, v1 }, { v1, v2 }, { v2, v0 } };
+
+    for (int i = 0; i < 3; i++) {
+        const RasterVertex* a = ends[i][0];
+        const RasterVertex* b = ends[i][1];
+        int64_t dx = b->x - a->x;
+        int64_t dy = b->y - a->y;
+        bool top_left = dy < 0 || (dy == 0 && dx > 0);
+
+        edges[i].a_x = -dy;
+        edges[i].c_y = dx;
+        edges[i].c0 = dy * a->x - dx * a->y - (top_left ? 0 : 1);
+    }
+
+    /* Attribute planes, 16.16 per pixel in x and y. */
+    auto gradient = [&](int32_t a0, int32_t a1, int32_t a2, int32_t& ddx, int32_t& ddy) {
+        int64_t d1 = a1 - a0;
+        int64_t d2 = a2 - a0;
+        ddx = (int32_t)(((d1 * (v2->y - v0->y) - d2 * (v1->y - v0->y)) << 16) / area);
+        ddy = (int32_t)(((d2 * (v1->x - v0->x) - d1 * (v2->x - v0->x)) << 16) / area);
+    };
+
+    SpanSetup dx = {}, dy = {};
+    gradient(v0->r, v1->r, v2->r, dx.r, dy.r);
+    gradient(v0->g, v1->g, v2->g, dx.g, dy.g);
+    gradient(v0->b, v1->b, v2->b, dx.b, dy.b);
+    if (prim.textured) {
+        gradient(v0->u, v1->u, v2->u, dx.u, dy.u);
+        gradient(v0->v, v1->v, v2->v, dx.v, dy.v);
+    }
+
+    SpanFunction span = span_function(prim);
+
+    for (int32_t y = top; y <= bottom; y++) {
+        int64_t x0 = left;
+        int64_t x1 = right;
+
+        for (const Edge& e : edges) {
+            int64_t c = e.c_y * y + e.c0;
+
+            if (e.a_x > 0)
+                x0 = std::max(x0, floor_div(-c + e.a_x - 1, e.a_x));
+            else if (e.a_x < 0)
+                x1 = std::min(x1, floor_div(c, -e.a_x));
+            else if (c < 0)
+                x1 = x0 - 1;
+        }
+
+        if (x0 > x1)
+            continue;
+
+        int64_t ox = x0 - v0->x;
+        int64_t oy = y - v0->y;
+        auto at = [&](int32_t base, int32_t ddx, int32_t ddy) {
+            return (int32_t)(((int64_t)base << 16) + 0x8000 + ddx * ox + ddy * oy);
+        };
+
+        SpanSetup s;
+        s.r = at(v0->r, dx.r, dy.r);
+        s.g = at(v0->g, dx.g, dy.g);
+        s.b = at(v0->b, dx.b, dy.b);
+        s.u = at(v0->u, dx.u, dy.u);
+        s.v = at(v0->v, dx.v, dy.v);
+        s.dr = dx.r;
+        s.dg = dx.g;
+        s.db = dx.b;
+        s.du = dx.u;
+        s.dv = dx.v;
+
+        (this->*span)(y, (int32_t)x0, (int32_t)x1, s, prim);
+    }
+}
+
+void Rasterizer::rectangle(const RasterVertex& corner, int32_t width, int32_t height,
+                           bool flip_x, bool flip_y, const RasterPrim& prim) {
+    int32_t left = std::max(corner.x, env.clip_left);
+    int32_t right = std::min(corner.x + width - 1, env.clip_right);
+    int32_t top = std::max(corner.y, env.clip_top);
+    int32_t bottom = std::min(corner.y + height - 1, env.clip_bottom);
+
+    if (left > right || top > bottom)
+        return;
+
+    int32_t step_u = flip_x ? -1 : 1;
+    int32_t step_v = flip_y ? -1 : 1;
+    SpanFunction span = span_function(prim);
+
+    for (int32_t y = top; y <= bottom; y++) {
+        SpanSetup s = {};
+        s.r = corner.r << 16;
+        s.g = corner.g << 16;
+        s.b = corner.b << 16;
+        s.u = (corner.u + (left - corner.x) * step_u) << 16;
+        s.v = (corner.v + (y - corner.y) * step_v) << 16;
+        s.du = step_u << 16;
+
+        (this->*span)(y, left, right, s, prim);
+    }
+}
+
+void Rasterizer::line(const RasterVertex& a, const RasterVertex& b, const RasterPrim& prim) {
+    int32_t dx = b.x - a.x;
+    int32_t dy = b.y - a.y;
+    if (std::abs(dx) >= 1024 || std::abs(dy) >= 512)
+        return;
+
+    int32_t steps = std::max(std::abs(dx), std::abs(dy));
+    auto step = [steps](int32_t from, int32_t to) {
+        return steps ? (int32_t)(((int64_t)(to - from) << 16) / steps) : 0;
+    };
+
+    int32_t x = (a.x << 16) + 0x8000;
+    int32_t y = (a.y << 16) + 0x8000;
+    int32_t sx = step(a.x, b.x);
+    int32_t sy = step(a.y, b.y);
+
+    SpanSetup s = {};
+    s.r = (a.r << 16) + 0x8000;
+    s.g = (a.g << 16) + 0x8000;
+    s.b = (a.b << 16) + 0x8000;
+    int32_t sr = step(a.r, b.r);
+    int32_t sg = step(a.g, b.g);
+    int32_t sb = step(a.b, b.b);
+    SpanFunction span = span_function(prim);
+
+    for (int32_t i = 0; i <= steps; i++, x += sx, y += sy, s.r += sr, s.g += sg, s.b += sb) {
+        int32_t px = x >> 16;
+        int32_t py = y >> 16;
+
+        if (px >= env.clip_left && px <= env.clip_right && py >= env.clip_top && py <= env.clip_bottom)
+            (this->*span)(py, px, px, s, prim);
+    }
+}
+
+void Rasterizer::fill(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t color) {
+    for (uint32_t row = 0; row < height; row++) {
+        uint16_t* pixels = vram.row(y + row);
+        for (uint32_t column = 0; column < width; column++)
+            pixels[(x + column) & (VRAM::WIDTH - 1)] = color;
+    }
+}
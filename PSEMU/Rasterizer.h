@@ -0,0 +1,110 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include "VRAM.h"
+#include "SpanKernels.h"
+
+/* Drawing state shared by every primitive, set from the GP0 E2-E6 registers. */
+struct DrawEnv {
+    /* Drawing area, inclusive. */
+    int32_t clip_left = 0;
+    int32_t clip_top = 0;
+    int32_t clip_right = 0;
+    int32_t clip_bottom = 0;
+
+    bool set_mask = false; /* Write pixels with bit 15 set. */
+    bool check_mask = false; /* Leave pixels with bit 15 set alone. */
+
+    /* Texture window in texels: u = (u & ~mask) | (offset & mask). */
+    uint32_t window_mask_u = 0;
+    uint32_t window_mask_v = 0;
+    uint32_t window_offset_u = 0;
+    uint32_t window_offset_v = 0;
+};
+
+/* How a single primitive is drawn. */
+struct RasterPrim {
+    bool textured = false;
+    bool raw = false; /* Texels are not modulated by the vertex colour. */
+    bool semi = false;
+    bool dither = false;
+    uint32_t semi_mode = 0; /* 0 = B/2+F/2, 1 = B+F, 2 = B-F, 3 = B+F/4. */
+
+    /* Texture page origin and CLUT position in VRAM pixels. */
+    uint32_t page_x = 0;
+    uint32_t page_y = 0;
+    uint32_t depth = 0; /* 0 = 4 bit, 1 = 8 bit, 2 = 15 bit. */
+    uint32_t clut_x = 0;
+    uint32_t clut_y = 0;
+
+    /* The page decoded by the texture cache, 256x256, or null to go through VRAM. */
+    const uint16_t* texels = nullptr;
+};
+
+/* A vertex after the drawing offset is applied. Colours are 8 bit. */
+struct RasterVertex {
+    int32_t x, y;
+    int32_t r, g, b;
+    int32_t u, v;
+};
+
+/* Interpolants at the first pixel of a span and their per pixel steps, 16.16 fixed point. */
+struct SpanSetup {
+    int32_t r, g, b, u, v;
+    int32_t dr, dg, db, du, dv;
+};
+
+/*
+ * Software rasterizer drawing straight into VRAM. Triangles are walked a
+ * row at a time: the three edge functions give the covered span of the
+ * row in integer maths, the colour and texture coordinates are planes
+ * stepped along it. Rectangles and lines produce spans too, so all
+ * pixels go through draw_span, which runs the span kernels over them in
+ * chunks of SPAN_CHUNK pixels.
+ *
+ * Like the GPU, the right and bottom edges of a triangle are not drawn
+ * and primitives of 1024x512 or more are dropped.
+ */
+class Rasterizer {
+public:
+    static const uint32_t SPAN_CHUNK = 256;
+
+    explicit Rasterizer(VRAM& vram) : vram(vram), kernels(&span_kernels(best_span_isa())) {}
+
+    /* Scalar gives the reference kernels. */
+    void set_span_isa(SpanISA isa) { kernels = &span_kernels(isa); }
+
+    void triangle(const RasterVertex vertices[3], const RasterPrim& prim);
+
+    /* Colour and texture coordinates of the top left corner come from corner. */
+    void rectangle(const RasterVertex& corner, int32_t width, int32_t height,
+                   bool flip_x, bool flip_y, const RasterPrim& prim);
+
+    /* Both end points are drawn. */
+    void line(const RasterVertex& a, const RasterVertex& b, const RasterPrim& prim);
+
+    /* GP0(02): plain 15 bit fill, ignores the drawing area and the mask. */
+    void fill(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t color);
+
+    void draw_span(int32_t y, int32_t x0, int32_t x1, SpanSetup s, const RasterPrim& prim);
+
+    DrawEnv env;
+
+private:
+    using SpanFunction = void (Rasterizer::*)(int32_t y, int32_t x0, int32_t x1, SpanSetup s, const RasterPrim& prim);
+
+    /* draw_span built for the primitive's texture and blending flags, picked once per primitive. */
+    template<bool textured, bool raw, bool semi>
+    void draw_span_as(int32_t y, int32_t x0, int32_t x1, SpanSetup s, const RasterPrim& prim);
+    static SpanFunction span_function(const RasterPrim& prim);
+
+    VRAM& vram;
+    const SpanKernels* kernels;
+};
@@ -0,0 +1,160 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <cmath>
+#include "Resampler.h"
+#include "SIMD.h"
+
+const double PI = 3.14159265358979323846;
+
+Resampler::Resampler(uint32_t in_rate, uint32_t out_rate) {
+    base_step = (double)in_rate / out_rate;
+    step = base_step;
+
+    /* Cut a little below the lower of the two Nyquist frequencies. */
+    double cutoff = 0.45 * std::min(1.0, (double)out_rate / in_rate);
+
+    for (int p = 0; p <= PHASES; p++) {
+        double sum = 0;
+        for (int k = 0; k < TAPS; k++) {
+            double x = (k - TAPS / 2 + 1) - (double)p / PHASES;
+            double sinc = x == 0 ? 1.0 : std::sin(2 * PI * cutoff * x) / (2 * PI * cutoff * x);
+            double window = 0.42 + 0.5 * std::cos(2 * PI * x / TAPS) + 0.08 * std::cos(4 * PI * x / TAPS);
+            double value = std::abs(x) >= TAPS / 2 ? 0.0 : 2 * cutoff * sinc * window;
+
+            bank[p][k] = (float)value;
+            sum += value;
+        }
+
+        /* Unity gain at DC for every phase. */
+        for (int k = 0; k < TAPS; k++)
+            bank[p][k] = (float)(bank[p][k] / sum);
+    }
+
+    for (int ch = 0; ch < 2; ch++)
+        history[ch].assign(TAPS, 0.0f);
+}
+
+void Resampler::set_adjust(double adjust) {
+    step = base_step * (1.0 + adjust);
+}
+
+void Resampler::feed(const int16_t* frames, size_t count) {
+    for (int ch = 0; ch < 2; ch++) {
+        std::vector<float>& h = history[ch];
+        size_t start = h.size();
+        h.resize(start + count);
+
+        for (size_t i = 0; i < count; i++)
+            h[start + i] = frames[i * 2 + ch];
+    }
+}
+
+size_t Resampler::buffered() const {
+    size_t used = TAPS + (size_t)position;
+    return history[0].size() > used ? history[0].size() - used : 0;
+}
+
+void Resampler::output_scalar(size_t index, float frac, float& left, float& right) const {
+    float t = frac * PHASES;
+    int phase = std::min((int)t, PHASES - 1);
+    float f = t - phase;
+
+    const float* c0 = bank[phase];
+    const float* c1 = bank[phase + 1];
+    const float* l = history[0].data() + index - TAPS / 2 + 1;
+    const float* r = history[1].data() + index - TAPS / 2 + 1;
+
+    left = 0;
+    right = 0;
+    for (int k = 0; k < TAPS; k++) {
+        float c = c0[k] + (c1[k] - c0[k]) * f;
+        left += c * l[k];
+        right += c * r[k];
+    }
+}
+
+#ifdef PSEMU_X86
+PSEMU_TARGET("avx2")
+static float horizontal_sum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+PSEMU_TARGET("avx2")
+void Resampler::output_avx2(size_t index, float frac, float& left, float& right) const {
+    float t = frac * PHASES;
+    int phase = std::min((int)t, PHASES - 1);
+    __m256 f = _mm256_set1_ps(t - phase);
+
+    const float* l = history[0].data() + index - TAPS / 2 + 1;
+    const float* r = history[1].data() + index - TAPS / 2 + 1;
+
+    __m256 sum_left = _mm256_setzero_ps();
+    __m256 sum_right = _mm256_setzero_ps();
+
+    for (int k = 0; k < TAPS; k += 8) {
+        __m256 c0 = _mm256_load_ps(bank[phase] + k);
+        __m256 c1 = _mm256_load_ps(bank[phase + 1] + k);
+        __m256 c = _mm256_add_ps(c0, _mm256_mul_ps(_mm256_sub_ps(c1, c0), f));
+
+        sum_left = _mm256_add_ps(sum_left, _mm256_mul_ps(c, _mm256_loadu_ps(l + k)));
+        sum_right = _mm256_add_ps(sum_right, _mm256_mul_ps(c, _mm256_loadu_ps(r + k)));
+    }
+
+    left = horizontal_sum(sum_left);
+    right = horizontal_sum(sum_right);
+}
+#else
+void Resampler::output_avx2(size_t index, float frac, float& left, float& right) const {
+    output_scalar(index, frac, left, right);
+}
+#endif
+
+static int16_t to_pcm(float value) {
+    return (int16_t)std::clamp(std::lrint(value), -0x8000L, 0x7fffL);
+}
+
+size_t Resampler::process(int16_t* out, size_t count) {
+    bool vector = use_simd && simd::has_avx2();
+    size_t produced = 0;
+
+    while (produced < count) {
+        double at = TAPS + position;
+        size_t index = (size_t)at;
+
+        /* The taps reach TAPS / 2 frames ahead. */
+        if (index + TAPS / 2 >= history[0].size())
+            break;
+
+        float left, right;
+        if (vector)
+            output_avx2(index, (float)(at - index), left, right);
+        else
+            output_scalar(index, (float)(at - index), left, right);
+
+        out[produced * 2] = to_pcm(left);
+        out[produced * 2 + 1] = to_pcm(right);
+        produced++;
+
+        position += step;
+    }
+
+    /* Drop what is behind the history window. */
+    size_t used = (size_t)position;
+    if (used > 0) {
+        for (int ch = 0; ch < 2; ch++)
+            history[ch].erase(history[ch].begin(), history[ch].begin() + used);
+        position -= used;
+    }
+
+    return produced;
+}
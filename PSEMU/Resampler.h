@@ -0,0 +1,55 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Stereo polyphase FIR resampler. The filter bank holds a windowed sinc
+ * for PHASES fractional positions, coefficients for positions in between
+ * are interpolated. The ratio can be nudged while running, which is how
+ * the audio output keeps its buffer from running dry or overflowing.
+ */
+class Resampler {
+public:
+    static const int TAPS = 16;
+    static const int PHASES = 256;
+
+    Resampler(uint32_t in_rate, uint32_t out_rate);
+
+    /* Input frames consumed per output frame = in / out * (1 + adjust). */
+    void set_adjust(double adjust);
+
+    /* Queues interleaved stereo input. */
+    void feed(const int16_t* frames, size_t count);
+
+    /* Queued input frames not used up yet. */
+    size_t buffered() const;
+
+    /* Writes up to count interleaved frames, returns how many were made. */
+    size_t process(int16_t* out, size_t count);
+
+    /* Clearing this forces the scalar reference path. */
+    bool use_simd = true;
+
+private:
+    void output_scalar(size_t index, float frac, float& left, float& right) const;
+    void output_avx2(size_t index, float frac, float& left, float& right) const;
+
+    /* bank[PHASES] repeats phase 0 shifted by one tap, for the interpolation. */
+    alignas(32) float bank[PHASES + 1][TAPS];
+
+    /* Deinterleaved input, starting with TAPS frames of history. */
+    std::vector<float> history[2];
+
+    double base_step;
+    double step;
+    double position = 0; /* Relative to the first frame after the history. */
+};
@@ -0,0 +1,440 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "Reverb.h"
+#include "SPU.h"
+#include "SIMD.h"
+
+/* Bytes one block moves through the work area. */
+const int32_t BLOCK_BYTES = REVERB_BLOCK * 2;
+
+static int32_t mul(int32_t a, int32_t b) {
+    return (a * b) >> 15;
+}
+
+static int32_t sat(int32_t value) {
+    return std::clamp(value, -0x8000, 0x7fff);
+}
+
+Reverb::Reverb(std::vector<uint8_t>& ram) : ram(ram) {}
+
+void Reverb::set_base(uint32_t addr) {
+    base = addr & (SPU_RAM_SIZE - 2);
+    current = base;
+}
+
+/* Offsets are relative to the current position and wrap inside the work area. */
+uint32_t Reverb::address(int32_t offset) const {
+    int32_t size = SPU_RAM_SIZE - base;
+    int32_t rel = (int32_t)(current - base) + offset;
+
+    /* Taps are usually within one lap of the work area. */
+    if (rel >= size)
+        rel -= size;
+    else if (rel < 0)
+        rel += size;
+
+    if (rel < 0 || rel >= size) {
+        rel %= size;
+        if (rel < 0)
+            rel += size;
+    }
+
+    return (base + (uint32_t)rel) & (SPU_RAM_SIZE - 2);
+}
+
+int32_t Reverb::read(int32_t offset) const {
+    uint32_t addr = address(offset);
+    return (int16_t)(ram[addr] | (ram[addr + 1] << 8));
+}
+
+void Reverb::write(int32_t offset, int32_t value) {
+    uint32_t addr = address(offset);
+    ram[addr] = (uint8_t)value;
+    ram[addr + 1] = (uint8_t)(value >> 8);
+}
+
+void Reverb::load_run(int32_t offset, int16_t* run) const {
+    uint32_t addr = address(offset);
+    if (addr + BLOCK_BYTES <= SPU_RAM_SIZE && addr + BLOCK_BYTES - 2 == address(offset + BLOCK_BYTES - 2)) {
+        std::memcpy(run, &ram[addr], BLOCK_BYTES);
+        return;
+    }
+
+    for (uint32_t i = 0; i < REVERB_BLOCK; i++)
+        run[i] = (int16_t)read(offset + i * 2);
+}
+
+void Reverb::store_run(int32_t offset, const int16_t* run) {
+    uint32_t addr = address(offset);
+    if (addr + BLOCK_BYTES <= SPU_RAM_SIZE && addr + BLOCK_BYTES - 2 == address(offset + BLOCK_BYTES - 2)) {
+        std::memcpy(&ram[addr], run, BLOCK_BYTES);
+        return;
+    }
+
+    for (uint32_t i = 0; i < REVERB_BLOCK; i++)
+        write(offset + i * 2, run[i]);
+}
+
+/* True when no tap reads, later in the same block, what another tap wrote */
+/* in it, so the block can be done as whole runs. Reads ahead of a write  */
+/* are fine, they get there first. The IIR reading back its own last     */
+/* output is the one dependency the vector path keeps.                   */
+bool Reverb::block_is_independent() {
+    /* Only depends on the configuration, which rarely changes. */
+    if (base == checked_base && std::memcmp(regs, checked_regs, sizeof(regs)) == 0)
+        return independent;
+
+    checked_base = base;
+    std::memcpy(checked_regs, regs, sizeof(regs));
+    independent = false;
+
+    int64_t size = SPU_RAM_SIZE - base;
+    if (size < BLOCK_BYTES * 4)
+        return false;
+
+    const int32_t writes[8] = {
+        offset(mLSAME), offset(mRSAME), offset(mLDIFF), offset(mRDIFF),
+        offset(mLAPF1), offset(mRAPF1), offset(mLAPF2), offset(mRAPF2)
+    };
+
+    /* The first 4 are the IIR feedback reads, paired with writes[0..3]. */
+    const int32_t reads[20] = {
+        offset(mLSAME) - 2, offset(mRSAME) - 2, offset(mLDIFF) - 2, offset(mRDIFF) - 2,
+        offset(dLSAME), offset(dRSAME), offset(dLDIFF), offset(dRDIFF),
+        offset(mLCOMB1), offset(mRCOMB1), offset(mLCOMB2), offset(mRCOMB2),
+        offset(mLCOMB3), offset(mRCOMB3), offset(mLCOMB4), offset(mRCOMB4),
+        offset(mLAPF1) - offset(dAPF1), offset(mRAPF1) - offset(dAPF1),
+        offset(mLAPF2) - offset(dAPF2), offset(mRAPF2) - offset(dAPF2)
+    };
+
+    /* How far the first tap is ahead of the second, around the work area. */
+    auto ahead = [size](int32_t a, int32_t b) {
+        int64_t distance = ((int64_t)a - b) % size;
+        if (distance < 0)
+            distance += size;
+        return distance;
+    };
+
+    for (int w = 0; w < 8; w++) {
+        /* Two writes to one place have to land in the right order. */
+        for (int other = w + 1; other < 8; other++) {
+            if (ahead(writes[w], writes[other]) < BLOCK_BYTES || ahead(writes[other], writes[w]) < BLOCK_BYTES)
+                return false;
+        }
+
+        for (int r = 0; r < 20; r++) {
+            if (w < 4 && r == w)
+                continue;
+            if (ahead(writes[w], reads[r]) < BLOCK_BYTES)
+                return false;
+        }
+    }
+
+    independent = true;
+    return true;
+}
+
+void Reverb::process_block(const int16_t in[2][REVERB_BLOCK], int16_t out[2][REVERB_BLOCK]) {
+    if (!enabled) {
+        std::memset(out, 0, sizeof(int16_t) * 2 * REVERB_BLOCK);
+        return;
+    }
+
+#ifdef PSEMU_X86
+    if (use_simd && simd::has_avx2() && block_is_independent()) {
+        process_vector(in, out);
+        vector_blocks++;
+        return;
+    }
+#endif
+
+    process_scalar(in, out);
+    scalar_blocks++;
+}
+
+/* One frame at a time, straight from the hardware description. */
+void Reverb::process_scalar(const int16_t in[2][REVERB_BLOCK], int16_t out[2][REVERB_BLOCK]) {
+    int32_t wall = volume(vWALL);
+    int32_t iir = volume(vIIR);
+
+    for (uint32_t i = 0; i < REVERB_BLOCK; i++) {
+        int32_t left_in = mul(volume(vLIN), in[0][i]);
+        int32_t right_in = mul(volume(vRIN), in[1][i]);
+
+        /* Same side and different side reflections. */
+        int32_t prev = read(offset(mLSAME) - 2);
+        write(offset(mLSAME), sat(mul(sat(left_in + mul(read(offset(dLSAME)), wall) - prev), iir) + prev));
+        prev = read(offset(mRSAME) - 2);
+        write(offset(mRSAME), sat(mul(sat(right_in + mul(read(offset(dRSAME)), wall) - prev), iir) + prev));
+        prev = read(offset(mLDIFF) - 2);
+        write(offset(mLDIFF), sat(mul(sat(left_in + mul(read(offset(dRDIFF)), wall) - prev), iir) + prev));
+        prev = read(offset(mRDIFF) - 2);
+        write(offset(mRDIFF), sat(mul(sat(right_in + mul(read(offset(dLDIFF)), wall) - prev), iir) + prev));
+
+        /* Early echo. */
+        int32_t left = mul(volume(vCOMB1), read(offset(mLCOMB1))) + mul(volume(vCOMB2), read(offset(mLCOMB2))) +
+                       mul(volume(vCOMB3), read(offset(mLCOMB3))) + mul(volume(vCOMB4), read(offset(mLCOMB4)));
+        int32_t right = mul(volume(vCOMB1), read(offset(mRCOMB1))) + mul(volume(vCOMB2), read(offset(mRCOMB2))) +
+                        mul(volume(vCOMB3), read(offset(mRCOMB3))) + mul(volume(vCOMB4), read(offset(mRCOMB4)));
+
+        /* Late reverb, two all-pass filters. */
+        const ReverbReg apf[2][2] = { { mLAPF1, mRAPF1 }, { mLAPF2, mRAPF2 } };
+        const ReverbReg apf_distance[2] = { dAPF1, dAPF2 };
+        const ReverbReg apf_volume[2] = { vAPF1, vAPF2 };
+
+        for (int stage = 0; stage < 2; stage++) {
+            int32_t v = volume(apf_volume[stage]);
+            int32_t d = offset(apf_distance[stage]);
+
+            int32_t delayed = read(offset(apf[stage][0]) - d);
+            int32_t t = sat(left - mul(v, delayed));
+            write(offset(apf[stage][0]), t);
+            left = sat(mul(t, v) + delayed);
+
+            delayed = read(offset(apf[stage][1]) - d);
+            t = sat(right - mul(v, delayed));
+            write(offset(apf[stage][1]), t);
+            right = sat(mul(t, v) + delayed);
+        }
+
+        out[0][i] = (int16_t)sat(mul(left, out_volume[0]));
+        out[1][i] = (int16_t)sat(mul(right, out_volume[1]));
+
+        current = address(2);
+    }
+}
+
+#ifdef PSEMU_X86
+PSEMU_TARGET("avx2")
+static __m256i mul_avx2(__m256i a, __m256i b) {
+    return _mm256_srai_epi32(_mm256_mullo_epi32(a, b), 15);
+}
+
+PSEMU_TARGET("avx2")
+static __m256i sat_avx2(__m256i value) {
+    return _mm256_min_epi32(_mm256_max_epi32(value, _mm256_set1_epi32(-0x8000)), _mm256_set1_epi32(0x7fff));
+}
+
+PSEMU_TARGET("avx2")
+static __m256i load8(const int16_t* p) {
+    return _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+PSEMU_TARGET("avx2")
+static void store8(int16_t* p, __m256i value) {
+    /* Values are already saturated, packing just drops the upper halves. */
+    __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+}
+
+/* IIR input without the feedback term: in * vIN + wall tap * vWALL. */
+PSEMU_TARGET("avx2")
+static void iir_input_avx2(const int16_t* in, const int16_t* wall_tap, int32_t in_volume, int32_t wall, int32_t* dst) {
+    const __m256i vin = _mm256_set1_epi32(in_volume);
+    const __m256i vwall = _mm256_set1_epi32(wall);
+
+    for (uint32_t i = 0; i < REVERB_BLOCK; i += 8) {
+        __m256i value = _mm256_add_epi32(mul_avx2(vin, load8(in + i)), mul_avx2(load8(wall_tap + i), vwall));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), value);
+    }
+}
+
+/* Comb taps, both all-pass stages and the output volume for one side. */
+PSEMU_TARGET("avx2")
+static void late_reverb_avx2(const int16_t* const comb[4], const int32_t comb_volume[4],
+                             const int16_t* const delayed[2], int16_t* const apf[2], const int32_t apf_volume[2],
+                             int32_t out_volume, int16_t* out) {
+    for (uint32_t i = 0; i < REVERB_BLOCK; i += 8) {
+        __m256i value = _mm256_setzero_si256();
+        for (int c = 0; c < 4; c++)
+            value = _mm256_add_epi32(value, mul_avx2(_mm256_set1_epi32(comb_volume[c]), load8(comb[c] + i)));
+
+        for (int stage = 0; stage < 2; stage++) {
+            __m256i v = _mm256_set1_epi32(apf_volume[stage]);
+            __m256i d = load8(delayed[stage] + i);
+
+            __m256i t = sat_avx2(_mm256_sub_epi32(value, mul_avx2(v, d)));
+            store8(apf[stage] + i, t);
+            value = sat_avx2(_mm256_add_epi32(mul_avx2(t, v), d));
+        }
+
+        store8(out + i, sat_avx2(mul_avx2(value, _mm256_set1_epi32(out_volume))));
+    }
+}
+
+PSEMU_TARGET("avx2")
+void Reverb::process_vector(const int16_t in[2][REVERB_BLOCK], int16_t out[2][REVERB_BLOCK]) {
+    /* mLSAME takes dLSAME, mRSAME dRSAME, mLDIFF dRDIFF and mRDIFF dLDIFF. */
+    const ReverbReg iir_dst[4] = { mLSAME, mRSAME, mLDIFF, mRDIFF };
+    const ReverbReg iir_tap[4] = { dLSAME, dRSAME, dRDIFF, dLDIFF };
+    const ReverbReg comb_taps[2][4] = {
+        { mLCOMB1, mLCOMB2, mLCOMB3, mLCOMB4 },
+        { mRCOMB1, mRCOMB2, mRCOMB3, mRCOMB4 }
+    };
+    const ReverbReg apf_taps[2][2] = { { mLAPF1, mLAPF2 }, { mRAPF1, mRAPF2 } };
+    const int32_t comb_volume[4] = { volume(vCOMB1), volume(vCOMB2), volume(vCOMB3), volume(vCOMB4) };
+    const int32_t apf_volume[2] = { volume(vAPF1), volume(vAPF2) };
+    const int32_t apf_distance[2] = { offset(dAPF1), offset(dAPF2) };
+
+    alignas(32) int16_t wall_taps[4][REVERB_BLOCK];
+    alignas(32) int16_t comb[2][4][REVERB_BLOCK];
+    alignas(32) int16_t delayed[2][2][REVERB_BLOCK];
+    int32_t prev[4];
+
+    /* Every read comes before every write, block_is_independent made */
+    /* sure no read in the block wants data written in it.            */
+    for (int k = 0; k < 4; k++) {
+        load_run(offset(iir_tap[k]), wall_taps[k]);
+        prev[k] = read(offset(iir_dst[k]) - 2);
+    }
+    for (int side = 0; side < 2; side++) {
+        for (int c = 0; c < 4; c++)
+            load_run(offset(comb_taps[side][c]), comb[side][c]);
+        for (int stage = 0; stage < 2; stage++)
+            load_run(offset(apf_taps[side][stage]) - apf_distance[stage], delayed[side][stage]);
+    }
+
+    /* The IIR feeds on its own last output, this part stays serial. */
+    alignas(32) int32_t iir_in[REVERB_BLOCK];
+    alignas(32) int16_t iir_out[4][REVERB_BLOCK];
+    int32_t iir = volume(vIIR);
+
+    for (int k = 0; k < 4; k++) {
+        iir_input_avx2(in[k & 1], wall_taps[k], volume((k & 1) ? vRIN : vLIN), volume(vWALL), iir_in);
+
+        int32_t last = prev[k];
+        for (uint32_t i = 0; i < REVERB_BLOCK; i++) {
+            last = sat(mul(sat(iir_in[i] - last), iir) + last);
+            iir_out[k][i] = (int16_t)last;
+        }
+    }
+
+    alignas(32) int16_t apf[2][2][REVERB_BLOCK];
+    for (int side = 0; side < 2; side++) {
+        const int16_t* const comb_runs[4] = { comb[side][0], comb[side][1], comb[side][2], comb[side][3] };
+        const int16_t* const delayed_runs[2] = { delayed[side][0], delayed[side][1] };
+        int16_t* const apf_runs[2] = { apf[side][0], apf[side][1] };
+        late_reverb_avx2(comb_runs, comb_volume, delayed_runs, apf_runs, apf_volume, out_volume[side], out[side]);
+    }
+
+    for (int k = 0; k < 4; k++)
+        store_run(offset(iir_dst[k]), iir_out[k]);
+    for (int side = 0; side < 2; side++) {
+        for (int stage = 0; stage < 2; stage++)
+            store_run(offset(apf_taps[side][stage]), apf[side][stage]);
+    }
+
+    current = address(BLOCK_BYTES);
+}
+#else
+void Reverb::process_vector(const int16_t in[2][REVERB_BLOCK], int16_t out[2][REVERB_BLOCK]) {
+    process_scalar(in, out);
+}
+#endif
+
+/* A random work area and register set. Dependent layouts put one read */
+/* less than a block behind a write, so they have to go scalar.        */
+static void random_layout(std::mt19937& rng, Reverb& reverb, bool dependent, uint32_t n) {
+    for (auto& reg : reverb.regs)
+        reg = (uint16_t)rng();
+    reverb.out_volume[0] = (int16_t)rng();
+    reverb.out_volume[1] = (int16_t)rng();
+    reverb.enabled = true;
+    reverb.set_base((uint32_t)(rng() % (SPU_RAM_SIZE - 0x1000)) & ~7u);
+
+    if (!dependent)
+        return;
+
+    const ReverbReg writes[8] = { mLSAME, mRSAME, mLDIFF, mRDIFF, mLAPF1, mRAPF1, mLAPF2, mRAPF2 };
+    const ReverbReg reads[12] = {
+        dLSAME, dRSAME, dLDIFF, dRDIFF, mLCOMB1, mRCOMB1, mLCOMB2, mRCOMB2, mLCOMB3, mRCOMB3, mLCOMB4, mRCOMB4
+    };
+
+    /* Every write against every tap, then the all-pass stages reading their own output. */
+    if (n < 96) {
+        ReverbReg w = writes[n % 8];
+        reverb.regs[w] = (uint16_t)std::max<uint32_t>(reverb.regs[w], 8);
+        reverb.regs[reads[n / 8]] = (uint16_t)(reverb.regs[w] - rng() % 8);
+    } else {
+        reverb.regs[(n & 1) ? dAPF2 : dAPF1] = (uint16_t)(rng() % 8);
+    }
+}
+
+bool bench_reverb(uint32_t iterations) {
+    const uint32_t layouts = 256;
+    const uint32_t dependent_layouts = 100;
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> ram[2] = { std::vector<uint8_t>(SPU_RAM_SIZE), std::vector<uint8_t>(SPU_RAM_SIZE) };
+    std::vector<int16_t> in(iterations * 2 * REVERB_BLOCK);
+    std::vector<int16_t> out[2] = { std::vector<int16_t>(in.size()), std::vector<int16_t>(in.size()) };
+
+    double seconds[2] = {};
+    uint32_t mismatches = 0, vectorised = 0, missed = 0;
+
+    for (uint32_t layout = 0; layout < layouts; layout++) {
+        bool dependent = layout < dependent_layouts;
+
+        for (auto& byte : ram[0])
+            byte = (uint8_t)rng();
+        ram[1] = ram[0];
+        for (auto& sample : in)
+            sample = (int16_t)rng();
+
+        std::mt19937 layout_rng(rng());
+        uint64_t vector_blocks = 0;
+
+        for (int vector = 0; vector < 2; vector++) {
+            if (vector == 1 && !simd::has_avx2())
+                continue;
+
+            Reverb reverb(ram[vector]);
+            std::mt19937 copy = layout_rng;
+            random_layout(copy, reverb, dependent, layout);
+            reverb.use_simd = vector == 1;
+
+            auto begin = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < iterations; i++) {
+                const int16_t* block_in = in.data() + i * 2 * REVERB_BLOCK;
+                int16_t* block_out = out[vector].data() + i * 2 * REVERB_BLOCK;
+                reverb.process_block(reinterpret_cast<const int16_t(*)[REVERB_BLOCK]>(block_in),
+                                     reinterpret_cast<int16_t(*)[REVERB_BLOCK]>(block_out));
+            }
+            seconds[vector] += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            vector_blocks = reverb.vector_blocks;
+        }
+
+        if (!simd::has_avx2())
+            continue;
+
+        if (out[1] != out[0] || ram[1] != ram[0])
+            mismatches++;
+        if (vector_blocks > 0)
+            vectorised++;
+        if (dependent && vector_blocks > 0)
+            missed++;
+    }
+
+    double blocks = (double)layouts * iterations;
+    printf("[SPU] reverb scalar %10.0f blocks/s\n", blocks / seconds[0]);
+    if (!simd::has_avx2())
+        return true;
+
+    printf("[SPU] reverb avx2   %10.0f blocks/s, %u of %u layouts vectorised, %u dependent%s\n",
+           blocks / seconds[1], vectorised, layouts, dependent_layouts, mismatches ? "  MISMATCH" : "");
+    if (missed > 0)
+        printf("[SPU] reverb: %u dependent layouts took the vector path\n", missed);
+
+    return mismatches == 0 && missed == 0;
+}
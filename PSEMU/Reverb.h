@@ -0,0 +1,84 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/* Reverb runs at half the output rate, a block is 32 stereo frames at 22.05 kHz. */
+const uint32_t REVERB_BLOCK = 32;
+
+/* The 32 reverb registers at 0x1f801dc0, in order. Addresses and */
+/* distances are in units of 8 bytes, volumes are signed 1.15.    */
+enum ReverbReg : uint32_t {
+    dAPF1, dAPF2, vIIR, vCOMB1, vCOMB2, vCOMB3, vCOMB4, vWALL, vAPF1, vAPF2,
+    mLSAME, mRSAME, mLCOMB1, mRCOMB1, mLCOMB2, mRCOMB2, dLSAME, dRSAME,
+    mLDIFF, mRDIFF, mLCOMB3, mRCOMB3, mLCOMB4, mRCOMB4, dLDIFF, dRDIFF,
+    mLAPF1, mRAPF1, mLAPF2, mRAPF2, vLIN, vRIN,
+    REVERB_REG_COUNT
+};
+
+/*
+ * The SPU reverb engine: same and different side IIR reflections, four
+ * comb taps and two all-pass stages, all working on a ring buffer (the
+ * work area) at the top of sound RAM.
+ *
+ * Work is done a block at a time. Unless the configured taps are closer
+ * than a block to each other, every read in a block hits data written
+ * before it, so everything but the IIR feedback runs as plain vector
+ * arithmetic on whole runs of the work area. Otherwise, or with use_simd
+ * cleared, the sample by sample reference is used; both give the same bits.
+ */
+class Reverb {
+public:
+    explicit Reverb(std::vector<uint8_t>& ram);
+
+    void set_base(uint32_t addr);
+
+    /* in and out are [left, right][REVERB_BLOCK]. */
+    void process_block(const int16_t in[2][REVERB_BLOCK], int16_t out[2][REVERB_BLOCK]);
+
+    uint16_t regs[REVERB_REG_COUNT] = {};
+    int32_t out_volume[2] = {};
+    bool enabled = false;
+
+    /* Clearing this forces the scalar reference path. */
+    bool use_simd = true;
+
+    uint64_t vector_blocks = 0;
+    uint64_t scalar_blocks = 0;
+
+private:
+    uint32_t address(int32_t offset) const;
+    int32_t read(int32_t offset) const;
+    void write(int32_t offset, int32_t value);
+
+    int32_t offset(ReverbReg reg) const { return regs[reg] * 8; }
+    int32_t volume(ReverbReg reg) const { return (int16_t)regs[reg]; }
+
+    bool block_is_independent();
+
+    void process_scalar(const int16_t in[2][REVERB_BLOCK], int16_t out[2][REVERB_BLOCK]);
+    void process_vector(const int16_t in[2][REVERB_BLOCK], int16_t out[2][REVERB_BLOCK]);
+
+    void load_run(int32_t offset, int16_t* run) const;
+    void store_run(int32_t offset, const int16_t* run);
+
+    std::vector<uint8_t>& ram;
+    uint32_t base = 0;
+    uint32_t current = 0;
+
+    uint16_t checked_regs[REVERB_REG_COUNT] = {};
+    uint32_t checked_base = UINT32_MAX;
+    bool independent = false;
+};
+
+/* Runs random reverb layouts, some with taps too close for the block path, */
+/* through the scalar and AVX2 paths and prints blocks/s. False if the     */
+/* output or the work area differs, or a dependent layout was vectorised.  */
+bool bench_reverb(uint32_t iterations);
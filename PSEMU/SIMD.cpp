@@ -0,0 +1,51 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include "SIMD.h"
+
+#if defined(PSEMU_X86) && defined(_MSC_VER)
+#include <intrin.h>
+
+static bool cpuid_bit(int leaf, int reg, int bit) {
+    int info[4];
+    __cpuidex(info, leaf, 0);
+    return (info[reg] >> bit) & 1;
+}
+
+static bool os_saves_ymm() {
+    /* OSXSAVE and AVX have to be set before XGETBV can be used. */
+    if (!cpuid_bit(1, 2, 27) || !cpuid_bit(1, 2, 28))
+        return false;
+
+    return (_xgetbv(0) & 0x6) == 0x6;
+}
+#endif
+
+bool simd::has_sse41() {
+#if defined(PSEMU_X86) && defined(_MSC_VER)
+    static const bool supported = cpuid_bit(1, 2, 19);
+    return supported;
+#elif defined(PSEMU_X86)
+    static const bool supported = __builtin_cpu_supports("sse4.1");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool simd::has_avx2() {
+#if defined(PSEMU_X86) && defined(_MSC_VER)
+    static const bool supported = os_saves_ymm() && cpuid_bit(7, 1, 5);
+    return supported;
+#elif defined(PSEMU_X86)
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,29 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+
+/* Vector paths are only built for x86, everything else uses the scalar code. */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PSEMU_X86 1
+#include <immintrin.h>
+#endif
+
+/* GCC and Clang need the target ISA on each vector function, */
+/* MSVC always allows the intrinsics. */
+#if defined(PSEMU_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PSEMU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PSEMU_TARGET(isa)
+#endif
+
+namespace simd {
+    /* Runtime CPU feature checks, cached after the first call. */
+    bool has_sse41();
+    bool has_avx2();
+}
@@ -0,0 +1,649 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "SPU.h"
+#include "SIMD.h"
+
+/* Filter coefficients in 6 bit fixed point. */
+static const int32_t filter_pos[5] = { 0, 60, 115, 98, 122 };
+static const int32_t filter_neg[5] = { 0, 0, -52, -55, -60 };
+
+/* About one second of output, older samples are dropped. */
+const size_t SAMPLE_BUFFER_LIMIT = SPU_SAMPLE_RATE * 2;
+
+/* Register offsets from 0x1f801c00. */
+const uint32_t VOICE_REGS_END = 0x180;
+const uint32_t MAIN_VOLUME_LEFT = 0x180;
+const uint32_t MAIN_VOLUME_RIGHT = 0x182;
+const uint32_t REVERB_VOLUME_LEFT = 0x184;
+const uint32_t REVERB_VOLUME_RIGHT = 0x186;
+const uint32_t KEY_ON = 0x188;
+const uint32_t KEY_OFF = 0x18c;
+const uint32_t PITCH_MOD = 0x190;
+const uint32_t NOISE_ON = 0x194;
+const uint32_t REVERB_ON = 0x198;
+const uint32_t ENDX = 0x19c;
+const uint32_t REVERB_BASE = 0x1a2;
+const uint32_t IRQ_ADDR = 0x1a4;
+const uint32_t TRANSFER_ADDR = 0x1a6;
+const uint32_t TRANSFER_FIFO = 0x1a8;
+const uint32_t CONTROL = 0x1aa;
+const uint32_t STATUS = 0x1ae;
+const uint32_t CD_VOLUME_LEFT = 0x1b0;
+const uint32_t CD_VOLUME_RIGHT = 0x1b2;
+const uint32_t REVERB_REGS = 0x1c0;
+const uint32_t VOICE_VOLUMES = 0x200;
+
+SPU::SPU() : ram(SPU_RAM_SIZE, 0), reverb(ram) {
+    control.raw = 0;
+}
+
+/* Fixed volume: 15 bit signed, doubled. Sweep mode is not emulated, */
+/* the volume just holds its last fixed value.                        */
+static void set_volume(int32_t& volume, uint16_t value) {
+    if (!(value & 0x8000))
+        volume = (int16_t)(value << 1);
+}
+
+uint16_t SPU::read(uint32_t offset) {
+    if (offset < VOICE_REGS_END) {
+        uint32_t voice = offset >> 4;
+
+        switch (offset & 0xf) {
+            case 0xc:
+                return (uint16_t)voices.envelope[voice];
+            case 0xe:
+                return (uint16_t)(voices.repeat_addr[voice] >> 3);
+            default:
+                return regs[offset >> 1];
+        }
+    }
+
+    if (offset >= VOICE_VOLUMES && offset < VOICE_VOLUMES + SPU_VOICES * 4) {
+        uint32_t voice = (offset - VOICE_VOLUMES) >> 2;
+        return (uint16_t)(offset & 2 ? voices.volume_right[voice] : voices.volume_left[voice]);
+    }
+
+    switch (offset) {
+        case ENDX:
+            return (uint16_t)endx;
+        case ENDX + 2:
+            return (uint16_t)(endx >> 16);
+        case TRANSFER_FIFO:
+            return 0;
+        case CONTROL:
+            return control.raw;
+        case STATUS: {
+            uint16_t stat = control.raw & 0x3f;
+            stat |= irq_flag << 6;
+            stat |= ((control.transfer_mode >> 1) & 1) << 7;
+            stat |= (control.transfer_mode == 2) << 8;
+            stat |= (control.transfer_mode == 3) << 9;
+            return stat;
+        }
+        default:
+            return regs[offset >> 1];
+    }
+}
+
+void SPU::write(uint32_t offset, uint16_t value) {
+    regs[offset >> 1] = value;
+
+    if (offset < VOICE_REGS_END) {
+        uint32_t voice = offset >> 4;
+
+        switch (offset & 0xf) {
+            case 0x0:
+                set_volume(voices.volume_left[voice], value);
+                break;
+            case 0x2:
+                set_volume(voices.volume_right[voice], value);
+                break;
+            case 0x4:
+                voices.pitch[voice] = value;
+                if (voices.phase[voice] != ADSRPhase::Off)
+                    voices.step[voice] = std::min<int32_t>(value, 0x4000);
+                break;
+            case 0x6:
+                voices.start_addr[voice] = (value << 3) & (SPU_RAM_SIZE - 1);
+                break;
+            case 0x8:
+                voices.adsr_low[voice] = value;
+                break;
+            case 0xa:
+                voices.adsr_high[voice] = value;
+                break;
+            case 0xc:
+                voices.envelope[voice] = std::clamp<int32_t>((int16_t)value, 0, 0x7fff);
+                break;
+            case 0xe:
+                voices.repeat_addr[voice] = (value << 3) & (SPU_RAM_SIZE - 1);
+                break;
+        }
+        return;
+    }
+
+    switch (offset) {
+        case MAIN_VOLUME_LEFT:
+            set_volume(main_volume[0], value);
+            break;
+        case MAIN_VOLUME_RIGHT:
+            set_volume(main_volume[1], value);
+            break;
+        case REVERB_VOLUME_LEFT:
+            reverb.out_volume[0] = (int16_t)value;
+            break;
+        case REVERB_VOLUME_RIGHT:
+            reverb.out_volume[1] = (int16_t)value;
+            break;
+        case KEY_ON:
+        case KEY_ON + 2:
+        case KEY_OFF:
+        case KEY_OFF + 2: {
+            uint32_t first = (offset & 2) ? 16 : 0;
+            for (uint32_t bit = 0; bit < 16 && first + bit < SPU_VOICES; bit++) {
+                if (!(value & (1 << bit)))
+                    continue;
+
+                if (offset < KEY_OFF)
+                    key_on(first + bit);
+                else
+                    key_off(first + bit);
+            }
+            break;
+        }
+        case PITCH_MOD:
+        case PITCH_MOD + 2:
+            /* Voice 0 has nothing to be modulated by. */
+            pitch_mod = (regs[PITCH_MOD >> 1] | (regs[(PITCH_MOD + 2) >> 1] << 16)) & 0xfffffe;
+            break;
+        case NOISE_ON:
+        case NOISE_ON + 2:
+            noise_on = (regs[NOISE_ON >> 1] | (regs[(NOISE_ON + 2) >> 1] << 16)) & 0xffffff;
+            for (uint32_t voice = 0; voice < SPU_VOICES; voice++)
+                voices.noise[voice] = (noise_on >> voice) & 1 ? -1 : 0;
+            break;
+        case REVERB_ON:
+        case REVERB_ON + 2:
+            reverb_on = (regs[REVERB_ON >> 1] | (regs[(REVERB_ON + 2) >> 1] << 16)) & 0xffffff;
+            for (uint32_t voice = 0; voice < SPU_VOICES; voice++)
+                voices.reverb[voice] = (reverb_on >> voice) & 1 ? -1 : 0;
+            break;
+        case REVERB_BASE:
+            reverb.set_base(value << 3);
+            break;
+        case IRQ_ADDR:
+            irq_addr = (value << 3) & (SPU_RAM_SIZE - 1);
+            break;
+        case TRANSFER_ADDR:
+            transfer_addr = (value << 3) & (SPU_RAM_SIZE - 1);
+            break;
+        case TRANSFER_FIFO:
+            check_irq(transfer_addr, 2);
+            ram[transfer_addr] = (uint8_t)value;
+            ram[transfer_addr + 1] = (uint8_t)(value >> 8);
+            transfer_addr = (transfer_addr + 2) & (SPU_RAM_SIZE - 1);
+            break;
+        case CONTROL:
+            control.raw = value;
+            reverb.enabled = control.reverb_enable;
+
+            /* Clearing the enable bit acknowledges the interrupt. */
+            if (!control.irq_enable)
+                irq_flag = false;
+            break;
+        case CD_VOLUME_LEFT:
+            cd_volume[0] = (int16_t)value;
+            break;
+        case CD_VOLUME_RIGHT:
+            cd_volume[1] = (int16_t)value;
+            break;
+        default:
+            if (offset >= REVERB_REGS && offset < REVERB_REGS + REVERB_REG_COUNT * 2)
+                reverb.regs[(offset - REVERB_REGS) >> 1] = value;
+            break;
+    }
+}
+
+uint32_t SPU::dma_read() {
+    check_irq(transfer_addr, 4);
+
+    uint32_t word = 0;
+    for (int i = 0; i < 4; i++) {
+        word |= ram[transfer_addr] << (8 * i);
+        transfer_addr = (transfer_addr + 1) & (SPU_RAM_SIZE - 1);
+    }
+    return word;
+}
+
+void SPU::dma_write(uint32_t word) {
+    check_irq(transfer_addr, 4);
+
+    for (int i = 0; i < 4; i++) {
+        ram[transfer_addr] = (uint8_t)(word >> (8 * i));
+        transfer_addr = (transfer_addr + 1) & (SPU_RAM_SIZE - 1);
+    }
+}
+
+void SPU::check_irq(uint32_t addr, uint32_t size) {
+    if (!control.irq_enable || irq_flag)
+        return;
+
+    if (((irq_addr - addr) & (SPU_RAM_SIZE - 1)) < size) {
+        irq_flag = true;
+        irq_raised = true;
+    }
+}
+
+void SPU::key_on(uint32_t voice) {
+    voices.phase[voice] = ADSRPhase::Attack;
+    voices.envelope[voice] = 0;
+    voices.adsr_wait[voice] = 0;
+    voices.counter[voice] = 0;
+    voices.step[voice] = std::min<int32_t>(voices.pitch[voice], 0x4000);
+    voices.history[voice][0] = voices.history[voice][1] = 0;
+    std::fill(std::begin(voices.decoded[voice]), std::end(voices.decoded[voice]), 0);
+
+    endx &= ~(1 << voice);
+    decode_block(voice, voices.start_addr[voice]);
+}
+
+void SPU::key_off(uint32_t voice) {
+    if (voices.phase[voice] == ADSRPhase::Off)
+        return;
+
+    voices.phase[voice] = ADSRPhase::Release;
+    voices.adsr_wait[voice] = 0;
+}
+
+/* Expands the 28 nibbles of a block and applies the range shift. */
+static void unpack_block_scalar(const uint8_t* data, int shift, int32_t* samples) {
+    for (uint32_t i = 0; i < SPU_BLOCK_SAMPLES; i++) {
+        int16_t t = (int16_t)(((data[i / 2] >> ((i & 1) * 4)) & 0xf) << 12);
+        samples[i] = t >> shift;
+    }
+}
+
+#ifdef PSEMU_X86
+PSEMU_TARGET("sse4.1")
+static void unpack_block_sse41(const uint8_t* data, int shift, int32_t* samples) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i mask = _mm_setr_epi16(0x0f, 0xf0, 0x0f, 0xf0, 0x0f, 0xf0, 0x0f, 0xf0);
+    const __m128i scale = _mm_setr_epi16(0x1000, 0x100, 0x1000, 0x100, 0x1000, 0x100, 0x1000, 0x100);
+
+    /* 4 bytes give 8 samples: low nibble first, then the high one. */
+    for (uint32_t i = 0; i < 32; i += 8) {
+        __m128i t = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(data + i / 2)));
+        t = _mm_unpacklo_epi16(t, t);
+        t = _mm_mullo_epi16(_mm_and_si128(t, mask), scale);
+        t = _mm_sra_epi16(t, count);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + i), _mm_cvtepi16_epi32(t));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + i + 4), _mm_cvtepi16_epi32(_mm_srli_si128(t, 8)));
+    }
+}
+#endif
+
+void SPU::decode_block(uint32_t voice, uint32_t addr) {
+    addr &= SPU_RAM_SIZE - 1;
+    check_irq(addr, 16);
+
+    /* Blocks are 8 byte aligned and may wrap around the end of RAM. The */
+    /* padding lets the vector unpack read whole registers.              */
+    alignas(16) uint8_t block[32] = {};
+    for (int i = 0; i < 16; i++)
+        block[i] = ram[(addr + i) & (SPU_RAM_SIZE - 1)];
+
+    int shift = block[0] & 0xf;
+    int filter = std::min((block[0] >> 4) & 0x7, 4);
+    uint8_t flags = block[1];
+
+    /* Shifts 13 to 15 behave like 9. */
+    if (shift > 12)
+        shift = 9;
+
+    if (flags & 0x4)
+        voices.repeat_addr[voice] = addr;
+
+    int32_t samples[32];
+#ifdef PSEMU_X86
+    if (use_simd && simd::has_sse41())
+        unpack_block_sse41(block + 2, shift, samples);
+    else
+#endif
+        unpack_block_scalar(block + 2, shift, samples);
+
+    int32_t* out = voices.decoded[voice];
+    out[0] = out[SPU_BLOCK_SAMPLES];
+
+    /* The 2 tap filter feeds back into itself, so this part stays serial. */
+    int32_t s1 = voices.history[voice][0];
+    int32_t s2 = voices.history[voice][1];
+    for (uint32_t i = 0; i < SPU_BLOCK_SAMPLES; i++) {
+        int32_t s = samples[i] + ((s1 * filter_pos[filter] + s2 * filter_neg[filter] + 32) >> 6);
+        s = std::clamp(s, -0x8000, 0x7fff);
+
+        out[1 + i] = s;
+        s2 = s1;
+        s1 = s;
+    }
+
+    voices.history[voice][0] = s1;
+    voices.history[voice][1] = s2;
+    voices.block_addr[voice] = addr;
+}
+
+void SPU::next_block(uint32_t voice) {
+    uint32_t addr = voices.block_addr[voice];
+    uint8_t flags = ram[(addr + 1) & (SPU_RAM_SIZE - 1)];
+
+    uint32_t next = addr + 16;
+    if (flags & 0x1) {
+        endx |= 1 << voice;
+        next = voices.repeat_addr[voice];
+
+        /* Loop end without repeat silences the voice. */
+        if (!(flags & 0x2)) {
+            voices.phase[voice] = ADSRPhase::Release;
+            voices.envelope[voice] = 0;
+        }
+    }
+
+    voices.counter[voice] -= SPU_BLOCK_SAMPLES << 12;
+    decode_block(voice, next);
+}
+
+void SPU::envelope_tick(uint32_t voice) {
+    ADSRPhase phase = voices.phase[voice];
+    if (phase == ADSRPhase::Off)
+        return;
+
+    if (voices.adsr_wait[voice] > 0) {
+        voices.adsr_wait[voice]--;
+        return;
+    }
+
+    uint16_t low = voices.adsr_low[voice];
+    uint16_t high = voices.adsr_high[voice];
+
+    bool exponential = false;
+    bool decrease = false;
+    int32_t shift = 0;
+    int32_t step = 0;
+
+    switch (phase) {
+        case ADSRPhase::Attack:
+            exponential = low >> 15;
+            shift = (low >> 10) & 0x1f;
+            step = 7 - ((low >> 8) & 0x3);
+            break;
+        case ADSRPhase::Decay:
+            exponential = true;
+            decrease = true;
+            shift = (low >> 4) & 0xf;
+            step = -8;
+            break;
+        case ADSRPhase::Sustain:
+            exponential = high >> 15;
+            decrease = (high >> 14) & 0x1;
+            shift = (high >> 8) & 0x1f;
+            step = decrease ? -8 + ((high >> 6) & 0x3) : 7 - ((high >> 6) & 0x3);
+            break;
+        case ADSRPhase::Release:
+            exponential = (high >> 5) & 0x1;
+            decrease = true;
+            shift = high & 0x1f;
+            step = -8;
+            break;
+        default:
+            break;
+    }
+
+    int32_t level = voices.envelope[voice];
+    int32_t wait = 1 << std::max(0, shift - 11);
+    step <<= std::max(0, 11 - shift);
+
+    if (exponential && !decrease && level > 0x6000)
+        wait *= 4;
+    if (exponential && decrease)
+        step = (step * level) >> 15;
+
+    level = std::clamp(level + step, 0, 0x7fff);
+    voices.envelope[voice] = level;
+    voices.adsr_wait[voice] = wait - 1;
+
+    int32_t sustain = std::min(((low & 0xf) + 1) * 0x800, 0x7fff);
+    switch (phase) {
+        case ADSRPhase::Attack:
+            if (level >= 0x7fff)
+                voices.phase[voice] = ADSRPhase::Decay;
+            break;
+        case ADSRPhase::Decay:
+            if (level <= sustain)
+                voices.phase[voice] = ADSRPhase::Sustain;
+            break;
+        case ADSRPhase::Release:
+            if (level == 0) {
+                voices.phase[voice] = ADSRPhase::Off;
+                voices.step[voice] = 0;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void SPU::noise_tick() {
+    int32_t step = control.noise_step + 4;
+    int32_t shift = control.noise_shift;
+
+    noise_timer -= step;
+    if (noise_timer >= 0)
+        return;
+
+    int32_t parity = ((noise_level >> 15) ^ (noise_level >> 12) ^ (noise_level >> 11) ^ (noise_level >> 10) ^ 1) & 1;
+    noise_level = ((noise_level << 1) | parity) & 0xffff;
+
+    noise_timer += 0x20000 >> shift;
+    if (noise_timer < 0)
+        noise_timer += 0x20000 >> shift;
+}
+
+/* Reference mixer, also the only one that handles pitch modulation: */
+/* each modulated voice needs the output of the one before it.       */
+void SPU::mix_scalar(int32_t out[2], int32_t reverb_in[2]) {
+    int32_t noise = (int16_t)noise_level;
+
+    for (uint32_t v = 0; v < SPU_VOICES; v++) {
+        int32_t step = voices.step[v];
+        if ((pitch_mod >> v) & 1 && step != 0) {
+            step = (int32_t)(((int64_t)voices.pitch[v] * (voices.output[v - 1] + 0x8000)) >> 15);
+            step = std::clamp(step, 0, 0x4000);
+        }
+
+        int32_t counter = voices.counter[v];
+        int32_t index = counter >> 12;
+        int32_t frac = counter & 0xfff;
+
+        int32_t s0 = voices.decoded[v][index];
+        int32_t s1 = voices.decoded[v][index + 1];
+        int32_t sample = s0 + (((s1 - s0) * frac) >> 12);
+
+        if (voices.noise[v])
+            sample = noise;
+
+        sample = (sample * voices.envelope[v]) >> 15;
+        voices.output[v] = sample;
+
+        int32_t left = (sample * voices.volume_left[v]) >> 15;
+        int32_t right = (sample * voices.volume_right[v]) >> 15;
+        out[0] += left;
+        out[1] += right;
+
+        if (voices.reverb[v]) {
+            reverb_in[0] += left;
+            reverb_in[1] += right;
+        }
+
+        voices.counter[v] = counter + step;
+    }
+}
+
+#ifdef PSEMU_X86
+PSEMU_TARGET("avx2")
+void SPU::mix_avx2(int32_t out[2], int32_t reverb_in[2]) {
+    const __m256i frac_mask = _mm256_set1_epi32(0xfff);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i noise = _mm256_set1_epi32((int16_t)noise_level);
+    const __m256i rows = _mm256_setr_epi32(0, 32, 64, 96, 128, 160, 192, 224);
+    const int32_t* decoded = &voices.decoded[0][0];
+
+    __m256i sum_left = _mm256_setzero_si256();
+    __m256i sum_right = _mm256_setzero_si256();
+    __m256i reverb_left = _mm256_setzero_si256();
+    __m256i reverb_right = _mm256_setzero_si256();
+
+    for (uint32_t v = 0; v < SPU_VOICES; v += 8) {
+        __m256i counter = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.counter + v));
+        __m256i step = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.step + v));
+        __m256i envelope = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.envelope + v));
+        __m256i volume_left = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.volume_left + v));
+        __m256i volume_right = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.volume_right + v));
+        __m256i noise_mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.noise + v));
+        __m256i reverb_mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(voices.reverb + v));
+
+        /* Lane i reads decoded[v + i][index] and the sample after it. */
+        __m256i index = _mm256_add_epi32(_mm256_add_epi32(rows, _mm256_set1_epi32(v * 32)), _mm256_srli_epi32(counter, 12));
+        __m256i s0 = _mm256_i32gather_epi32(decoded, index, 4);
+        __m256i s1 = _mm256_i32gather_epi32(decoded, _mm256_add_epi32(index, one), 4);
+
+        __m256i frac = _mm256_and_si256(counter, frac_mask);
+        __m256i sample = _mm256_add_epi32(s0, _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(s1, s0), frac), 12));
+        sample = _mm256_blendv_epi8(sample, noise, noise_mask);
+
+        sample = _mm256_srai_epi32(_mm256_mullo_epi32(sample, envelope), 15);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(voices.output + v), sample);
+
+        __m256i left = _mm256_srai_epi32(_mm256_mullo_epi32(sample, volume_left), 15);
+        __m256i right = _mm256_srai_epi32(_mm256_mullo_epi32(sample, volume_right), 15);
+        sum_left = _mm256_add_epi32(sum_left, left);
+        sum_right = _mm256_add_epi32(sum_right, right);
+        reverb_left = _mm256_add_epi32(reverb_left, _mm256_and_si256(left, reverb_mask));
+        reverb_right = _mm256_add_epi32(reverb_right, _mm256_and_si256(right, reverb_mask));
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(voices.counter + v), _mm256_add_epi32(counter, step));
+    }
+
+    alignas(32) int32_t lanes[4][8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[0]), sum_left);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[1]), sum_right);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[2]), reverb_left);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[3]), reverb_right);
+    for (int i = 0; i < 8; i++) {
+        out[0] += lanes[0][i];
+        out[1] += lanes[1][i];
+        reverb_in[0] += lanes[2][i];
+        reverb_in[1] += lanes[3][i];
+    }
+}
+#else
+void SPU::mix_avx2(int32_t out[2], int32_t reverb_in[2]) {
+    mix_scalar(out, reverb_in);
+}
+#endif
+
+void SPU::generate_sample(const int16_t* cd_frame) {
+    int32_t mix[2] = {};
+    int32_t reverb_in[2] = {};
+
+    if (control.enable) {
+        if (use_simd && pitch_mod == 0 && simd::has_avx2())
+            mix_avx2(mix, reverb_in);
+        else
+            mix_scalar(mix, reverb_in);
+
+        for (uint32_t v = 0; v < SPU_VOICES; v++) {
+            if ((voices.counter[v] >> 12) >= (int32_t)SPU_BLOCK_SAMPLES)
+                next_block(v);
+            envelope_tick(v);
+        }
+        noise_tick();
+    }
+
+    if (control.cd_audio && cd_frame != nullptr) {
+        for (int ch = 0; ch < 2; ch++) {
+            int32_t cd = (cd_frame[ch] * cd_volume[ch]) >> 15;
+            mix[ch] += cd;
+            if (control.cd_reverb)
+                reverb_in[ch] += cd;
+        }
+    }
+
+    /* Reverb runs at 22.05 kHz, every pair of samples is one input frame. */
+    uint32_t frame = reverb_pos >> 1;
+    for (int ch = 0; ch < 2; ch++) {
+        int32_t input = std::clamp(reverb_in[ch], -0x8000, 0x7fff);
+        if (reverb_pos & 1)
+            reverb_input[ch][frame] = (int16_t)((reverb_even[ch] + input) >> 1);
+        else
+            reverb_even[ch] = input;
+
+        mix[ch] += reverb_output[ch][frame];
+    }
+
+    if (++reverb_pos == REVERB_BLOCK * 2) {
+        reverb_pos = 0;
+        reverb.process_block(reverb_input, reverb_output);
+    }
+
+    int32_t left = std::clamp(mix[0], -0x8000, 0x7fff);
+    int32_t right = std::clamp(mix[1], -0x8000, 0x7fff);
+    left = (left * main_volume[0]) >> 15;
+    right = (right * main_volume[1]) >> 15;
+
+    if (!control.unmute)
+        left = right = 0;
+
+    samples.push_back((int16_t)left);
+    samples.push_back((int16_t)right);
+}
+
+bool SPU::tick(uint32_t elapsed, std::vector<int16_t>& cd_audio, uint32_t cd_rate) {
+    cycles += elapsed;
+
+    /* CD audio is stepped through at its own rate, nearest frame. */
+    uint32_t cd_step = (uint32_t)(((uint64_t)cd_rate << 16) / SPU_SAMPLE_RATE);
+    size_t cd_read = 0;
+
+    while (cycles >= SPU_CYCLES_PER_SAMPLE) {
+        cycles -= SPU_CYCLES_PER_SAMPLE;
+
+        const int16_t* frame = cd_read + 2 <= cd_audio.size() ? &cd_audio[cd_read] : nullptr;
+        generate_sample(frame);
+
+        cd_phase += cd_step;
+        while (cd_phase >= 0x10000) {
+            cd_phase -= 0x10000;
+            if (cd_read + 2 <= cd_audio.size())
+                cd_read += 2;
+        }
+    }
+
+    if (cd_read > 0)
+        cd_audio.erase(cd_audio.begin(), cd_audio.begin() + cd_read);
+
+    if (samples.size() > SAMPLE_BUFFER_LIMIT)
+        samples.erase(samples.begin(), samples.end() - SAMPLE_BUFFER_LIMIT);
+
+    bool raised = irq_raised;
+    irq_raised = false;
+    return raised;
+}
@@ -0,0 +1,159 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "Reverb.h"
+
+const uint32_t SPU_RAM_SIZE = 512 * 1024;
+const uint32_t SPU_VOICES = 24;
+const uint32_t SPU_SAMPLE_RATE = 44100;
+
+/* 33.8688 MHz / 44100 Hz. */
+const uint32_t SPU_CYCLES_PER_SAMPLE = 768;
+
+/* Samples in one 16 byte SPU-ADPCM block. */
+const uint32_t SPU_BLOCK_SAMPLES = 28;
+
+union SPUControl {
+    uint16_t raw;
+
+    struct {
+        uint16_t cd_audio : 1;
+        uint16_t ext_audio : 1;
+        uint16_t cd_reverb : 1;
+        uint16_t ext_reverb : 1;
+        uint16_t transfer_mode : 2; /* 0 = Stop, 1 = Manual, 2 = DMA write, 3 = DMA read. */
+        uint16_t irq_enable : 1;
+        uint16_t reverb_enable : 1;
+        uint16_t noise_step : 2;
+        uint16_t noise_shift : 4;
+        uint16_t unmute : 1;
+        uint16_t enable : 1;
+    };
+};
+
+enum class ADSRPhase : uint8_t {
+    Off,
+    Attack,
+    Decay,
+    Sustain,
+    Release
+};
+
+/*
+ * Voice state laid out structure of arrays, one lane per voice, so the
+ * mixer handles 8 voices per AVX2 register. Everything the mixer touches
+ * for every output sample lives in the aligned 32 bit arrays.
+ */
+struct SPUVoices {
+    alignas(32) int32_t counter[SPU_VOICES] = {}; /* 20.12 position in the decoded block. */
+    alignas(32) int32_t step[SPU_VOICES] = {}; /* Pitch, 0 while the voice is off. */
+    alignas(32) int32_t envelope[SPU_VOICES] = {}; /* ADSR level, 0 to 0x7fff. */
+    alignas(32) int32_t volume_left[SPU_VOICES] = {};
+    alignas(32) int32_t volume_right[SPU_VOICES] = {};
+    alignas(32) int32_t noise[SPU_VOICES] = {}; /* -1 when the voice plays the noise generator. */
+    alignas(32) int32_t reverb[SPU_VOICES] = {}; /* -1 when the voice feeds the reverb. */
+    alignas(32) int32_t output[SPU_VOICES] = {}; /* Last sample after the envelope. */
+
+    /* [0] is the last sample of the previous block, [1..28] the current one. */
+    alignas(32) int32_t decoded[SPU_VOICES][32] = {};
+
+    uint16_t pitch[SPU_VOICES] = {}; /* Raw register, step is clamped. */
+    uint32_t start_addr[SPU_VOICES] = {};
+    uint32_t repeat_addr[SPU_VOICES] = {};
+    uint32_t block_addr[SPU_VOICES] = {};
+    int32_t history[SPU_VOICES][2] = {}; /* ADPCM filter state. */
+
+    uint16_t adsr_low[SPU_VOICES] = {};
+    uint16_t adsr_high[SPU_VOICES] = {};
+    ADSRPhase phase[SPU_VOICES] = {};
+    int32_t adsr_wait[SPU_VOICES] = {};
+};
+
+/*
+ * Sound processing unit: 512 KiB of sound RAM, 24 SPU-ADPCM voices with
+ * ADSR envelopes, reverb and the CD audio input, mixed to 44.1 kHz stereo.
+ * Registers are 16 bit, offsets are relative to 0x1f801c00.
+ */
+class SPU {
+public:
+    SPU();
+
+    uint16_t read(uint32_t offset);
+    void write(uint32_t offset, uint16_t value);
+
+    /* DMA channel 4. */
+    uint32_t dma_read();
+    void dma_write(uint32_t word);
+
+    /* Runs the mixer for the elapsed CPU cycles, taking CD audio (stereo */
+    /* interleaved at cd_rate) from the front of cd_audio. Returns true  */
+    /* when the SPU interrupt was raised.                                 */
+    bool tick(uint32_t cycles, std::vector<int16_t>& cd_audio, uint32_t cd_rate);
+
+    /* Mixed output, stereo interleaved at SPU_SAMPLE_RATE. The consumer */
+    /* removes what it used from the front.                               */
+    std::vector<int16_t> samples;
+
+    std::vector<uint8_t> ram;
+
+    /* Clearing this forces the scalar reference path. */
+    bool use_simd = true;
+
+private:
+    void key_on(uint32_t voice);
+    void key_off(uint32_t voice);
+
+    void decode_block(uint32_t voice, uint32_t addr);
+    void next_block(uint32_t voice);
+    void envelope_tick(uint32_t voice);
+    void noise_tick();
+
+    /* Both mixers also sum the reverb input of the voices with EON set. */
+    void mix_scalar(int32_t out[2], int32_t reverb_in[2]);
+    void mix_avx2(int32_t out[2], int32_t reverb_in[2]);
+    void generate_sample(const int16_t* cd_frame);
+
+    void check_irq(uint32_t addr, uint32_t size);
+
+    /* Mirror of everything written, for registers that just read back. */
+    uint16_t regs[0x140] = {};
+
+    SPUVoices voices;
+    SPUControl control;
+    Reverb reverb;
+
+    /* The reverb works a block behind the voices: while one block of */
+    /* input is collected the previous block's output is played.      */
+    int16_t reverb_input[2][REVERB_BLOCK] = {};
+    int16_t reverb_output[2][REVERB_BLOCK] = {};
+    int32_t reverb_even[2] = {};
+    uint32_t reverb_pos = 0; /* In 44.1 kHz samples. */
+
+    int32_t main_volume[2] = {};
+    int32_t cd_volume[2] = {};
+
+    uint32_t endx = 0;
+    uint32_t pitch_mod = 0;
+    uint32_t noise_on = 0;
+    uint32_t reverb_on = 0;
+
+    uint32_t transfer_addr = 0;
+    uint32_t irq_addr = 0;
+    bool irq_flag = false;
+    bool irq_raised = false;
+
+    int32_t noise_level = 1;
+    int32_t noise_timer = 0;
+
+    uint32_t cycles = 0;
+    uint32_t cd_phase = 0; /* 16.16 position between two CD frames. */
+};
@@ -0,0 +1,241 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "SectorVerify.h"
+
+struct EDCTables {
+    uint32_t table[8][256];
+
+    constexpr EDCTables() : table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ ((crc & 1) ? 0xd8018001 : 0);
+            table[0][i] = crc;
+        }
+
+        /* table[k] advances a byte that is followed by k more bytes. */
+        for (int k = 1; k < 8; k++) {
+            for (uint32_t i = 0; i < 256; i++)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+        }
+    }
+};
+static constexpr EDCTables edc;
+
+/* GF(2^8) multiply by 2 (f) and its helper inverse (b) for the P/Q parity. */
+struct ECCTables {
+    uint8_t f[256];
+    uint8_t b[256];
+
+    constexpr ECCTables() : f(), b() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t j = (i << 1) ^ ((i & 0x80) ? 0x11d : 0);
+            f[i] = (uint8_t)j;
+            b[i ^ j] = (uint8_t)i;
+        }
+    }
+};
+static constexpr ECCTables ecc;
+
+uint32_t edc_crc(const uint8_t* data, size_t size, uint32_t crc) {
+    while (size >= 8) {
+        uint32_t one, two;
+        std::memcpy(&one, data, 4);
+        std::memcpy(&two, data + 4, 4);
+        one ^= crc;
+
+        crc = edc.table[7][one & 0xff] ^ edc.table[6][(one >> 8) & 0xff] ^
+              edc.table[5][(one >> 16) & 0xff] ^ edc.table[4][one >> 24] ^
+              edc.table[3][two & 0xff] ^ edc.table[2][(two >> 8) & 0xff] ^
+              edc.table[1][(two >> 16) & 0xff] ^ edc.table[0][two >> 24];
+
+        data += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0)
+        crc = (crc >> 8) ^ edc.table[0][(crc ^ *data++) & 0xff];
+
+    return crc;
+}
+
+/* Computes one set of parity bytes over the sector seen as a matrix. */
+static void ecc_block(const uint8_t* src, uint32_t major_count, uint32_t minor_count,
+                      uint32_t major_mult, uint32_t minor_inc, uint8_t* dest) {
+    uint32_t size = major_count * minor_count;
+
+    for (uint32_t major = 0; major < major_count; major++) {
+        uint32_t index = (major >> 1) * major_mult + (major & 1);
+        uint8_t a = 0, b = 0;
+
+        for (uint32_t minor = 0; minor < minor_count; minor++) {
+            uint8_t temp = src[index];
+            index += minor_inc;
+            if (index >= size)
+                index -= size;
+
+            a ^= temp;
+            b ^= temp;
+            a = ecc.f[a];
+        }
+
+        a = ecc.b[ecc.f[a] ^ b];
+        dest[major] = a;
+        dest[major + major_count] = a ^ b;
+    }
+}
+
+bool ecc_check(const uint8_t* sector) {
+    uint8_t copy[SECTOR_SIZE];
+    std::memcpy(copy, sector, SECTOR_SIZE);
+
+    /* Mode 2 computes the parity with a zeroed header. */
+    if (copy[15] == 2)
+        std::memset(copy + 12, 0, 4);
+
+    uint8_t p[172];
+    uint8_t q[104];
+    ecc_block(copy + 0xc, 86, 24, 2, 86, p);
+    if (std::memcmp(p, copy + 0x81c, sizeof(p)) != 0)
+        return false;
+
+    ecc_block(copy + 0xc, 52, 43, 86, 88, q);
+    return std::memcmp(q, copy + 0x8c8, sizeof(q)) == 0;
+}
+
+static const uint8_t sync_pattern[12] = {
+    0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00
+};
+
+static uint32_t stored_edc(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+SectorCheck verify_sector(const uint8_t* sector, TrackType type) {
+    if (type == TrackType::Audio)
+        return SectorCheck::Unchecked;
+
+    if (std::memcmp(sector, sync_pattern, sizeof(sync_pattern)) != 0)
+        return SectorCheck::BadSync;
+
+    bool edc_ok;
+    bool has_ecc = true;
+
+    switch (sector[15]) {
+        case 1:
+            edc_ok = edc_crc(sector, 0x810) == stored_edc(sector + 0x810);
+            break;
+        case 2: {
+            /* Submode bit 5 selects form 2: more data, no ECC, optional EDC. */
+            bool form2 = sector[18] & 0x20;
+            if (form2) {
+                uint32_t stored = stored_edc(sector + 0x92c);
+                if (stored == 0)
+                    return SectorCheck::Unchecked;
+
+                edc_ok = edc_crc(sector + 0x10, 0x91c) == stored;
+                has_ecc = false;
+            }
+            else {
+                edc_ok = edc_crc(sector + 0x10, 0x808) == stored_edc(sector + 0x818);
+            }
+            break;
+        }
+        default:
+            return SectorCheck::Unchecked;
+    }
+
+    if (edc_ok)
+        return SectorCheck::Good;
+
+    /* Only now pay for the parity, to tell a bad EDC field from bad data. */
+    if (has_ecc && ecc_check(sector))
+        return SectorCheck::BadEDC;
+
+    return SectorCheck::Corrupt;
+}
+
+static TrackType track_type(const std::vector<Track>& tracks, uint32_t lba) {
+    TrackType type = TrackType::Mode2;
+    for (const Track& track : tracks) {
+        if (lba >= track.start)
+            type = track.type;
+    }
+
+    return type;
+}
+
+bool verify_image(const std::string& path, unsigned threads, VerifyReport& report) {
+    std::unique_ptr<DiscImage> first = DiscImage::open(path);
+    if (!first)
+        return false;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    const uint32_t CHUNK = 1024;
+    uint32_t sectors = first->sector_count();
+    std::vector<Track> tracks = first->get_tracks();
+
+    std::atomic<uint32_t> next_chunk = 0;
+    std::mutex merge;
+    report = VerifyReport();
+    report.sectors = sectors;
+
+    auto begin = std::chrono::steady_clock::now();
+
+    auto worker = [&](std::unique_ptr<DiscImage> image) {
+        VerifyReport local;
+
+        while (true) {
+            uint32_t start = next_chunk.fetch_add(1) * CHUNK;
+            if (start >= sectors)
+                break;
+
+            uint32_t end = std::min(sectors, start + CHUNK);
+            for (uint32_t lba = start; lba < end; lba++) {
+                SectorCheck check = verify_sector(image->read_sector(lba), track_type(tracks, lba));
+                local.counts[(uint32_t)check]++;
+
+                if (check != SectorCheck::Good && check != SectorCheck::Unchecked)
+                    local.bad_lbas.push_back(lba);
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(merge);
+        for (int i = 0; i < 5; i++)
+            report.counts[i] += local.counts[i];
+        report.bad_lbas.insert(report.bad_lbas.end(), local.bad_lbas.begin(), local.bad_lbas.end());
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) {
+        std::unique_ptr<DiscImage> image = DiscImage::open(path);
+        if (image)
+            pool.emplace_back(worker, std::move(image));
+    }
+    worker(std::move(first));
+
+    for (std::thread& thread : pool)
+        thread.join();
+
+    std::sort(report.bad_lbas.begin(), report.bad_lbas.end());
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double bytes = (double)sectors * SECTOR_SIZE;
+    report.gigabytes_per_second = report.seconds > 0 ? bytes / report.seconds / 1e9 : 0;
+    return true;
+}
@@ -0,0 +1,43 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "DiscImage.h"
+
+enum class SectorCheck : uint32_t {
+    Good,
+    Unchecked, /* Audio, or a form 2 sector without EDC. */
+    BadEDC, /* EDC mismatch but P/Q parity agrees with the data: only the EDC field is damaged. */
+    Corrupt, /* EDC and ECC both disagree with the data. */
+    BadSync
+};
+
+/* CD EDC: reflected CRC32 with polynomial 0xD8018001, slicing-by-8. */
+uint32_t edc_crc(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+/* True when the stored P and Q parity matches the sector. */
+bool ecc_check(const uint8_t* sector);
+
+/* Checks one raw 2352 byte sector. ECC is only computed when the EDC fails. */
+SectorCheck verify_sector(const uint8_t* sector, TrackType type);
+
+struct VerifyReport {
+    uint64_t sectors = 0;
+    uint64_t counts[5] = {}; /* Indexed by SectorCheck. */
+    std::vector<uint32_t> bad_lbas; /* BadEDC, Corrupt and BadSync sectors. */
+    double seconds = 0;
+    double gigabytes_per_second = 0;
+};
+
+/* Scans a whole image, split across threads (0 = one per core). Every */
+/* thread opens its own view of the image.                             */
+bool verify_image(const std::string& path, unsigned threads, VerifyReport& report);
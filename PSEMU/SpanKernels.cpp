@@ -0,0 +1,679 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "SpanKernels.h"
+#include "Rasterizer.h"
+#include "SIMD.h"
+
+static uint16_t to_5bit(int32_t r, int32_t g, int32_t b) {
+    r = std::clamp(r, 0, 255) >> 3;
+    g = std::clamp(g, 0, 255) >> 3;
+    b = std::clamp(b, 0, 255) >> 3;
+    return (uint16_t)(r | (g << 5) | (b << 10));
+}
+
+static int32_t blend_channel(int32_t b, int32_t f, uint32_t mode) {
+    switch (mode) {
+    case 0: return (b + f) >> 1;
+    case 1: return std::min(b + f, 31);
+    case 2: return std::max(b - f, 0);
+    default: return std::min(b + (f >> 2), 31);
+    }
+}
+
+/* The setup n pixels further along the span. */
+static SpanSetup advanced(const SpanSetup& s, uint32_t n) {
+    SpanSetup a = s;
+    a.r = (int32_t)((uint32_t)s.r + (uint32_t)s.dr * n);
+    a.g = (int32_t)((uint32_t)s.g + (uint32_t)s.dg * n);
+    a.b = (int32_t)((uint32_t)s.b + (uint32_t)s.db * n);
+    a.u = (int32_t)((uint32_t)s.u + (uint32_t)s.du * n);
+    a.v = (int32_t)((uint32_t)s.v + (uint32_t)s.dv * n);
+    return a;
+}
+
+/* Scalar kernels, the reference for the vector ones. */
+
+static void shade_scalar(const SpanSetup& s, uint32_t count, const int8_t* dither, uint32_t x0, uint16_t* out) {
+    for (uint32_t i = 0; i < count; i++) {
+        SpanSetup p = advanced(s, i);
+        int32_t d = dither ? dither[(x0 + i) & 3] : 0;
+        out[i] = to_5bit((p.r >> 16) + d, (p.g >> 16) + d, (p.b >> 16) + d);
+    }
+}
+
+static uint16_t fetch_texel(const uint16_t* vram, int32_t u, int32_t v, const RasterPrim& prim, const DrawEnv& env) {
+    u &= 0xff;
+    v &= 0xff;
+    u = (u & ~env.window_mask_u) | (env.window_offset_u & env.window_mask_u);
+    v = (v & ~env.window_mask_v) | (env.window_offset_v & env.window_mask_v);
+
+    if (prim.texels)
+        return prim.texels[v * 256 + u];
+
+    auto pixel = [vram](uint32_t x, uint32_t y) {
+        return vram[(y & (VRAM::HEIGHT - 1)) * VRAM::WIDTH + (x & (VRAM::WIDTH - 1))];
+    };
+
+    uint32_t y = prim.page_y + v;
+
+    switch (prim.depth) {
+    case 0: {
+        uint16_t packed = pixel(prim.page_x + (u >> 2), y);
+        uint32_t index = (packed >> ((u & 3) * 4)) & 0xf;
+        return pixel(prim.clut_x + index, prim.clut_y);
+    }
+    case 1: {
+        uint16_t packed = pixel(prim.page_x + (u >> 1), y);
+        uint32_t index = (packed >> ((u & 1) * 8)) & 0xff;
+        return pixel(prim.clut_x + index, prim.clut_y);
+    }
+    default:
+        return pixel(prim.page_x + u, y);
+    }
+}
+
+static void fetch_scalar(const uint16_t* vram, const SpanSetup& s, uint32_t count,
+                         const RasterPrim& prim, const DrawEnv& env, uint16_t* out) {
+    for (uint32_t i = 0; i < count; i++) {
+        SpanSetup p = advanced(s, i);
+        out[i] = fetch_texel(vram, p.u >> 16, p.v >> 16, prim, env);
+    }
+}
+
+static void modulate_scalar(const uint16_t* texels, const SpanSetup& s, uint32_t count,
+                            const int8_t* dither, uint32_t x0, uint16_t* out) {
+    for (uint32_t i = 0; i < count; i++) {
+        SpanSetup p = advanced(s, i);
+        uint16_t t = texels[i];
+
+        /* Kept at 8 bits for the dither. */
+        int32_t r = ((t & 31) * (p.r >> 16)) >> 4;
+        int32_t g = (((t >> 5) & 31) * (p.g >> 16)) >> 4;
+        int32_t b = (((t >> 10) & 31) * (p.b >> 16)) >> 4;
+
+        int32_t d = dither ? dither[(x0 + i) & 3] : 0;
+        out[i] = to_5bit(r + d, g + d, b + d);
+    }
+}
+
+static void blend_scalar(const uint16_t* back, const uint16_t* front, uint32_t count, uint32_t mode, uint16_t* out) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t result = 0;
+        for (uint32_t shift = 0; shift < 15; shift += 5) {
+            int32_t c = blend_channel((back[i] >> shift) & 31, (front[i] >> shift) & 31, mode);
+            result |= (uint16_t)(c << shift);
+        }
+        out[i] = result;
+    }
+}
+
+static void store_scalar(uint16_t* dst, const uint16_t* color, const uint16_t* blended,
+                         const uint16_t* texels, uint32_t count, StoreFlags flags) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (flags.check_mask && (dst[i] & 0x8000))
+            continue;
+
+        uint16_t value = color[i];
+        uint16_t mask = flags.set_mask ? 0x8000 : 0;
+
+        if (texels) {
+            uint16_t t = texels[i];
+            if (t == 0)
+                continue;
+
+            mask |= t & 0x8000;
+            if (blended && (t & 0x8000))
+                value = blended[i];
+        } else if (blended) {
+            value = blended[i];
+        }
+
+        dst[i] = (value & 0x7fff) | mask;
+    }
+}
+
+static const SpanKernels SCALAR_KERNELS = {
+    shade_scalar, fetch_scalar, modulate_scalar, blend_scalar, store_scalar
+};
+
+#ifdef PSEMU_X86
+
+/* SSE4.1, 4 pixels per iteration for the 32 bit kernels, 8 for the 16 bit ones. */
+
+PSEMU_TARGET("sse4.1")
+static __m128i ramp_sse41(int32_t start, int32_t step) {
+    __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    return _mm_add_epi32(_mm_set1_epi32(start), _mm_mullo_epi32(lanes, _mm_set1_epi32(step)));
+}
+
+PSEMU_TARGET("sse4.1")
+static __m128i dither_sse41(const int8_t* dither, uint32_t x0) {
+    if (!dither)
+        return _mm_setzero_si128();
+
+    return _mm_setr_epi32(dither[x0 & 3], dither[(x0 + 1) & 3], dither[(x0 + 2) & 3], dither[(x0 + 3) & 3]);
+}
+
+/* clamp(value + dither, 0, 255) >> 3 */
+PSEMU_TARGET("sse4.1")
+static __m128i cut_sse41(__m128i value, __m128i dither) {
+    value = _mm_add_epi32(value, dither);
+    value = _mm_min_epi32(_mm_max_epi32(value, _mm_setzero_si128()), _mm_set1_epi32(255));
+    return _mm_srli_epi32(value, 3);
+}
+
+PSEMU_TARGET("sse4.1")
+static __m128i pack_rgb_sse41(__m128i r, __m128i g, __m128i b) {
+    __m128i c = _mm_or_si128(r, _mm_or_si128(_mm_slli_epi32(g, 5), _mm_slli_epi32(b, 10)));
+    return _mm_packus_epi32(c, c);
+}
+
+PSEMU_TARGET("sse4.1")
+static void shade_sse41(const SpanSetup& s, uint32_t count, const int8_t* dither, uint32_t x0, uint16_t* out) {
+    __m128i r = ramp_sse41(s.r, s.dr);
+    __m128i g = ramp_sse41(s.g, s.dg);
+    __m128i b = ramp_sse41(s.b, s.db);
+    __m128i step_r = _mm_set1_epi32((int32_t)((uint32_t)s.dr * 4));
+    __m128i step_g = _mm_set1_epi32((int32_t)((uint32_t)s.dg * 4));
+    __m128i step_b = _mm_set1_epi32((int32_t)((uint32_t)s.db * 4));
+
+    /* The dither pattern repeats every 4 pixels, same for every iteration. */
+    __m128i d = dither_sse41(dither, x0);
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i cr = cut_sse41(_mm_srai_epi32(r, 16), d);
+        __m128i cg = cut_sse41(_mm_srai_epi32(g, 16), d);
+        __m128i cb = cut_sse41(_mm_srai_epi32(b, 16), d);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), pack_rgb_sse41(cr, cg, cb));
+
+        r = _mm_add_epi32(r, step_r);
+        g = _mm_add_epi32(g, step_g);
+        b = _mm_add_epi32(b, step_b);
+    }
+
+    shade_scalar(advanced(s, i), count - i, dither, x0 + i, out + i);
+}
+
+PSEMU_TARGET("sse4.1")
+static void modulate_sse41(const uint16_t* texels, const SpanSetup& s, uint32_t count,
+                           const int8_t* dither, uint32_t x0, uint16_t* out) {
+    __m128i r = ramp_sse41(s.r, s.dr);
+    __m128i g = ramp_sse41(s.g, s.dg);
+    __m128i b = ramp_sse41(s.b, s.db);
+    __m128i step_r = _mm_set1_epi32((int32_t)((uint32_t)s.dr * 4));
+    __m128i step_g = _mm_set1_epi32((int32_t)((uint32_t)s.dg * 4));
+    __m128i step_b = _mm_set1_epi32((int32_t)((uint32_t)s.db * 4));
+    __m128i d = dither_sse41(dither, x0);
+    __m128i five = _mm_set1_epi32(31);
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i t = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(texels + i)));
+        __m128i tr = _mm_and_si128(t, five);
+        __m128i tg = _mm_and_si128(_mm_srli_epi32(t, 5), five);
+        __m128i tb = _mm_and_si128(_mm_srli_epi32(t, 10), five);
+
+        __m128i cr = cut_sse41(_mm_srai_epi32(_mm_mullo_epi32(tr, _mm_srai_epi32(r, 16)), 4), d);
+        __m128i cg = cut_sse41(_mm_srai_epi32(_mm_mullo_epi32(tg, _mm_srai_epi32(g, 16)), 4), d);
+        __m128i cb = cut_sse41(_mm_srai_epi32(_mm_mullo_epi32(tb, _mm_srai_epi32(b, 16)), 4), d);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), pack_rgb_sse41(cr, cg, cb));
+
+        r = _mm_add_epi32(r, step_r);
+        g = _mm_add_epi32(g, step_g);
+        b = _mm_add_epi32(b, step_b);
+    }
+
+    modulate_scalar(texels + i, advanced(s, i), count - i, dither, x0 + i, out + i);
+}
+
+PSEMU_TARGET("sse4.1")
+static __m128i blend_channel_sse41(__m128i b, __m128i f, uint32_t mode) {
+    __m128i max = _mm_set1_epi16(31);
+
+    switch (mode) {
+    case 0: return _mm_srli_epi16(_mm_add_epi16(b, f), 1);
+    case 1: return _mm_min_epu16(_mm_add_epi16(b, f), max);
+    case 2: return _mm_subs_epu16(b, f);
+    default: return _mm_min_epu16(_mm_add_epi16(b, _mm_srli_epi16(f, 2)), max);
+    }
+}
+
+PSEMU_TARGET("sse4.1")
+static void blend_sse41(const uint16_t* back, const uint16_t* front, uint32_t count, uint32_t mode, uint16_t* out) {
+    __m128i five = _mm_set1_epi16(31);
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i bk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(back + i));
+        __m128i fr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(front + i));
+
+        __m128i r = blend_channel_sse41(_mm_and_si128(bk, five), _mm_and_si128(fr, five), mode);
+        __m128i g = blend_channel_sse41(_mm_and_si128(_mm_srli_epi16(bk, 5), five),
+                                        _mm_and_si128(_mm_srli_epi16(fr, 5), five), mode);
+        __m128i b = blend_channel_sse41(_mm_and_si128(_mm_srli_epi16(bk, 10), five),
+                                        _mm_and_si128(_mm_srli_epi16(fr, 10), five), mode);
+
+        __m128i c = _mm_or_si128(r, _mm_or_si128(_mm_slli_epi16(g, 5), _mm_slli_epi16(b, 10)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), c);
+    }
+
+    blend_scalar(back + i, front + i, count - i, mode, out + i);
+}
+
+PSEMU_TARGET("sse4.1")
+static void store_sse41(uint16_t* dst, const uint16_t* color, const uint16_t* blended,
+                        const uint16_t* texels, uint32_t count, StoreFlags flags) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i top = _mm_set1_epi16((int16_t)0x8000);
+    const __m128i low = _mm_set1_epi16(0x7fff);
+    const __m128i set = flags.set_mask ? top : zero;
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i back = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(color + i));
+        __m128i keep = _mm_cmpeq_epi16(zero, zero);
+        __m128i mask = set;
+        __m128i select = keep;
+
+        if (flags.check_mask)
+            keep = _mm_cmpeq_epi16(_mm_and_si128(back, top), zero);
+
+        if (texels) {
+            __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels + i));
+            __m128i t_top = _mm_and_si128(t, top);
+            keep = _mm_andnot_si128(_mm_cmpeq_epi16(t, zero), keep);
+            mask = _mm_or_si128(mask, t_top);
+            select = _mm_cmpeq_epi16(t_top, top);
+        }
+
+        if (blended) {
+            __m128i bl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blended + i));
+            value = _mm_blendv_epi8(value, bl, select);
+        }
+
+        value = _mm_or_si128(_mm_and_si128(value, low), mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_blendv_epi8(back, value, keep));
+    }
+
+    store_scalar(dst + i, color + i, blended ? blended + i : nullptr, texels ? texels + i : nullptr, count - i, flags);
+}
+
+/* SSE4.1 has no gathers, texel fetches stay scalar. */
+static const SpanKernels SSE41_KERNELS = {
+    shade_sse41, fetch_scalar, modulate_sse41, blend_sse41, store_sse41
+};
+
+/* AVX2, 8 pixels per iteration for the 32 bit kernels, 16 for the 16 bit ones. */
+/* The tails run scalar code, clear the upper halves first so the SSE         */
+/* instructions in it do not pay for the dirty AVX state.                     */
+
+PSEMU_TARGET("avx2")
+static __m256i ramp_avx2(int32_t start, int32_t step) {
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    return _mm256_add_epi32(_mm256_set1_epi32(start), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(step)));
+}
+
+PSEMU_TARGET("avx2")
+static __m256i dither_avx2(const int8_t* dither, uint32_t x0) {
+    if (!dither)
+        return _mm256_setzero_si256();
+
+    int32_t a = dither[x0 & 3], b = dither[(x0 + 1) & 3], c = dither[(x0 + 2) & 3], d = dither[(x0 + 3) & 3];
+    return _mm256_setr_epi32(a, b, c, d, a, b, c, d);
+}
+
+PSEMU_TARGET("avx2")
+static __m256i cut_avx2(__m256i value, __m256i dither) {
+    value = _mm256_add_epi32(value, dither);
+    value = _mm256_min_epi32(_mm256_max_epi32(value, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+    return _mm256_srli_epi32(value, 3);
+}
+
+/* Eight 32 bit lanes that fit in 16 bits, in order. */
+PSEMU_TARGET("avx2")
+static __m128i pack_avx2(__m256i v) {
+    __m256i packed = _mm256_packus_epi32(v, v);
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+PSEMU_TARGET("avx2")
+static __m128i pack_rgb_avx2(__m256i r, __m256i g, __m256i b) {
+    return pack_avx2(_mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi32(g, 5), _mm256_slli_epi32(b, 10))));
+}
+
+PSEMU_TARGET("avx2")
+static void shade_avx2(const SpanSetup& s, uint32_t count, const int8_t* dither, uint32_t x0, uint16_t* out) {
+    __m256i r = ramp_avx2(s.r, s.dr);
+    __m256i g = ramp_avx2(s.g, s.dg);
+    __m256i b = ramp_avx2(s.b, s.db);
+    __m256i step_r = _mm256_set1_epi32((int32_t)((uint32_t)s.dr * 8));
+    __m256i step_g = _mm256_set1_epi32((int32_t)((uint32_t)s.dg * 8));
+    __m256i step_b = _mm256_set1_epi32((int32_t)((uint32_t)s.db * 8));
+    __m256i d = dither_avx2(dither, x0);
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i cr = cut_avx2(_mm256_srai_epi32(r, 16), d);
+        __m256i cg = cut_avx2(_mm256_srai_epi32(g, 16), d);
+        __m256i cb = cut_avx2(_mm256_srai_epi32(b, 16), d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), pack_rgb_avx2(cr, cg, cb));
+
+        r = _mm256_add_epi32(r, step_r);
+        g = _mm256_add_epi32(g, step_g);
+        b = _mm256_add_epi32(b, step_b);
+    }
+
+    _mm256_zeroupper();
+    shade_scalar(advanced(s, i), count - i, dither, x0 + i, out + i);
+}
+
+PSEMU_TARGET("avx2")
+static void fetch_avx2(const uint16_t* vram, const SpanSetup& s, uint32_t count,
+                       const RasterPrim& prim, const DrawEnv& env, uint16_t* out) {
+    const int* base = reinterpret_cast<const int*>(vram);
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    const __m256i half = _mm256_set1_epi32(0xffff);
+    const __m256i x_wrap = _mm256_set1_epi32(VRAM::WIDTH - 1);
+    const __m256i y_wrap = _mm256_set1_epi32(VRAM::HEIGHT - 1);
+
+    const __m256i keep_u = _mm256_set1_epi32(~env.window_mask_u);
+    const __m256i keep_v = _mm256_set1_epi32(~env.window_mask_v);
+    const __m256i set_u = _mm256_set1_epi32(env.window_offset_u & env.window_mask_u);
+    const __m256i set_v = _mm256_set1_epi32(env.window_offset_v & env.window_mask_v);
+
+    const __m256i page_x = _mm256_set1_epi32(prim.page_x);
+    const __m256i page_y = _mm256_set1_epi32(prim.page_y);
+    const __m256i clut_x = _mm256_set1_epi32(prim.clut_x);
+    const __m256i clut_row = _mm256_set1_epi32(prim.clut_y * VRAM::WIDTH);
+
+    __m256i u = ramp_avx2(s.u, s.du);
+    __m256i v = ramp_avx2(s.v, s.dv);
+    __m256i step_u = _mm256_set1_epi32((int32_t)((uint32_t)s.du * 8));
+    __m256i step_v = _mm256_set1_epi32((int32_t)((uint32_t)s.dv * 8));
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i tu = _mm256_and_si256(_mm256_srai_epi32(u, 16), byte);
+        __m256i tv = _mm256_and_si256(_mm256_srai_epi32(v, 16), byte);
+        tu = _mm256_or_si256(_mm256_and_si256(tu, keep_u), set_u);
+        tv = _mm256_or_si256(_mm256_and_si256(tv, keep_v), set_v);
+
+        __m256i row = _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(page_y, tv), y_wrap), 10);
+        __m256i texel;
+
+        if (prim.texels) {
+            __m256i offset = _mm256_or_si256(_mm256_slli_epi32(tv, 8), tu);
+            texel = _mm256_i32gather_epi32(reinterpret_cast<const int*>(prim.texels), offset, 2);
+        } else if (prim.depth < 2) {
+            /* 4 texels per pixel at 4 bits, 2 at 8 bits, then through the CLUT. */
+            bool nibble = prim.depth == 0;
+            __m256i column = nibble ? _mm256_srli_epi32(tu, 2) : _mm256_srli_epi32(tu, 1);
+            __m256i shift = nibble ? _mm256_slli_epi32(_mm256_and_si256(tu, _mm256_set1_epi32(3)), 2)
+                                   : _mm256_slli_epi32(_mm256_and_si256(tu, _mm256_set1_epi32(1)), 3);
+
+            __m256i offset = _mm256_or_si256(row, _mm256_and_si256(_mm256_add_epi32(page_x, column), x_wrap));
+            __m256i packed = _mm256_i32gather_epi32(base, offset, 2);
+            __m256i index = _mm256_and_si256(_mm256_srlv_epi32(packed, shift), _mm256_set1_epi32(nibble ? 0xf : 0xff));
+
+            __m256i entry = _mm256_or_si256(clut_row, _mm256_and_si256(_mm256_add_epi32(clut_x, index), x_wrap));
+            texel = _mm256_i32gather_epi32(base, entry, 2);
+        } else {
+            __m256i offset = _mm256_or_si256(row, _mm256_and_si256(_mm256_add_epi32(page_x, tu), x_wrap));
+            texel = _mm256_i32gather_epi32(base, offset, 2);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), pack_avx2(_mm256_and_si256(texel, half)));
+
+        u = _mm256_add_epi32(u, step_u);
+        v = _mm256_add_epi32(v, step_v);
+    }
+
+    _mm256_zeroupper();
+    fetch_scalar(vram, advanced(s, i), count - i, prim, env, out + i);
+}
+
+PSEMU_TARGET("avx2")
+static void modulate_avx2(const uint16_t* texels, const SpanSetup& s, uint32_t count,
+                          const int8_t* dither, uint32_t x0, uint16_t* out) {
+    __m256i r = ramp_avx2(s.r, s.dr);
+    __m256i g = ramp_avx2(s.g, s.dg);
+    __m256i b = ramp_avx2(s.b, s.db);
+    __m256i step_r = _mm256_set1_epi32((int32_t)((uint32_t)s.dr * 8));
+    __m256i step_g = _mm256_set1_epi32((int32_t)((uint32_t)s.dg * 8));
+    __m256i step_b = _mm256_set1_epi32((int32_t)((uint32_t)s.db * 8));
+    __m256i d = dither_avx2(dither, x0);
+    __m256i five = _mm256_set1_epi32(31);
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i t = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(texels + i)));
+        __m256i tr = _mm256_and_si256(t, five);
+        __m256i tg = _mm256_and_si256(_mm256_srli_epi32(t, 5), five);
+        __m256i tb = _mm256_and_si256(_mm256_srli_epi32(t, 10), five);
+
+        __m256i cr = cut_avx2(_mm256_srai_epi32(_mm256_mullo_epi32(tr, _mm256_srai_epi32(r, 16)), 4), d);
+        __m256i cg = cut_avx2(_mm256_srai_epi32(_mm256_mullo_epi32(tg, _mm256_srai_epi32(g, 16)), 4), d);
+        __m256i cb = cut_avx2(_mm256_srai_epi32(_mm256_mullo_epi32(tb, _mm256_srai_epi32(b, 16)), 4), d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), pack_rgb_avx2(cr, cg, cb));
+
+        r = _mm256_add_epi32(r, step_r);
+        g = _mm256_add_epi32(g, step_g);
+        b = _mm256_add_epi32(b, step_b);
+    }
+
+    _mm256_zeroupper();
+    modulate_scalar(texels + i, advanced(s, i), count - i, dither, x0 + i, out + i);
+}
+
+PSEMU_TARGET("avx2")
+static __m256i blend_channel_avx2(__m256i b, __m256i f, uint32_t mode) {
+    __m256i max = _mm256_set1_epi16(31);
+
+    switch (mode) {
+    case 0: return _mm256_srli_epi16(_mm256_add_epi16(b, f), 1);
+    case 1: return _mm256_min_epu16(_mm256_add_epi16(b, f), max);
+    case 2: return _mm256_subs_epu16(b, f);
+    default: return _mm256_min_epu16(_mm256_add_epi16(b, _mm256_srli_epi16(f, 2)), max);
+    }
+}
+
+PSEMU_TARGET("avx2")
+static void blend_avx2(const uint16_t* back, const uint16_t* front, uint32_t count, uint32_t mode, uint16_t* out) {
+    __m256i five = _mm256_set1_epi16(31);
+
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i bk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(back + i));
+        __m256i fr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(front + i));
+
+        __m256i r = blend_channel_avx2(_mm256_and_si256(bk, five), _mm256_and_si256(fr, five), mode);
+        __m256i g = blend_channel_avx2(_mm256_and_si256(_mm256_srli_epi16(bk, 5), five),
+                                       _mm256_and_si256(_mm256_srli_epi16(fr, 5), five), mode);
+        __m256i b = blend_channel_avx2(_mm256_and_si256(_mm256_srli_epi16(bk, 10), five),
+                                       _mm256_and_si256(_mm256_srli_epi16(fr, 10), five), mode);
+
+        __m256i c = _mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi16(g, 5), _mm256_slli_epi16(b, 10)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), c);
+    }
+
+    _mm256_zeroupper();
+    blend_scalar(back + i, front + i, count - i, mode, out + i);
+}
+
+PSEMU_TARGET("avx2")
+static void store_avx2(uint16_t* dst, const uint16_t* color, const uint16_t* blended,
+                       const uint16_t* texels, uint32_t count, StoreFlags flags) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i top = _mm256_set1_epi16((int16_t)0x8000);
+    const __m256i low = _mm256_set1_epi16(0x7fff);
+    const __m256i set = flags.set_mask ? top : zero;
+
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i back = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(color + i));
+        __m256i keep = _mm256_cmpeq_epi16(zero, zero);
+        __m256i mask = set;
+        __m256i select = keep;
+
+        if (flags.check_mask)
+            keep = _mm256_cmpeq_epi16(_mm256_and_si256(back, top), zero);
+
+        if (texels) {
+            __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(texels + i));
+            __m256i t_top = _mm256_and_si256(t, top);
+            keep = _mm256_andnot_si256(_mm256_cmpeq_epi16(t, zero), keep);
+            mask = _mm256_or_si256(mask, t_top);
+            select = _mm256_cmpeq_epi16(t_top, top);
+        }
+
+        if (blended) {
+            __m256i bl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blended + i));
+            value = _mm256_blendv_epi8(value, bl, select);
+        }
+
+        value = _mm256_or_si256(_mm256_and_si256(value, low), mask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_blendv_epi8(back, value, keep));
+    }
+
+    _mm256_zeroupper();
+    store_scalar(dst + i, color + i, blended ? blended + i : nullptr, texels ? texels + i : nullptr, count - i, flags);
+}
+
+static const SpanKernels AVX2_KERNELS = {
+    shade_avx2, fetch_avx2, modulate_avx2, blend_avx2, store_avx2
+};
+
+#endif
+
+const SpanKernels& span_kernels(SpanISA isa) {
+#ifdef PSEMU_X86
+    if (isa == SpanISA::AVX2 && simd::has_avx2())
+        return AVX2_KERNELS;
+    if (isa != SpanISA::Scalar && simd::has_sse41())
+        return SSE41_KERNELS;
+#endif
+    return SCALAR_KERNELS;
+}
+
+SpanISA best_span_isa() {
+    if (simd::has_avx2())
+        return SpanISA::AVX2;
+    if (simd::has_sse41())
+        return SpanISA::SSE41;
+    return SpanISA::Scalar;
+}
+
+const char* span_isa_name(SpanISA isa) {
+    switch (isa) {
+    case SpanISA::AVX2: return "avx2";
+    case SpanISA::SSE41: return "sse4.1";
+    default: return "scalar";
+    }
+}
+
+bool bench_span_kernels(uint32_t iterations) {
+    /* Odd length so the scalar tails run too. */
+    const uint32_t count = 1021;
+    const int8_t dither[4] = { -4, 0, -3, 1 };
+
+    std::mt19937 rng(1);
+    std::vector<uint16_t> vram(VRAM::WIDTH * VRAM::HEIGHT + 2);
+    for (auto& pixel : vram)
+        pixel = (uint16_t)rng();
+
+    std::vector<uint16_t> back(vram.begin(), vram.begin() + count);
+    std::vector<uint16_t> texels(back.rbegin(), back.rend());
+    for (uint32_t i = 0; i < count; i += 7)
+        texels[i] = 0;
+
+    SpanSetup s = {};
+    s.r = 20 << 16;  s.dr = 0x3d21;
+    s.g = 200 << 16; s.dg = -0x2a03;
+    s.b = 128 << 16; s.db = 0x0123;
+    s.u = 3 << 16;   s.du = 0x1c40;
+    s.v = 17 << 16;  s.dv = 0x0511;
+
+    RasterPrim prim;
+    prim.page_x = 640;
+    prim.page_y = 256;
+    prim.clut_x = 1008;
+    prim.clut_y = 480;
+
+    DrawEnv env;
+    env.window_mask_u = 0x18;
+    env.window_offset_u = 0x08;
+
+    const SpanISA isas[] = { SpanISA::Scalar, SpanISA::SSE41, SpanISA::AVX2 };
+    const char* names[] = { "shade", "fetch4", "fetch8", "fetch15", "fetchc", "modulate", "blend", "store" };
+    std::vector<uint16_t> reference[8];
+    bool ok = true;
+
+    for (SpanISA isa : isas) {
+        if ((isa == SpanISA::SSE41 && !simd::has_sse41()) || (isa == SpanISA::AVX2 && !simd::has_avx2()))
+            continue;
+
+        const SpanKernels& k = span_kernels(isa);
+        StoreFlags flags = { true, true };
+
+        for (int kernel = 0; kernel < 8; kernel++) {
+            std::vector<uint16_t> out(count);
+            std::vector<uint16_t> dst;
+
+            auto run = [&]() {
+                switch (kernel) {
+                case 0: k.shade(s, count, dither, 5, out.data()); break;
+                case 1: case 2: case 3:
+                    prim.depth = kernel - 1;
+                    k.fetch(vram.data(), s, count, prim, env, out.data());
+                    break;
+                case 4:
+                    /* Any 256x256 texels stand in for a decoded page. */
+                    prim.depth = 0;
+                    prim.texels = vram.data();
+                    k.fetch(vram.data(), s, count, prim, env, out.data());
+                    prim.texels = nullptr;
+                    break;
+                case 5: k.modulate(texels.data(), s, count, dither, 5, out.data()); break;
+                case 6: k.blend(back.data(), texels.data(), count, 1, out.data()); break;
+                default:
+                    dst = back;
+                    k.store(dst.data(), back.data(), texels.data(), texels.data(), count, flags);
+                    out = dst;
+                    break;
+                }
+            };
+
+            auto begin = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < iterations; i++)
+                run();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            bool match = true;
+            if (isa == SpanISA::Scalar)
+                reference[kernel] = out;
+            else
+                match = out == reference[kernel];
+
+            ok &= match;
+            printf("[GPU] %-8s %-6s %9.1f Mpixels/s%s\n", names[kernel], span_isa_name(isa),
+                   (double)count * iterations / seconds / 1e6, match ? "" : "  MISMATCH");
+        }
+    }
+
+    return ok;
+}
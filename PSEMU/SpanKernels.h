@@ -0,0 +1,62 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+
+struct SpanSetup;
+struct RasterPrim;
+struct DrawEnv;
+
+enum class SpanISA {
+    Scalar,
+    SSE41,
+    AVX2
+};
+
+/* What store does besides writing the colour. */
+struct StoreFlags {
+    bool check_mask; /* Skip pixels with bit 15 set in VRAM. */
+    bool set_mask; /* Write bit 15. */
+};
+
+/*
+ * The per pixel work of the rasterizer, split into kernels that each do
+ * one step for a run of pixels in a VRAM row. dither is the dither table
+ * row for the span or null, x0 the VRAM column of the first pixel.
+ * Every ISA gives the same bits.
+ */
+struct SpanKernels {
+    /* Gouraud or flat colour, dithered and cut to 5:5:5. */
+    void (*shade)(const SpanSetup& s, uint32_t count, const int8_t* dither, uint32_t x0, uint16_t* out);
+
+    /* Texels along the span, texture window applied. Reads up to 2 bytes */
+    /* past a VRAM pixel, or past a decoded texel with prim.texels set.  */
+    void (*fetch)(const uint16_t* vram, const SpanSetup& s, uint32_t count,
+                  const RasterPrim& prim, const DrawEnv& env, uint16_t* out);
+
+    /* Texel * colour / 128, dithered and cut to 5:5:5. */
+    void (*modulate)(const uint16_t* texels, const SpanSetup& s, uint32_t count,
+                     const int8_t* dither, uint32_t x0, uint16_t* out);
+
+    /* Semi-transparency mode of front over back. */
+    void (*blend)(const uint16_t* back, const uint16_t* front, uint32_t count, uint32_t mode, uint16_t* out);
+
+    /* Writes color, or blended where the pixel is semi transparent. With */
+    /* texels, 0 texels are skipped and only texels with bit 15 set blend. */
+    void (*store)(uint16_t* dst, const uint16_t* color, const uint16_t* blended,
+                  const uint16_t* texels, uint32_t count, StoreFlags flags);
+};
+
+const SpanKernels& span_kernels(SpanISA isa);
+SpanISA best_span_isa();
+const char* span_isa_name(SpanISA isa);
+
+/* Times every kernel on every ISA the host has and checks them against */
+/* the scalar ones. Returns false if any result differs.               */
+bool bench_span_kernels(uint32_t iterations);
@@ -0,0 +1,171 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include "TextureCache.h"
+#include "Rasterizer.h"
+
+/* Whether [a, a + a_len) and [b, b + b_len) overlap on a ring of size entries. */
+static bool ring_overlap(uint32_t a, uint32_t a_len, uint32_t b, uint32_t b_len, uint32_t size) {
+    return ((b - a) & (size - 1)) < a_len || ((a - b) & (size - 1)) < b_len;
+}
+
+/* Page positions are in 64x256 steps and CLUTs in 16 pixel steps, so this is exact. */
+static uint32_t entry_key(const RasterPrim& prim) {
+    return prim.depth | (prim.page_x / 64) << 1 | (prim.page_y / 256) << 5 |
+           (prim.clut_x / 16) << 6 | prim.clut_y << 12;
+}
+
+TextureCache::TextureCache(const VRAM& vram) : vram(vram), entries(ENTRIES), candidates(CANDIDATES) {}
+
+TextureCache::~TextureCache() {
+    if (stats.lookups)
+        printf("[GPU] texture cache: %llu lookups, %llu hits, %llu cold, %llu decodes, %llu evicted, %llu invalidated\n",
+               (unsigned long long)stats.lookups, (unsigned long long)stats.hits, (unsigned long long)stats.cold,
+               (unsigned long long)stats.decodes, (unsigned long long)stats.evictions,
+               (unsigned long long)stats.invalidations);
+}
+
+const uint16_t* TextureCache::lookup(const RasterPrim& prim, uint32_t first_row, uint32_t rows,
+                                     uint32_t pixels, bool hold) {
+    if (prim.depth >= 2)
+        return nullptr;
+
+    stats.lookups++;
+    uint32_t key = entry_key(prim);
+    Entry* found = nullptr;
+    Entry* victim = nullptr;
+
+    for (Entry& entry : entries) {
+        if (entry.valid && entry.key == key) {
+            found = &entry;
+            break;
+        }
+
+        /* Empty entries first, then the least recently used. */
+        if (entry.held)
+            continue;
+        if (!victim || (victim->valid && (!entry.valid || entry.last_used < victim->last_used)))
+            victim = &entry;
+    }
+
+    if (found) {
+        stats.hits++;
+    } else {
+        Candidate& candidate = candidates[(key * 0x9e3779b1u) >> 24];
+        if (candidate.key != key)
+            candidate = { key, 0 };
+
+        candidate.pixels += std::min(pixels, ADMIT);
+        if (candidate.pixels < ADMIT) {
+            stats.cold++;
+            return nullptr;
+        }
+
+        if (!victim) {
+            stats.full++;
+            return nullptr;
+        }
+
+        candidate = Candidate();
+        if (victim->valid)
+            stats.evictions++;
+
+        found = victim;
+        found->key = key;
+        found->valid = true;
+        found->bands = 0;
+
+        bool nibble = prim.depth == 0;
+        found->page_x = prim.page_x;
+        found->page_y = prim.page_y;
+        found->page_width = nibble ? 64 : 128;
+        found->clut_x = prim.clut_x;
+        found->clut_y = prim.clut_y;
+        found->clut_width = nibble ? 16 : 256;
+
+        if (!found->texels)
+            found->texels = std::make_unique<uint16_t[]>(TEXELS + 1);
+    }
+
+    /* Bands covering the rows, which may wrap past row 255. */
+    uint32_t first_band = first_row / BAND_ROWS;
+    uint32_t last_band = (first_row + std::min(rows, 256u) - 1) / BAND_ROWS;
+    for (uint32_t band = first_band; band <= last_band; band++) {
+        uint32_t bit = 1u << (band % BANDS);
+        if (!(found->bands & bit))
+            decode(*found, band % BANDS);
+    }
+
+    found->last_used = ++clock;
+    found->held |= hold;
+    return found->texels.get();
+}
+
+void TextureCache::release() {
+    for (Entry& entry : entries)
+        entry.held = false;
+}
+
+void TextureCache::invalidate(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    for (Entry& entry : entries) {
+        if (!entry.valid)
+            continue;
+
+        if (ring_overlap(entry.clut_x, entry.clut_width, x, width, VRAM::WIDTH) &&
+            ring_overlap(entry.clut_y, 1, y, height, VRAM::HEIGHT)) {
+            stats.invalidations += std::popcount(entry.bands);
+            entry.valid = false;
+            continue;
+        }
+
+        if (!entry.bands || !ring_overlap(entry.page_x, entry.page_width, x, width, VRAM::WIDTH))
+            continue;
+
+        for (uint32_t band = 0; band < BANDS; band++) {
+            uint32_t bit = 1u << band;
+            if ((entry.bands & bit) && ring_overlap(entry.page_y + band * BAND_ROWS, BAND_ROWS, y, height, VRAM::HEIGHT)) {
+                entry.bands &= ~bit;
+                stats.invalidations++;
+            }
+        }
+    }
+}
+
+void TextureCache::decode(Entry& entry, uint32_t band) {
+    stats.decodes++;
+    entry.bands |= 1u << band;
+
+    bool nibble = entry.clut_width == 16;
+    uint16_t clut[256];
+    for (uint32_t i = 0; i < entry.clut_width; i++)
+        clut[i] = vram.read(entry.clut_x + i, entry.clut_y);
+
+    for (uint32_t v = band * BAND_ROWS; v < (band + 1) * BAND_ROWS; v++) {
+        const uint16_t* row = vram.row(entry.page_y + v);
+        uint16_t* out = entry.texels.get() + v * 256;
+
+        for (uint32_t column = 0; column < entry.page_width; column++) {
+            uint16_t packed = row[(entry.page_x + column) & (VRAM::WIDTH - 1)];
+
+            if (nibble) {
+                out[0] = clut[packed & 0xf];
+                out[1] = clut[(packed >> 4) & 0xf];
+                out[2] = clut[(packed >> 8) & 0xf];
+                out[3] = clut[packed >> 12];
+                out += 4;
+            } else {
+                out[0] = clut[packed & 0xff];
+                out[1] = clut[packed >> 8];
+                out += 2;
+            }
+        }
+    }
+}
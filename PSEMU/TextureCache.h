@@ -0,0 +1,98 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "VRAM.h"
+
+struct RasterPrim;
+
+struct TextureCacheStats {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t decodes = 0; /* In bands. */
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0; /* Bands dropped because VRAM under them was written. */
+    uint64_t cold = 0; /* Lookups for textures not drawn enough yet to pay for a decode. */
+    uint64_t full = 0; /* Lookups that found every entry held by the batch. */
+};
+
+/*
+ * 4 and 8 bit texture pages decoded through their CLUT into 256x256
+ * 15 bit texels, so a fetch is one load instead of two. Entries are
+ * keyed by page, CLUT and depth and dropped by invalidate() when VRAM
+ * under either is written, the least recently used go first.
+ *
+ * Pages are decoded and invalidated in bands of BAND_ROWS rows, only
+ * the bands under the rows a primitive samples are decoded. A texture
+ * is only cached once primitives using it have covered ADMIT pixels;
+ * until then lookups return null and primitives fetch from VRAM.
+ *
+ * Primitives waiting in a batch point into entries, so lookups made for
+ * a batch hold their entry until release(); held entries are never
+ * evicted. VRAM under a held entry is only written after the batch was
+ * drawn, see TiledRasterizer.
+ */
+class TextureCache {
+public:
+    static const uint32_t ENTRIES = 64;
+    static const uint32_t TEXELS = 256 * 256;
+    static const uint32_t BAND_ROWS = 16;
+    static const uint32_t BANDS = 256 / BAND_ROWS;
+    static const uint32_t ADMIT = TEXELS / 8;
+    static const uint32_t CANDIDATES = 256;
+
+    explicit TextureCache(const VRAM& vram);
+    ~TextureCache();
+
+    /* Decoded texels of the primitive's page, v * 256 + u, valid in rows */
+    /* first_row to first_row + rows - 1 (wrapping), for a primitive that */
+    /* covers about pixels. Null for 15 bit pages, textures not admitted  */
+    /* yet, or when every entry is held.                                  */
+    const uint16_t* lookup(const RasterPrim& prim, uint32_t first_row, uint32_t rows, uint32_t pixels, bool hold);
+    void release();
+
+    /* Drops the bands of every page under the rectangle, which wraps like VRAM, */
+    /* and the whole entry where it overlaps the CLUT.                          */
+    void invalidate(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    const TextureCacheStats& get_stats() const { return stats; }
+
+private:
+    struct Entry {
+        uint32_t key = 0;
+        bool valid = false;
+        bool held = false;
+        uint32_t bands = 0; /* Decoded bands, one bit each. */
+        uint64_t last_used = 0;
+
+        /* Pixels the texels came from. */
+        uint32_t page_x = 0, page_y = 0, page_width = 0;
+        uint32_t clut_x = 0, clut_y = 0, clut_width = 0;
+
+        /* The AVX2 gather reads 2 bytes past the last texel. */
+        std::unique_ptr<uint16_t[]> texels;
+    };
+
+    void decode(Entry& entry, uint32_t band);
+
+    /* Pixels drawn with textures that are not cached, one key per slot. */
+    struct Candidate {
+        uint32_t key = ~0u;
+        uint32_t pixels = 0;
+    };
+
+    const VRAM& vram;
+    std::vector<Entry> entries;
+    std::vector<Candidate> candidates;
+    uint64_t clock = 0;
+
+    TextureCacheStats stats;
+};
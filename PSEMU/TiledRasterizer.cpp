@@ -0,0 +1,376 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <cstdio>
+#include "TiledRasterizer.h"
+
+TiledRasterizer::TiledRasterizer(VRAM& vram) : vram(vram), textures(vram) {
+    rasterizers.emplace_back(vram);
+}
+
+TiledRasterizer::~TiledRasterizer() {
+    stop_workers();
+
+    if (stats.batches)
+        printf("[GPU] tiles: %llu prims in %llu batches, %llu tile jobs, %llu drawn alone\n",
+               (unsigned long long)stats.prims, (unsigned long long)stats.batches,
+               (unsigned long long)stats.tile_jobs, (unsigned long long)stats.serial);
+}
+
+void TiledRasterizer::set_threads(unsigned threads) {
+    flush();
+    stop_workers();
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    rasterizers.clear();
+    for (unsigned i = 0; i < threads; i++) {
+        rasterizers.emplace_back(vram);
+        rasterizers.back().set_span_isa(isa);
+    }
+
+    for (unsigned i = 1; i < threads; i++)
+        pool.emplace_back(&TiledRasterizer::worker, this, i);
+}
+
+void TiledRasterizer::set_span_isa(SpanISA isa) {
+    flush();
+    this->isa = isa;
+    for (Rasterizer& rasterizer : rasterizers)
+        rasterizer.set_span_isa(isa);
+}
+
+void TiledRasterizer::stop_workers() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    start.notify_all();
+
+    for (std::thread& thread : pool)
+        thread.join();
+
+    pool.clear();
+    quit = false;
+}
+
+/* Tiles touched by a rectangle that may wrap around VRAM. */
+TileMask TiledRasterizer::tiles_of(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    TileMask mask;
+    uint32_t columns = std::min(TILES_X, (x % TILE_SIZE + width + TILE_SIZE - 1) / TILE_SIZE);
+    uint32_t rows = std::min(TILES_Y, (y % TILE_SIZE + height + TILE_SIZE - 1) / TILE_SIZE);
+
+    for (uint32_t row = 0; row < rows; row++) {
+        uint32_t tile_y = (y / TILE_SIZE + row) % TILES_Y;
+        for (uint32_t column = 0; column < columns; column++)
+            mask.set(tile_y * TILES_X + (x / TILE_SIZE + column) % TILES_X);
+    }
+
+    return mask;
+}
+
+/* Every pixel a textured primitive may sample: its page and its CLUT. */
+TileMask TiledRasterizer::texture_tiles(const RasterPrim& prim) {
+    uint32_t page_width = prim.depth == 0 ? 64 : prim.depth == 1 ? 128 : 256;
+    TileMask mask = tiles_of(prim.page_x, prim.page_y, page_width, 256);
+
+    if (prim.depth < 2) {
+        mask.merge(tiles_of(prim.clut_x, prim.clut_y, prim.depth == 0 ? 16 : 256, 1));
+    }
+
+    return mask;
+}
+
+/* Texture rows a primitive may sample, counted from first and wrapping past 255. */
+static void texture_rows(const BinnedPrim& binned, uint32_t& first, uint32_t& rows) {
+    first = 0;
+    rows = 256;
+    if (binned.env.window_mask_v)
+        return;
+
+    const RasterVertex* v = binned.vertices;
+
+    if (binned.kind == PrimKind::Triangle) {
+        /* Interpolation rounds, allow a row either side. */
+        int32_t low = std::min({ v[0].v, v[1].v, v[2].v });
+        int32_t high = std::max({ v[0].v, v[1].v, v[2].v });
+        first = (uint32_t)(low - 1) & 0xff;
+        rows = high - low + 3;
+    } else if (binned.kind == PrimKind::Rectangle) {
+        /* One row per line, up or down from the corner. */
+        first = (uint32_t)(binned.flip_y ? v[0].v - (binned.height - 1) : v[0].v) & 0xff;
+        rows = binned.height;
+    }
+}
+
+bool TiledRasterizer::clip(BinnedPrim& binned, int32_t left, int32_t top, int32_t right, int32_t bottom) {
+    binned.left = std::max(left, env.clip_left);
+    binned.top = std::max(top, env.clip_top);
+    binned.right = std::min(right, env.clip_right);
+    binned.bottom = std::min(bottom, env.clip_bottom);
+
+    return binned.left <= binned.right && binned.top <= binned.bottom;
+}
+
+void TiledRasterizer::triangle(const RasterVertex vertices[3], const RasterPrim& prim) {
+    BinnedPrim binned = {};
+    binned.kind = PrimKind::Triangle;
+    std::copy(vertices, vertices + 3, binned.vertices);
+    binned.prim = prim;
+    binned.env = env;
+
+    int32_t left = std::min({ vertices[0].x, vertices[1].x, vertices[2].x });
+    int32_t right = std::max({ vertices[0].x, vertices[1].x, vertices[2].x });
+    int32_t top = std::min({ vertices[0].y, vertices[1].y, vertices[2].y });
+    int32_t bottom = std::max({ vertices[0].y, vertices[1].y, vertices[2].y });
+
+    if (clip(binned, left, top, right, bottom))
+        submit(binned);
+}
+
+void TiledRasterizer::rectangle(const RasterVertex& corner, int32_t width, int32_t height,
+                                bool flip_x, bool flip_y, const RasterPrim& prim) {
+    BinnedPrim binned = {};
+    binned.kind = PrimKind::Rectangle;
+    binned.vertices[0] = corner;
+    binned.width = width;
+    binned.height = height;
+    binned.flip_x = flip_x;
+    binned.flip_y = flip_y;
+    binned.prim = prim;
+    binned.env = env;
+
+    if (clip(binned, corner.x, corner.y, corner.x + width - 1, corner.y + height - 1))
+        submit(binned);
+}
+
+void TiledRasterizer::line(const RasterVertex& a, const RasterVertex& b, const RasterPrim& prim) {
+    BinnedPrim binned = {};
+    binned.kind = PrimKind::Line;
+    binned.vertices[0] = a;
+    binned.vertices[1] = b;
+    binned.prim = prim;
+    binned.env = env;
+
+    /* The DDA never leaves the box spanned by the end points. */
+    if (clip(binned, std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.x, b.x), std::max(a.y, b.y)))
+        submit(binned);
+}
+
+void TiledRasterizer::fill(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t color) {
+    if (pool.empty() && prims.empty()) {
+        rasterizers[0].fill(x, y, width, height, color);
+        wrote(x, y, width, height);
+        return;
+    }
+
+    /* Fills wrap around VRAM, bin each piece on its own. */
+    x &= VRAM::WIDTH - 1;
+    y &= VRAM::HEIGHT - 1;
+    width = std::min(width, VRAM::WIDTH);
+    height = std::min(height, VRAM::HEIGHT);
+
+    uint32_t widths[2] = { std::min(width, VRAM::WIDTH - x), 0 };
+    uint32_t heights[2] = { std::min(height, VRAM::HEIGHT - y), 0 };
+    widths[1] = width - widths[0];
+    heights[1] = height - heights[0];
+
+    for (int row = 0; row < 2; row++) {
+        for (int column = 0; column < 2; column++) {
+            if (!widths[column] || !heights[row])
+                continue;
+
+            BinnedPrim binned = {};
+            binned.kind = PrimKind::Fill;
+            binned.color = color;
+            binned.left = column ? 0 : x;
+            binned.top = row ? 0 : y;
+            binned.right = binned.left + widths[column] - 1;
+            binned.bottom = binned.top + heights[row] - 1;
+
+            submit(binned);
+        }
+    }
+}
+
+/* Pixels in the rectangle change, or will once the batch is drawn. */
+void TiledRasterizer::wrote(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    textures.invalidate(x, y, width, height);
+    vram.mark_dirty(x, y, width, height);
+}
+
+void TiledRasterizer::submit(BinnedPrim& binned) {
+    uint32_t width = binned.right - binned.left + 1;
+    uint32_t height = binned.bottom - binned.top + 1;
+    bool textured = binned.kind != PrimKind::Fill && binned.prim.textured;
+    bool direct = pool.empty() && prims.empty();
+
+    if (direct && !textured) {
+        draw(rasterizers[0], binned, binned.env);
+        wrote(binned.left, binned.top, width, height);
+        return;
+    }
+
+    TileMask own = tiles_of(binned.left, binned.top, width, height);
+
+    TileMask reads;
+    uint32_t first_row = 0, rows = 0;
+    if (textured) {
+        reads = texture_tiles(binned.prim);
+        texture_rows(binned, first_row, rows);
+
+        if (direct || reads.intersects(written) || reads.intersects(own)) {
+            flush();
+
+            /* Decoded texels would miss what it draws over its own texture. */
+            if (!reads.intersects(own))
+                binned.prim.texels = textures.lookup(binned.prim, first_row, rows, width * height, false);
+
+            draw(rasterizers[0], binned, binned.env);
+            wrote(binned.left, binned.top, width, height);
+            stats.serial += !direct;
+            return;
+        }
+    }
+
+    /* Earlier primitives must sample these tiles before this one draws over them. */
+    if (own.intersects(read))
+        flush();
+
+    /* Entries held by the batch are under read, so this never drops one. */
+    wrote(binned.left, binned.top, width, height);
+    if (textured)
+        binned.prim.texels = textures.lookup(binned.prim, first_row, rows, width * height, true);
+
+    uint32_t index = (uint32_t)prims.size();
+    prims.push_back(binned);
+
+    for (uint32_t tile = 0; tile < TILES_X * TILES_Y; tile++) {
+        if (own.has(tile))
+            bins[tile].push_back(index);
+    }
+
+    written.merge(own);
+    read.merge(reads);
+    stats.prims++;
+
+    if (prims.size() >= MAX_BATCH)
+        flush();
+}
+
+void TiledRasterizer::draw(Rasterizer& rasterizer, const BinnedPrim& binned, const DrawEnv& clip_env) {
+    rasterizer.env = clip_env;
+
+    switch (binned.kind) {
+    case PrimKind::Triangle:
+        rasterizer.triangle(binned.vertices, binned.prim);
+        break;
+    case PrimKind::Rectangle:
+        rasterizer.rectangle(binned.vertices[0], binned.width, binned.height, binned.flip_x, binned.flip_y, binned.prim);
+        break;
+    case PrimKind::Line:
+        rasterizer.line(binned.vertices[0], binned.vertices[1], binned.prim);
+        break;
+    case PrimKind::Fill:
+        rasterizer.fill(clip_env.clip_left, clip_env.clip_top,
+                        clip_env.clip_right - clip_env.clip_left + 1, clip_env.clip_bottom - clip_env.clip_top + 1,
+                        binned.color);
+        break;
+    }
+}
+
+void TiledRasterizer::draw_tile(Rasterizer& rasterizer, uint32_t tile) {
+    int32_t tile_left = (tile % TILES_X) * TILE_SIZE;
+    int32_t tile_top = (tile / TILES_X) * TILE_SIZE;
+    int32_t tile_right = tile_left + TILE_SIZE - 1;
+    int32_t tile_bottom = tile_top + TILE_SIZE - 1;
+
+    for (uint32_t index : bins[tile]) {
+        const BinnedPrim& binned = prims[index];
+
+        /* The clipped bounds also stand in for the drawing area of a fill. */
+        DrawEnv clip_env = binned.env;
+        clip_env.clip_left = std::max(binned.left, tile_left);
+        clip_env.clip_top = std::max(binned.top, tile_top);
+        clip_env.clip_right = std::min(binned.right, tile_right);
+        clip_env.clip_bottom = std::min(binned.bottom, tile_bottom);
+
+        draw(rasterizer, binned, clip_env);
+    }
+}
+
+void TiledRasterizer::work(uint32_t index) {
+    uint32_t job;
+    while ((job = next_job.fetch_add(1)) < jobs.size())
+        draw_tile(rasterizers[index], jobs[job]);
+}
+
+void TiledRasterizer::worker(uint32_t index) {
+    uint64_t seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            start.wait(guard, [&] { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+        }
+
+        work(index);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+void TiledRasterizer::flush() {
+    if (prims.empty())
+        return;
+
+    jobs.clear();
+    for (uint32_t tile = 0; tile < TILES_X * TILES_Y; tile++) {
+        if (!bins[tile].empty())
+            jobs.push_back(tile);
+    }
+
+    /* Busiest tiles first, so no thread is left with a big one at the end. */
+    std::stable_sort(jobs.begin(), jobs.end(), [&](uint32_t a, uint32_t b) {
+        return bins[a].size() > bins[b].size();
+    });
+
+    stats.batches++;
+    stats.tile_jobs += jobs.size();
+    next_job = 0;
+
+    if (pool.empty() || jobs.size() == 1) {
+        work(0);
+    } else {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            generation++;
+            busy = (uint32_t)pool.size();
+        }
+        start.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return busy == 0; });
+    }
+
+    for (uint32_t tile : jobs)
+        bins[tile].clear();
+    prims.clear();
+    written = TileMask();
+    read = TileMask();
+    textures.release();
+}
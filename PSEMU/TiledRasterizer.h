@@ -0,0 +1,144 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Rasterizer.h"
+#include "TextureCache.h"
+
+enum class PrimKind : uint32_t {
+    Triangle,
+    Rectangle,
+    Line,
+    Fill
+};
+
+/* A primitive waiting in a batch, with the drawing state it was sent with. */
+struct BinnedPrim {
+    PrimKind kind;
+    RasterVertex vertices[3]; /* Triangle: all three. Rectangle: corner. Line: two ends. */
+    int32_t width, height; /* Rectangle and fill size. */
+    bool flip_x, flip_y;
+    uint16_t color; /* Fill colour. */
+    RasterPrim prim;
+    DrawEnv env;
+
+    /* Pixels the primitive may write, inclusive, inside VRAM. */
+    int32_t left, top, right, bottom;
+};
+
+struct TiledStats {
+    uint64_t prims = 0;
+    uint64_t batches = 0;
+    uint64_t tile_jobs = 0; /* Non-empty tiles over all batches. */
+    uint64_t serial = 0; /* Textured primitives that read their own batch and were drawn alone. */
+};
+
+/* One bit per tile. */
+struct TileMask {
+    uint64_t bits[2] = {};
+
+    void set(uint32_t tile) { bits[tile >> 6] |= 1ull << (tile & 63); }
+    bool has(uint32_t tile) const { return (bits[tile >> 6] >> (tile & 63)) & 1; }
+    void merge(const TileMask& other) { bits[0] |= other.bits[0]; bits[1] |= other.bits[1]; }
+    bool intersects(const TileMask& other) const {
+        return (bits[0] & other.bits[0]) || (bits[1] & other.bits[1]);
+    }
+};
+
+/*
+ * Front of the rasterizer used by the GPU. With one thread every
+ * primitive is drawn as it arrives. With more, primitives are binned
+ * into 64x64 tiles of VRAM and a batch is drawn by a pool of threads,
+ * one tile at a time, each tile in primitive order. Tiles do not share
+ * pixels, so blending and the mask bit come out as if drawn serially.
+ *
+ * Reads are the catch: a textured primitive sampling pixels written
+ * earlier in the batch (or by itself) flushes the batch and is drawn
+ * alone, and a primitive drawing over texels the batch still samples
+ * flushes it first. Anything else reading VRAM must call flush() first,
+ * anything else writing it must also call invalidate() after.
+ *
+ * 4 and 8 bit textures are sampled from the texture cache, looked up
+ * when the primitive is submitted. Primitives that may sample their own
+ * pixels read VRAM instead.
+ */
+class TiledRasterizer {
+public:
+    static const uint32_t TILE_SIZE = 64;
+    static const uint32_t TILES_X = VRAM::WIDTH / TILE_SIZE;
+    static const uint32_t TILES_Y = VRAM::HEIGHT / TILE_SIZE;
+    static const uint32_t MAX_BATCH = 4096;
+
+    explicit TiledRasterizer(VRAM& vram);
+    ~TiledRasterizer();
+
+    /* 0 uses every hardware thread, 1 draws immediately. */
+    void set_threads(unsigned threads);
+    unsigned get_threads() const { return (unsigned)rasterizers.size(); }
+
+    void set_span_isa(SpanISA isa);
+
+    void triangle(const RasterVertex vertices[3], const RasterPrim& prim);
+    void rectangle(const RasterVertex& corner, int32_t width, int32_t height,
+                   bool flip_x, bool flip_y, const RasterPrim& prim);
+    void line(const RasterVertex& a, const RasterVertex& b, const RasterPrim& prim);
+    void fill(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t color);
+
+    /* Draws everything binned so far. */
+    void flush();
+
+    /* VRAM in the rectangle was written by something other than the rasterizer. */
+    void invalidate(uint32_t x, uint32_t y, uint32_t width, uint32_t height) { textures.invalidate(x, y, width, height); }
+
+    const TiledStats& get_stats() const { return stats; }
+    const TextureCacheStats& get_texture_stats() const { return textures.get_stats(); }
+
+    DrawEnv env;
+
+private:
+    /* Clips the primitive's bounds to the drawing area, false if nothing is left. */
+    bool clip(BinnedPrim& binned, int32_t left, int32_t top, int32_t right, int32_t bottom);
+    void submit(BinnedPrim& binned);
+    void wrote(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    void draw(Rasterizer& rasterizer, const BinnedPrim& binned, const DrawEnv& clip_env);
+    void draw_tile(Rasterizer& rasterizer, uint32_t tile);
+    void work(uint32_t index);
+    void worker(uint32_t index);
+    void stop_workers();
+
+    static TileMask tiles_of(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    static TileMask texture_tiles(const RasterPrim& prim);
+
+    VRAM& vram;
+    SpanISA isa = best_span_isa();
+    std::vector<Rasterizer> rasterizers; /* One per thread, the caller's first. */
+    TextureCache textures;
+
+    std::vector<BinnedPrim> prims;
+    std::vector<uint32_t> bins[TILES_X * TILES_Y];
+    TileMask written, read; /* Tiles the batch draws to and samples textures from. */
+
+    /* The batch handed to the pool. */
+    std::vector<uint32_t> jobs;
+    std::atomic<uint32_t> next_job = 0;
+
+    std::vector<std::thread> pool;
+    std::mutex lock;
+    std::condition_variable start, done;
+    uint64_t generation = 0;
+    uint32_t busy = 0;
+    bool quit = false;
+
+    TiledStats stats;
+};
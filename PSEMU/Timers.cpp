@@ -0,0 +1,244 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include "Timers.h"
+
+uint32_t Timers::read(uint32_t offset, uint64_t now) {
+    uint32_t index = offset >> 4;
+    if (index >= TIMER_COUNT)
+        return 0;
+
+    RootCounter& counter = counters[index];
+    sync(index, now);
+    update_deadline();
+
+    switch (offset & 0xf) {
+    case 0x0:
+        return counter.value;
+    case 0x4: {
+        uint32_t mode = counter.mode.raw;
+        counter.mode.reached_target = 0;
+        counter.mode.reached_overflow = 0;
+        return mode;
+    }
+    case 0x8:
+        return counter.target;
+    default:
+        return 0;
+    }
+}
+
+void Timers::write(uint32_t offset, uint32_t value, uint64_t now) {
+    uint32_t index = offset >> 4;
+    if (index >= TIMER_COUNT)
+        return;
+
+    RootCounter& counter = counters[index];
+    sync(index, now);
+
+    switch (offset & 0xf) {
+    case 0x0:
+        counter.value = value & 0xffff;
+        break;
+    case 0x4:
+        /* Writing the mode restarts the counter and rearms the IRQ. */
+        counter.mode.raw = (value & 0x3ff) | (1 << 10) | (counter.mode.raw & 0x1800);
+        counter.value = 0;
+        counter.irq_armed = true;
+        set_rate(index);
+        break;
+    case 0x8:
+        counter.target = value & 0xffff;
+        break;
+    }
+
+    schedule(index);
+    update_deadline();
+}
+
+void Timers::set_video(uint32_t divider, bool is_pal, uint64_t now) {
+    if (divider == dot_divider && is_pal == pal)
+        return;
+
+    /* Count up to now at the old rates first. */
+    sync(0, now);
+    sync(1, now);
+
+    dot_divider = divider;
+    pal = is_pal;
+
+    for (uint32_t i = 0; i < 2; i++) {
+        set_rate(i);
+        schedule(i);
+    }
+    update_deadline();
+}
+
+uint32_t Timers::update(uint64_t now) {
+    for (uint32_t i = 0; i < TIMER_COUNT; i++) {
+        if (counters[i].next_irq <= now) {
+            sync(i, now);
+            schedule(i);
+        }
+    }
+
+    uint32_t raised = pending;
+    pending = 0;
+    update_deadline();
+    return raised;
+}
+
+void Timers::sync(uint32_t index, uint64_t now) {
+    RootCounter& counter = counters[index];
+    if (now <= counter.base_cycle)
+        return;
+
+    uint64_t elapsed = now - counter.base_cycle;
+    counter.base_cycle = now;
+    if (counter.stopped)
+        return;
+
+    uint64_t units = elapsed * counter.rate_num + counter.fraction;
+    counter.fraction = units % counter.rate_den;
+    advance(index, units / counter.rate_den);
+}
+
+void Timers::advance(uint32_t index, uint64_t ticks) {
+    RootCounter& counter = counters[index];
+    bool hit_target = false;
+    bool hit_overflow = false;
+
+    while (ticks > 0) {
+        /* A counter past its target runs on to 0xffff even when it resets at the target. */
+        uint32_t wrap = counter.mode.reset_on_target && counter.value <= counter.target ? counter.target + 1 : 0x10000;
+
+        if (counter.value < counter.target && ticks >= counter.target - counter.value)
+            hit_target = true;
+        if (wrap == 0x10000 && counter.value < 0xffff && ticks >= 0xffff - counter.value)
+            hit_overflow = true;
+
+        uint64_t to_wrap = wrap - counter.value;
+        if (ticks < to_wrap) {
+            counter.value += (uint32_t)ticks;
+            break;
+        }
+
+        ticks -= to_wrap;
+        counter.value = 0;
+        if (counter.target == 0)
+            hit_target = true;
+
+        /* Every lap from 0 passes the same values, skip the whole ones. */
+        uint32_t lap = counter.mode.reset_on_target ? counter.target + 1 : 0x10000;
+        if (ticks >= lap) {
+            hit_target = true;
+            hit_overflow |= lap == 0x10000;
+            ticks %= lap;
+        }
+    }
+
+    if (hit_target) {
+        counter.mode.reached_target = 1;
+        if (counter.mode.irq_on_target)
+            raise(index);
+    }
+
+    if (hit_overflow) {
+        counter.mode.reached_overflow = 1;
+        if (counter.mode.irq_on_overflow)
+            raise(index);
+    }
+}
+
+void Timers::raise(uint32_t index) {
+    RootCounter& counter = counters[index];
+    if (!counter.irq_armed)
+        return;
+
+    /* In toggle mode only every other event pulls the line low. */
+    if (counter.mode.irq_toggle)
+        counter.mode.irq_inactive ^= 1;
+
+    if (!counter.mode.irq_toggle || !counter.mode.irq_inactive)
+        pending |= 1 << (4 + index);
+
+    if (!counter.mode.irq_repeat)
+        counter.irq_armed = false;
+}
+
+void Timers::set_rate(uint32_t index) {
+    RootCounter& counter = counters[index];
+    uint32_t source = counter.mode.clock_source;
+
+    counter.rate_num = 1;
+    counter.rate_den = 1;
+    counter.fraction = 0;
+
+    VideoClock clock = video_clock(pal);
+    if (index == 0 && (source & 1)) {
+        counter.rate_num = clock.num;
+        counter.rate_den = clock.den * dot_divider;
+    } else if (index == 1 && (source & 1)) {
+        counter.rate_num = clock.num;
+        counter.rate_den = clock.den * (pal ? PAL_LINE_CYCLES : NTSC_LINE_CYCLES);
+    } else if (index == 2 && (source & 2)) {
+        counter.rate_den = 8;
+    }
+
+    /* Counter 2 sync modes 0 and 3 stop it. */
+    counter.stopped = index == 2 && counter.mode.sync_enable &&
+                      (counter.mode.sync_mode == 0 || counter.mode.sync_mode == 3);
+}
+
+uint64_t Timers::ticks_until(const RootCounter& counter, uint32_t value) const {
+    uint32_t wrap = counter.mode.reset_on_target && counter.value <= counter.target ? counter.target + 1 : 0x10000;
+    if (counter.value < value && value < wrap)
+        return value - counter.value;
+
+    /* Not before the counter wraps to 0. */
+    uint64_t first = wrap - counter.value;
+    uint32_t lap = counter.mode.reset_on_target ? counter.target + 1 : 0x10000;
+    if (value < lap)
+        return first + value;
+
+    return UINT64_MAX;
+}
+
+void Timers::schedule(uint32_t index) {
+    RootCounter& counter = counters[index];
+    counter.next_irq = UINT64_MAX;
+
+    if (counter.stopped || !counter.irq_armed)
+        return;
+
+    uint64_t ticks = UINT64_MAX;
+    if (counter.mode.irq_on_target)
+        ticks = std::min(ticks, ticks_until(counter, counter.target));
+    if (counter.mode.irq_on_overflow)
+        ticks = std::min(ticks, ticks_until(counter, 0xffff));
+
+    if (ticks == UINT64_MAX)
+        return;
+
+    /* First cycle at which fraction + cycles * num reaches ticks * den. */
+    uint64_t units = ticks * counter.rate_den - counter.fraction;
+    counter.next_irq = counter.base_cycle + (units + counter.rate_num - 1) / counter.rate_num;
+}
+
+void Timers::update_deadline() {
+    /* Something a read or write ran into is handed out on the next compare. */
+    if (pending) {
+        next_deadline = 0;
+        return;
+    }
+
+    next_deadline = UINT64_MAX;
+    for (uint32_t i = 0; i < TIMER_COUNT; i++)
+        next_deadline = std::min(next_deadline, counters[i].next_irq);
+}
@@ -0,0 +1,110 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+
+const uint32_t TIMER_COUNT = 3;
+
+/* Video clock cycles per scanline. */
+const uint32_t NTSC_LINE_CYCLES = 3413;
+const uint32_t PAL_LINE_CYCLES = 3406;
+
+/* Video clock ticks per CPU cycle, num / den. The CPU runs at 33.8688 MHz, */
+/* the PAL GPU at 53.2224 MHz (11/7 of it) and the NTSC one at 53.693175.   */
+struct VideoClock {
+    uint32_t num;
+    uint32_t den;
+};
+
+const VideoClock PAL_VIDEO_CLOCK = { 11, 7 };
+const VideoClock NTSC_VIDEO_CLOCK = { 715909, 451584 };
+
+inline VideoClock video_clock(bool pal) {
+    return pal ? PAL_VIDEO_CLOCK : NTSC_VIDEO_CLOCK;
+}
+
+union CounterMode {
+    uint32_t raw;
+
+    struct {
+        uint32_t sync_enable : 1;
+        uint32_t sync_mode : 2;
+        uint32_t reset_on_target : 1; /* Otherwise counts up to 0xffff. */
+        uint32_t irq_on_target : 1;
+        uint32_t irq_on_overflow : 1;
+        uint32_t irq_repeat : 1; /* Otherwise one shot. */
+        uint32_t irq_toggle : 1; /* Otherwise a short pulse. */
+        uint32_t clock_source : 2;
+        uint32_t irq_inactive : 1; /* Active low. */
+        uint32_t reached_target : 1; /* Cleared when read. */
+        uint32_t reached_overflow : 1; /* Cleared when read. */
+        uint32_t unused : 19;
+    };
+};
+
+/*
+ * A root counter is not stepped. It remembers its value at base_cycle
+ * and the clock ratio, reading it works out how far it got since then.
+ * Counter ticks per CPU cycle is rate_num / rate_den, fraction keeps
+ * the part of a tick that was left over at base_cycle.
+ */
+struct RootCounter {
+    CounterMode mode = { 1 << 10 };
+    uint32_t value = 0;
+    uint16_t target = 0;
+
+    uint64_t base_cycle = 0;
+    uint64_t fraction = 0;
+    uint32_t rate_num = 1;
+    uint32_t rate_den = 1;
+    bool stopped = false;
+
+    bool irq_armed = true; /* A one shot IRQ disarms until the mode is written. */
+    uint64_t next_irq = UINT64_MAX; /* CPU cycle of the next IRQ. */
+};
+
+/*
+ * The three root counters at 0x1f801100. Every counter knows the cycle
+ * its next IRQ fires at, next_deadline is the earliest of them, so the
+ * only work per instruction is one compare against the cycle counter.
+ *
+ * Pausing or resetting counters 0 and 1 at the blanks (their sync modes)
+ * is not emulated, they count freely. The dotclock and scanline rates
+ * come from the GPU state given to set_video.
+ */
+class Timers {
+public:
+    uint32_t read(uint32_t offset, uint64_t now);
+    void write(uint32_t offset, uint32_t value, uint64_t now);
+
+    /* Dotclock divider and video standard, only resyncs when they change. */
+    void set_video(uint32_t dot_divider, bool pal, uint64_t now);
+
+    /* Called once now reaches next_deadline, returns the i_stat bits raised. */
+    uint32_t update(uint64_t now);
+
+    uint64_t next_deadline = UINT64_MAX;
+    RootCounter counters[TIMER_COUNT];
+
+private:
+    void sync(uint32_t index, uint64_t now);
+    void advance(uint32_t index, uint64_t ticks);
+    void raise(uint32_t index);
+
+    void set_rate(uint32_t index);
+    uint64_t ticks_until(const RootCounter& counter, uint32_t value) const;
+    void schedule(uint32_t index);
+    void update_deadline();
+
+    uint32_t dot_divider = 10;
+    bool pal = false;
+
+    /* IRQs found by a sync, handed out by the next update. */
+    uint32_t pending = 0;
+};
@@ -7,3 +7,61 @@
 
 */
 #include "VRAM.h"
+#include <algorithm>
+#include <bit>
+
+/* Blocks under a rectangle: the bits of one row of blocks, the first row and how many. */
+static uint64_t block_columns(uint32_t x, uint32_t width) {
+    uint32_t first = (x & (VRAM::WIDTH - 1)) / DirtyBlocks::BLOCK;
+    uint32_t count = std::min(DirtyBlocks::COLUMNS, (x % DirtyBlocks::BLOCK + width + DirtyBlocks::BLOCK - 1) / DirtyBlocks::BLOCK);
+    uint64_t bits = count == DirtyBlocks::COLUMNS ? ~0ull : (1ull << count) - 1;
+
+    return std::rotl(bits, (int)first);
+}
+
+static uint32_t block_rows(uint32_t y, uint32_t height) {
+    return std::min(DirtyBlocks::ROWS, (y % DirtyBlocks::BLOCK + height + DirtyBlocks::BLOCK - 1) / DirtyBlocks::BLOCK);
+}
+
+void DirtyBlocks::mark(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0)
+        return;
+
+    uint64_t bits = block_columns(x, width);
+    uint32_t first = (y & (VRAM::HEIGHT - 1)) / BLOCK;
+    uint32_t count = block_rows(y, height);
+
+    for (uint32_t row = 0; row < count; row++)
+        rows[(first + row) % ROWS] |= bits;
+}
+
+bool DirtyBlocks::intersects(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const {
+    if (width == 0 || height == 0)
+        return false;
+
+    uint64_t bits = block_columns(x, width);
+    uint32_t first = (y & (VRAM::HEIGHT - 1)) / BLOCK;
+    uint32_t count = block_rows(y, height);
+
+    for (uint32_t row = 0; row < count; row++) {
+        if (rows[(first + row) % ROWS] & bits)
+            return true;
+    }
+    return false;
+}
+
+bool DirtyBlocks::any() const {
+    return std::any_of(rows.begin(), rows.end(), [](uint64_t bits) { return bits != 0; });
+}
+
+uint32_t DirtyBlocks::count() const {
+    uint32_t blocks = 0;
+    for (uint64_t bits : rows)
+        blocks += std::popcount(bits);
+    return blocks;
+}
+
+void DirtyBlocks::merge(const DirtyBlocks& other) {
+    for (uint32_t row = 0; row < ROWS; row++)
+        rows[row] |= other.rows[row];
+}
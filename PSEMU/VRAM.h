@@ -8,28 +8,89 @@
 */
 #pragma once
 #include <cstdint>
-#include <vector>
-#include <iostream>
-#include <climits>
-#include <stddef.h>
-#include "Logging.h"
+#include <cstddef>
+#include <array>
+#include <memory>
 
+/*
+ * VRAM written since some point, one bit per 16x16 pixel block. A row
+ * of blocks is one word, bit n for pixels 16n to 16n + 15.
+ */
+struct DirtyBlocks {
+    static const uint32_t BLOCK = 16;
+    static const uint32_t COLUMNS = 64;
+    static const uint32_t ROWS = 32;
+
+    std::array<uint64_t, ROWS> rows = {};
+
+    /* Rectangles wrap like VRAM. */
+    void mark(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    bool intersects(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const;
+
+    bool test(uint32_t column, uint32_t row) const { return (rows[row] >> column) & 1; }
+    bool any() const;
+    uint32_t count() const;
+    void merge(const DirtyBlocks& other);
+    void clear() { rows = {}; }
+};
+
+/*
+ * The GPU's 1 MiB of VRAM as 1024x512 16 bit pixels, row major. Rows are
+ * 2 KiB and start on a cache line, so spans can be loaded and stored
+ * with full vectors. Every accessor wraps coordinates like the GPU does.
+ */
 class VRAM {
 public:
-    // [ For GPU Memory ]
-    VRAM() : GPUmemory((1024 * 8000) / sizeof(uint8_t)) {}
-
-    uint8_t& operator[](uint32_t address) {
-        if (address < GPUmemory.size()) {
-            return GPUmemory[address];
-        }
-        else {
-            Logging Console;
-            Console.err(54);
-            static uint8_t eval = 0;
-            return eval;
-        }
+    /* In 16 bit pixels. */
+    static const uint32_t WIDTH = 1024;
+    static const uint32_t HEIGHT = 512;
+    static const uint32_t PIXELS = WIDTH * HEIGHT;
+
+    /* The AVX2 texel gather loads 32 bits per texel, so the last pixel */
+    /* may read 2 bytes past the end. One cache line covers that.       */
+    static const uint32_t PADDING = 32;
+
+    VRAM() : surface(std::make_unique<Surface>()) {}
+
+    uint16_t* data() { return surface->pixels; }
+    const uint16_t* data() const { return surface->pixels; }
+
+    static uint32_t index(uint32_t x, uint32_t y) {
+        return (y & (HEIGHT - 1)) * WIDTH + (x & (WIDTH - 1));
     }
+
+    uint16_t* row(uint32_t y) { return surface->pixels + (y & (HEIGHT - 1)) * WIDTH; }
+    const uint16_t* row(uint32_t y) const { return surface->pixels + (y & (HEIGHT - 1)) * WIDTH; }
+
+    uint16_t& at(uint32_t x, uint32_t y) { return surface->pixels[index(x, y)]; }
+
+    uint16_t read(uint32_t x, uint32_t y) const {
+        return surface->pixels[index(x, y)];
+    }
+
+    void write(uint32_t x, uint32_t y, uint16_t value) {
+        surface->pixels[index(x, y)] = value;
+        dirty.mark(x, y, 1, 1);
+    }
+
+    /* Blocks written since the last take_dirty(). Writes through data(), */
+    /* row() and at() are marked by whoever makes them.                    */
+    void mark_dirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height) { dirty.mark(x, y, width, height); }
+    const DirtyBlocks& get_dirty() const { return dirty; }
+    DirtyBlocks take_dirty() {
+        DirtyBlocks taken = dirty;
+        dirty.clear();
+        return taken;
+    }
+
 private:
-    std::vector<uint8_t> GPUmemory;
-};
\ No newline at end of file
+    struct Surface {
+        alignas(64) uint16_t pixels[PIXELS + PADDING] = {};
+    };
+
+    static_assert(PIXELS * sizeof(uint16_t) == 1024 * 1024);
+    static_assert(DirtyBlocks::COLUMNS * DirtyBlocks::BLOCK == WIDTH && DirtyBlocks::ROWS * DirtyBlocks::BLOCK == HEIGHT);
+
+    std::unique_ptr<Surface> surface;
+    DirtyBlocks dirty;
+};
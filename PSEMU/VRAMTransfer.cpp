@@ -0,0 +1,191 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <cstring>
+#include "VRAMTransfer.h"
+
+void TransferRect::advance(uint32_t pixels) {
+    column += pixels;
+    row += column / width;
+    column %= width;
+
+    if (row >= height)
+        active = false;
+}
+
+void VRAMTransfer::begin_upload(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                                bool check_mask, bool set_mask) {
+    upload_rect = TransferRect();
+    upload_rect.x = x;
+    upload_rect.y = y;
+    upload_rect.width = width;
+    upload_rect.height = height;
+    upload_rect.active = true;
+
+    upload_check_mask = check_mask;
+    upload_set_mask = set_mask;
+    stats.uploads++;
+}
+
+size_t VRAMTransfer::upload(const uint32_t* words, size_t count) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(words);
+    size_t pixels = std::min<size_t>(count * 2, upload_rect.pixels_left());
+
+    /* An odd rectangle ends in the low half of its last word. */
+    size_t used = (pixels + 1) / 2;
+
+    while (pixels > 0) {
+        TransferRect& r = upload_rect;
+        uint32_t run = (uint32_t)std::min<size_t>(pixels, r.width - r.column);
+
+        vram.mark_dirty(r.x + r.column, r.y + r.row, run, 1);
+        write_run(r.x + r.column, r.y + r.row, bytes, run, upload_check_mask, upload_set_mask);
+        r.advance(run);
+        stats.upload_pixels += run;
+
+        bytes += run * 2;
+        pixels -= run;
+    }
+
+    return used;
+}
+
+void VRAMTransfer::begin_download(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    size_t pixels = (size_t)width * height;
+    stats.downloads++;
+    stats.download_pixels += pixels;
+
+    /* An odd rectangle leaves the high half of the last word clear. */
+    download_words.assign((pixels + 1) / 2, 0);
+    download_pos = 0;
+
+    uint16_t* packed = reinterpret_cast<uint16_t*>(download_words.data());
+    for (uint32_t row = 0; row < height; row++)
+        read_run(x, y + row, packed + (size_t)row * width, width);
+}
+
+uint32_t VRAMTransfer::download_word() {
+    if (downloading())
+        latch = download_words[download_pos++];
+
+    return latch;
+}
+
+size_t VRAMTransfer::download(uint32_t* words, size_t count) {
+    size_t copied = std::min(count, download_words.size() - download_pos);
+    if (copied == 0)
+        return 0;
+
+    std::memcpy(words, download_words.data() + download_pos, copied * 4);
+    download_pos += copied;
+    latch = words[copied - 1];
+
+    return copied;
+}
+
+void VRAMTransfer::cancel() {
+    upload_rect.active = false;
+    download_words.clear();
+    download_pos = 0;
+}
+
+void VRAMTransfer::write_run(uint32_t x, uint32_t y, const uint8_t* pixels, uint32_t count,
+                             bool check_mask, bool set_mask) {
+    uint16_t* row = vram.row(y);
+
+    while (count > 0) {
+        x &= VRAM::WIDTH - 1;
+        uint32_t run = std::min(count, VRAM::WIDTH - x);
+        uint16_t* dst = row + x;
+
+        if (!check_mask && !set_mask) {
+            std::memcpy(dst, pixels, run * 2);
+        } else {
+            uint16_t set = set_mask ? 0x8000 : 0;
+            for (uint32_t i = 0; i < run; i++) {
+                uint16_t pixel;
+                std::memcpy(&pixel, pixels + i * 2, 2);
+
+                bool keep = check_mask && (dst[i] & 0x8000);
+                dst[i] = keep ? dst[i] : (uint16_t)(pixel | set);
+            }
+            stats.masked_pixels += run;
+        }
+
+        x += run;
+        pixels += run * 2;
+        count -= run;
+    }
+}
+
+void VRAMTransfer::read_run(uint32_t x, uint32_t y, uint16_t* pixels, uint32_t count) {
+    const uint16_t* row = vram.row(y);
+
+    while (count > 0) {
+        x &= VRAM::WIDTH - 1;
+        uint32_t run = std::min(count, VRAM::WIDTH - x);
+        std::memcpy(pixels, row + x, run * 2);
+
+        x += run;
+        pixels += run;
+        count -= run;
+    }
+}
+
+void VRAMTransfer::blit_row(uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
+                            uint32_t width, bool check_mask, bool set_mask) {
+    bool wraps = src_x + width > VRAM::WIDTH || dst_x + width > VRAM::WIDTH;
+
+    if (!wraps && !check_mask && !set_mask) {
+        std::memmove(vram.row(dst_y) + dst_x, vram.row(src_y) + src_x, width * 2);
+        return;
+    }
+
+    /* Read the whole run first, so overlap within the row cannot matter. */
+    alignas(64) uint16_t line[VRAM::WIDTH];
+    read_run(src_x, src_y, line, width);
+    write_run(dst_x, dst_y, reinterpret_cast<const uint8_t*>(line), width, check_mask, set_mask);
+}
+
+void VRAMTransfer::blit(uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
+                        uint32_t width, uint32_t height, bool check_mask, bool set_mask) {
+    stats.blits++;
+    stats.blit_pixels += (uint64_t)width * height;
+    vram.mark_dirty(dst_x, dst_y, width, height);
+
+    /* Rows of the two rectangles overlap when one starts inside the    */
+    /* other on the 512 row ring. Copy away from the overlap: bottom up */
+    /* when the destination starts inside the source, top down when the */
+    /* source starts inside the destination. Both at once leaves no     */
+    /* good order, so the source is staged first.                       */
+    uint32_t down = (dst_y - src_y) & (VRAM::HEIGHT - 1);
+    uint32_t up = (src_y - dst_y) & (VRAM::HEIGHT - 1);
+    bool dst_in_src = down != 0 && down < height;
+    bool src_in_dst = up != 0 && up < height;
+
+    if (dst_in_src && src_in_dst) {
+        stats.staged_blits++;
+        staging.resize((size_t)width * height);
+
+        for (uint32_t row = 0; row < height; row++)
+            read_run(src_x, src_y + row, staging.data() + (size_t)row * width, width);
+        for (uint32_t row = 0; row < height; row++)
+            write_run(dst_x, dst_y + row, reinterpret_cast<const uint8_t*>(staging.data() + (size_t)row * width),
+                      width, check_mask, set_mask);
+        return;
+    }
+
+    if (dst_in_src) {
+        for (uint32_t row = height; row-- > 0;)
+            blit_row(src_x, src_y + row, dst_x, dst_y + row, width, check_mask, set_mask);
+    } else {
+        for (uint32_t row = 0; row < height; row++)
+            blit_row(src_x, src_y + row, dst_x, dst_y + row, width, check_mask, set_mask);
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "VRAM.h"
+
+/* A VRAM rectangle walked in row order, two pixels per word. */
+struct TransferRect {
+    uint32_t x = 0, y = 0;
+    uint32_t width = 0, height = 0;
+    uint32_t column = 0, row = 0; /* Next pixel, relative to x and y. */
+    bool active = false;
+
+    uint32_t pixels_left() const { return (height - row) * width - column; }
+    void advance(uint32_t pixels);
+};
+
+struct TransferStats {
+    uint64_t uploads = 0;
+    uint64_t upload_pixels = 0;
+    uint64_t downloads = 0;
+    uint64_t download_pixels = 0;
+    uint64_t blits = 0;
+    uint64_t blit_pixels = 0;
+    uint64_t staged_blits = 0; /* Overlapping so that no row order works. */
+    uint64_t masked_pixels = 0; /* Written through the mask bit path. */
+};
+
+/*
+ * Moves whole spans between VRAM and the GPU ports. Rectangles wrap
+ * around VRAM; rows are copied as runs with memcpy, only the mask bit
+ * settings send pixels through a per pixel loop. Downloads are packed
+ * when the command runs, GPUREAD and DMA then only copy words out.
+ */
+class VRAMTransfer {
+public:
+    explicit VRAMTransfer(VRAM& vram) : vram(vram) {}
+
+    /* GP0(A0): width and height are already in 1-1024 and 1-512. */
+    void begin_upload(uint32_t x, uint32_t y, uint32_t width, uint32_t height, bool check_mask, bool set_mask);
+    bool uploading() const { return upload_rect.active; }
+
+    /* Takes up to count words and returns how many it used, fewer once the rectangle is complete. */
+    size_t upload(const uint32_t* words, size_t count);
+
+    /* GP0(C0): packs the rectangle for GPUREAD in one go, two pixels per word. */
+    void begin_download(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    bool downloading() const { return download_pos < download_words.size(); }
+
+    /* The next packed word. With nothing left GPUREAD keeps returning the last word read. */
+    uint32_t download_word();
+
+    /* Copies up to count packed words and returns how many, fewer once the rectangle is done. */
+    size_t download(uint32_t* words, size_t count);
+    uint32_t last_word() const { return latch; }
+
+    /* GP1(10) answers through GPUREAD too. */
+    void set_last_word(uint32_t word) { latch = word; }
+
+    /* GP1(01): drops whatever is left of an upload or download. */
+    void cancel();
+
+    /* GP0(80): the destination ends up as if the source was read whole before any write. */
+    void blit(uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
+              uint32_t width, uint32_t height, bool check_mask, bool set_mask);
+
+    const TransferStats& get_stats() const { return stats; }
+
+private:
+    /* A run of pixels within one VRAM row, split where it wraps. */
+    void write_run(uint32_t x, uint32_t y, const uint8_t* pixels, uint32_t count, bool check_mask, bool set_mask);
+    void read_run(uint32_t x, uint32_t y, uint16_t* pixels, uint32_t count);
+    void blit_row(uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
+                  uint32_t width, bool check_mask, bool set_mask);
+
+    VRAM& vram;
+    TransferRect upload_rect;
+    bool upload_check_mask = false;
+    bool upload_set_mask = false;
+
+    std::vector<uint32_t> download_words;
+    size_t download_pos = 0;
+    uint32_t latch = 0;
+
+    std::vector<uint16_t> staging;
+
+    TransferStats stats;
+};
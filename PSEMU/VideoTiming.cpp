@@ -0,0 +1,127 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include "VideoTiming.h"
+
+VideoTiming::VideoTiming() {
+    schedule(0);
+}
+
+uint64_t VideoTiming::clocks(uint64_t now) const {
+    VideoClock clock = video_clock(pal);
+    return base_clock + (now - base_cycle) * clock.num / clock.den;
+}
+
+BeamPosition VideoTiming::position(uint64_t now) const {
+    uint64_t c = clocks(now);
+    uint64_t in_frame = c % frame_clocks();
+
+    BeamPosition beam;
+    beam.frame = base_frame + c / frame_clocks();
+    beam.line = (uint32_t)(in_frame / line_clocks());
+    beam.dot = (uint32_t)(in_frame % line_clocks());
+    return beam;
+}
+
+bool VideoTiming::in_vblank(uint64_t now) const {
+    BeamPosition beam = position(now);
+    return beam.line < y1 || beam.line >= y2;
+}
+
+bool VideoTiming::in_hblank(uint64_t now) const {
+    BeamPosition beam = position(now);
+    return beam.dot < x1 || beam.dot >= x2;
+}
+
+uint32_t VideoTiming::status_bits(uint64_t now) {
+    if (now < status_until)
+        return status_cache;
+
+    BeamPosition beam = position(now);
+    bool vblank = beam.line < y1 || beam.line >= y2;
+    bool field = !interlaced || (beam.frame & 1);
+    bool odd = !vblank && ((interlaced && double_height) ? (beam.frame & 1) : (beam.line & 1));
+
+    status_cache = (field ? 1u << 13 : 0) | (odd ? 1u << 31 : 0);
+    status_until = cycle_at(clocks(now) - beam.dot + line_clocks());
+    return status_cache;
+}
+
+uint64_t VideoTiming::cycle_at(uint64_t clock) const {
+    VideoClock rate = video_clock(pal);
+    return base_cycle + ((clock - base_clock) * rate.den + rate.num - 1) / rate.num;
+}
+
+void VideoTiming::rebase(const BeamPosition& beam, uint64_t now) {
+    /* A shorter frame may not have the line the beam is on. */
+    base_frame = beam.frame;
+    base_clock = (uint64_t)std::min(beam.line, lines() - 1) * line_clocks() + std::min(beam.dot, line_clocks() - 1);
+    base_cycle = now;
+    status_until = 0;
+}
+
+void VideoTiming::set_mode(bool is_pal, bool is_interlaced, bool is_double_height, uint64_t now) {
+    if (is_interlaced != interlaced || is_double_height != double_height) {
+        interlaced = is_interlaced;
+        double_height = is_double_height;
+        status_until = 0;
+    }
+
+    /* Only the standard changes the line length, line count and video   */
+    /* clock rate. The beam is found at the old rate, then rebased on it. */
+    if (is_pal == pal)
+        return;
+
+    BeamPosition beam = position(now);
+    pal = is_pal;
+
+    rebase(beam, now);
+    schedule(now);
+}
+
+void VideoTiming::set_horizontal_range(uint32_t h1, uint32_t h2) {
+    x1 = h1;
+    x2 = h2;
+}
+
+void VideoTiming::set_vertical_range(uint32_t v1, uint32_t v2, uint64_t now) {
+    y1 = v1;
+    y2 = v2;
+    status_until = 0;
+    schedule(now);
+}
+
+void VideoTiming::reset(uint64_t now) {
+    set_mode(false, false, false, now);
+    set_horizontal_range(0x200, 0xc00);
+    set_vertical_range(0x10, 0x100, now);
+}
+
+/* The next start of vblank after now: the line y2, or the top of the frame past the last line. */
+void VideoTiming::schedule(uint64_t now) {
+    uint64_t c = clocks(now);
+    uint64_t frame_start = c - c % frame_clocks();
+    uint64_t target = frame_start + (uint64_t)std::min(y2, lines()) * line_clocks();
+    if (target <= c)
+        target += frame_clocks();
+
+    next_deadline = cycle_at(target);
+}
+
+bool VideoTiming::update(uint64_t now) {
+    if (now < next_deadline)
+        return false;
+
+    vblanks++;
+
+    /* Keep the numbers small, the beam is at a known place anyway. */
+    rebase(position(now), now);
+    schedule(now);
+    return true;
+}
@@ -0,0 +1,90 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include "Timers.h"
+
+const uint32_t NTSC_LINES = 263;
+const uint32_t PAL_LINES = 314;
+
+/* Where the beam is: scanline, video clock within it, and frames so far. */
+struct BeamPosition {
+    uint64_t frame;
+    uint32_t line;
+    uint32_t dot;
+};
+
+/*
+ * Video timing worked out from the CPU cycle counter. Like the root
+ * counters nothing is stepped: the beam position at base_cycle is kept
+ * and anything else (scanline, blanking, field) follows from how many
+ * video clocks went by since. The only event is the start of vblank,
+ * at next_deadline.
+ *
+ * Lines are counted from the top of the frame, vblank is outside the
+ * vertical display range y1 to y2 and hblank outside the horizontal one
+ * (in video clocks), both as set by GP1(06) and GP1(07). The GP1
+ * writes land here straight from the CPU, never from the render thread.
+ */
+class VideoTiming {
+public:
+    VideoTiming();
+
+    /* Video standard, interlace and the 480 line bit, from GP1(08). Only resyncs when the standard changes. */
+    void set_mode(bool pal, bool interlaced, bool double_height, uint64_t now);
+    void set_horizontal_range(uint32_t x1, uint32_t x2);
+    void set_vertical_range(uint32_t y1, uint32_t y2, uint64_t now);
+
+    /* GP1(00): NTSC, not interlaced, default ranges. */
+    void reset(uint64_t now);
+
+    /* Called once now reaches next_deadline, true when vblank began. */
+    bool update(uint64_t now);
+
+    BeamPosition position(uint64_t now) const;
+    bool in_vblank(uint64_t now) const;
+    bool in_hblank(uint64_t now) const;
+
+    /* GPUSTAT.13 and .31 for now, see GPUSTAT_TIMING_BITS. Worked out once per scanline. */
+    /* .13 is the field when interlaced, else 1. .31 is the field being drawn in 480 line   */
+    /* interlaced mode, else the scanline's parity; 0 in vblank.                            */
+    uint32_t status_bits(uint64_t now);
+
+    uint32_t line_clocks() const { return pal ? PAL_LINE_CYCLES : NTSC_LINE_CYCLES; }
+    uint32_t lines() const { return pal ? PAL_LINES : NTSC_LINES; }
+
+    uint64_t next_deadline = UINT64_MAX;
+    uint64_t vblanks = 0;
+
+private:
+    /* Video clocks since the start of the frame the beam was in at base_cycle. */
+    uint64_t clocks(uint64_t now) const;
+    uint64_t frame_clocks() const { return (uint64_t)line_clocks() * lines(); }
+
+    /* First cycle at which the video clock count reaches clock. */
+    uint64_t cycle_at(uint64_t clock) const;
+
+    /* Moves base_cycle to now, with the beam at beam. */
+    void rebase(const BeamPosition& beam, uint64_t now);
+    void schedule(uint64_t now);
+
+    bool pal = false;
+    bool interlaced = false;
+    bool double_height = false;
+    uint32_t x1 = 0x200, x2 = 0xc00;
+    uint32_t y1 = 0x10, y2 = 0x100;
+
+    uint64_t base_cycle = 0;
+    uint64_t base_clock = 0; /* Into the frame, at base_cycle. */
+    uint64_t base_frame = 0;
+
+    /* status_bits until the end of the scanline it was worked out on. */
+    uint32_t status_cache = 0;
+    uint64_t status_until = 0;
+};
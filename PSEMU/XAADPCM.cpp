@@ -0,0 +1,264 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "XAADPCM.h"
+#include "SIMD.h"
+
+/* Filter coefficients in 6 bit fixed point. */
+static const int32_t filter_pos[4] = { 0, 60, 115, 98 };
+static const int32_t filter_neg[4] = { 0, 0, -52, -55 };
+
+const size_t GROUP_COUNT = 18;
+const size_t GROUP_SIZE = 128;
+const size_t UNIT_SAMPLES = 28;
+
+bool XAADPCM::parse_header(const uint8_t* sector, XASectorInfo& info) {
+    /* Mode 2 subheader: file, channel, submode, coding info. */
+    const uint8_t* subheader = sector + 16;
+    if (sector[15] != 2 || !(subheader[2] & 0x04))
+        return false;
+
+    XACodingInfo coding;
+    coding.raw = subheader[3];
+
+    info.file = subheader[0];
+    info.channel = subheader[1];
+    info.stereo = coding.stereo == 1;
+    info.eight_bit = coding.bits == 1;
+    info.sample_rate = coding.sample_rate == 1 ? 18900 : 37800;
+    return true;
+}
+
+void XAADPCM::reset() {
+    old[0] = old[1] = 0;
+    older[0] = older[1] = 0;
+}
+
+/* Pulls the raw samples of one sound unit out of the group and applies the */
+/* range shift. 4 bit units share their bytes with a neighbour, the nibble */
+/* picks which half.                                                       */
+static void unpack_unit_scalar(const uint8_t* data, int unit, bool eight_bit, int shift, int32_t* samples) {
+    for (size_t j = 0; j < UNIT_SAMPLES; j++) {
+        int16_t t;
+        if (eight_bit)
+            t = (int16_t)(data[j * 4 + unit] << 8);
+        else
+            t = (int16_t)(((data[j * 4 + unit / 2] >> ((unit & 1) * 4)) & 0xf) << 12);
+
+        samples[j] = t >> shift;
+    }
+}
+
+#ifdef PSEMU_X86
+/* The 28 words of a group hold one byte of every unit lane. This moves */
+/* them into 4 rows of 28 bytes, one row per byte lane.                */
+PSEMU_TARGET("sse4.1")
+static void transpose_group_sse41(const uint8_t* data, uint8_t rows[4][32]) {
+    const __m128i transpose = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+    for (size_t j = 0; j < UNIT_SAMPLES; j += 4) {
+        __m128i words = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + j * 4)), transpose);
+
+        for (int r = 0; r < 4; r++) {
+            int32_t lane = _mm_extract_epi32(words, 0);
+            std::copy_n(reinterpret_cast<const uint8_t*>(&lane), 4, rows[r] + j);
+            words = _mm_srli_si128(words, 4);
+        }
+    }
+}
+
+PSEMU_TARGET("sse4.1")
+static void unpack_row_sse41(const uint8_t* row, bool high_nibble, bool eight_bit, int shift, int32_t* samples) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i low_mask = _mm_set1_epi16(0x000f);
+    const __m128i high_mask = _mm_set1_epi16(0x00f0);
+
+    /* 32 bytes of row, the last 4 are padding. */
+    for (size_t j = 0; j < 32; j += 8) {
+        __m128i t = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + j)));
+
+        if (eight_bit)
+            t = _mm_slli_epi16(t, 8);
+        else if (high_nibble)
+            t = _mm_slli_epi16(_mm_and_si128(t, high_mask), 8);
+        else
+            t = _mm_slli_epi16(_mm_and_si128(t, low_mask), 12);
+
+        t = _mm_sra_epi16(t, count);
+
+        __m128i lo = _mm_cvtepi16_epi32(t);
+        __m128i hi = _mm_cvtepi16_epi32(_mm_srli_si128(t, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + j), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + j + 4), hi);
+    }
+}
+#endif
+
+size_t XAADPCM::decode_sector(const uint8_t* sector, int16_t* out) {
+    XASectorInfo info;
+    if (!parse_header(sector, info))
+        return 0;
+
+    int units = info.eight_bit ? 4 : 8;
+    int channels = info.stereo ? 2 : 1;
+    bool vector = use_simd && simd::has_sse41();
+
+    /* 32 so the vector unpack can write whole registers. */
+    int32_t samples[32];
+    size_t frames = 0;
+
+    for (size_t g = 0; g < GROUP_COUNT; g++) {
+        const uint8_t* group = sector + 24 + g * GROUP_SIZE;
+        const uint8_t* data = group + 16;
+
+#ifdef PSEMU_X86
+        alignas(16) uint8_t rows[4][32] = {};
+        if (vector)
+            transpose_group_sse41(data, rows);
+#endif
+
+        for (int unit = 0; unit < units; unit++) {
+            uint8_t param = group[4 + unit];
+            int range = param & 0xf;
+            int filter = (param >> 4) & 0x3;
+
+            /* Ranges 13 to 15 behave like 9. */
+            if (range > 12)
+                range = 9;
+
+#ifdef PSEMU_X86
+            if (vector)
+                unpack_row_sse41(rows[info.eight_bit ? unit : unit / 2], unit & 1, info.eight_bit, range, samples);
+            else
+#endif
+                unpack_unit_scalar(data, unit, info.eight_bit, range, samples);
+
+            /* The 2 tap filter feeds back into itself, so this part stays serial. */
+            int ch = info.stereo ? (unit & 1) : 0;
+            int32_t f0 = filter_pos[filter];
+            int32_t f1 = filter_neg[filter];
+            int32_t s1 = old[ch];
+            int32_t s2 = older[ch];
+
+            size_t first = info.stereo ? frames + (unit / 2) * UNIT_SAMPLES : frames + unit * UNIT_SAMPLES;
+            for (size_t j = 0; j < UNIT_SAMPLES; j++) {
+                int32_t s = samples[j] + ((s1 * f0 + s2 * f1 + 32) >> 6);
+                s = std::clamp(s, -0x8000, 0x7fff);
+
+                out[(first + j) * channels + ch] = (int16_t)s;
+                s2 = s1;
+                s1 = s;
+            }
+
+            old[ch] = s1;
+            older[ch] = s2;
+        }
+
+        frames += (units / channels) * UNIT_SAMPLES;
+    }
+
+    return frames;
+}
+
+/* A form 2 audio sector, coding as in the subheader. Sound groups are */
+/* random, with every range (13 to 15 too) and filter.                 */
+static void make_sector(std::mt19937& rng, uint8_t coding, uint8_t* sector) {
+    std::memset(sector, 0, 2352);
+    sector[15] = 2;
+
+    const uint8_t subheader[4] = { 1, 0, 0x64, coding };
+    std::memcpy(sector + 16, subheader, 4);
+    std::memcpy(sector + 20, subheader, 4);
+
+    for (size_t g = 0; g < GROUP_COUNT; g++) {
+        uint8_t* group = sector + 24 + g * GROUP_SIZE;
+        for (size_t i = 0; i < 16; i++)
+            group[i] = (uint8_t)(rng() & 0x3f);
+        for (size_t i = 16; i < GROUP_SIZE; i++)
+            group[i] = (uint8_t)rng();
+    }
+}
+
+bool bench_xa_adpcm(uint32_t iterations) {
+    const size_t sectors = 75;
+    std::mt19937 rng(1);
+    bool ok = true;
+
+    /* Known answer: range 0 and filter 0 pass the nibbles straight through. */
+    {
+        std::vector<uint8_t> sector(2352);
+        make_sector(rng, 0x00, sector.data());
+        for (size_t g = 0; g < GROUP_COUNT; g++) {
+            uint8_t* group = sector.data() + 24 + g * GROUP_SIZE;
+            std::memset(group, 0, 16);
+            std::memset(group + 16, 0x71, GROUP_SIZE - 16);
+        }
+
+        for (int vector = 0; vector < 2; vector++) {
+            XAADPCM xa;
+            xa.use_simd = vector == 1;
+
+            int16_t pcm[XA_MAX_SAMPLES];
+            bool match = xa.decode_sector(sector.data(), pcm) == XA_MAX_SAMPLES;
+            for (size_t i = 0; i < XA_MAX_SAMPLES; i++)
+                match &= pcm[i] == ((i / UNIT_SAMPLES) & 1 ? 0x7000 : 0x1000);
+
+            ok &= match;
+            if (!match)
+                printf("[XA] known answer %s  MISMATCH\n", vector ? "sse4.1" : "scalar");
+        }
+    }
+
+    for (uint8_t coding = 0; coding < 8; coding++) {
+        bool stereo = coding & 1;
+        bool eight_bit = coding & 4;
+        uint8_t raw = (uint8_t)((stereo ? 0x01 : 0) | ((coding & 2) ? 0x04 : 0) | (eight_bit ? 0x10 : 0));
+
+        std::vector<uint8_t> data(sectors * 2352);
+        for (size_t i = 0; i < sectors; i++)
+            make_sector(rng, raw, data.data() + i * 2352);
+
+        XASectorInfo info = {};
+        XAADPCM::parse_header(data.data(), info);
+        size_t frames = XA_MAX_SAMPLES / (eight_bit ? 2 : 1) / (stereo ? 2 : 1);
+        std::vector<int16_t> pcm[2];
+
+        for (int vector = 0; vector < 2; vector++) {
+            if (vector == 1 && !simd::has_sse41())
+                continue;
+
+            XAADPCM xa;
+            xa.use_simd = vector == 1;
+            pcm[vector].assign(sectors * XA_MAX_SAMPLES, 0);
+            bool counts = true;
+
+            auto begin = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < iterations; i++) {
+                /* Every pass starts from silence, so each one decodes the same PCM. */
+                xa.reset();
+                for (size_t s = 0; s < sectors; s++)
+                    counts &= xa.decode_sector(data.data() + s * 2352, pcm[vector].data() + s * XA_MAX_SAMPLES) == frames;
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            bool match = counts && (vector == 0 || pcm[1] == pcm[0]);
+            ok &= match;
+            printf("[XA] %d bit %-6s %5u Hz %-6s %9.0f sectors/s%s\n", eight_bit ? 8 : 4, stereo ? "stereo" : "mono",
+                   info.sample_rate, vector ? "sse4.1" : "scalar", (double)sectors * iterations / seconds,
+                   match ? "" : "  MISMATCH");
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,62 @@
+/*
+ *************************************
+ *           PSEMU Licence           *
+ *************************************
+
+ PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
+
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/* Coding info byte of the XA subheader. */
+union XACodingInfo {
+    uint8_t raw;
+
+    struct {
+        uint8_t stereo : 2;
+        uint8_t sample_rate : 2; /* 0 = 37800 Hz, 1 = 18900 Hz. */
+        uint8_t bits : 2; /* 0 = 4 bit, 1 = 8 bit. */
+        uint8_t emphasis : 1;
+        uint8_t reserved : 1;
+    };
+};
+
+struct XASectorInfo {
+    uint8_t file;
+    uint8_t channel;
+    bool stereo;
+    bool eight_bit;
+    uint32_t sample_rate;
+};
+
+/* Samples of one XA audio sector (18 sound groups). */
+const size_t XA_MAX_SAMPLES = 18 * 8 * 28;
+
+/*
+ * CD-XA ADPCM decoder. Keeps the filter history of both channels between
+ * sectors, so one decoder has to be used per stream.
+ */
+class XAADPCM {
+public:
+    /* Fills info from the subheader, false if it is not an audio sector. */
+    static bool parse_header(const uint8_t* sector, XASectorInfo& info);
+
+    /* Decodes a raw 2352 byte sector into 16 bit PCM, interleaved L/R for */
+    /* stereo. out needs room for XA_MAX_SAMPLES. Returns samples per channel. */
+    size_t decode_sector(const uint8_t* sector, int16_t* out);
+
+    void reset();
+
+    /* Clearing this forces the scalar reference path. */
+    bool use_simd = true;
+
+private:
+    int32_t old[2] = {};
+    int32_t older[2] = {};
+};
+
+/* Decodes synthetic sectors of every format through the scalar and SSE4.1 */
+/* paths and prints sectors/s, false if the PCM differs.                   */
+bool bench_xa_adpcm(uint32_t iterations);
@@ -6,148 +6,97 @@
  PSEMU © 2023 by Ronit D'silva is licensed under Attribution-NonCommercial-ShareAlike 4.0 International
 
 */
+#include <utility>
 #include "GPU.h"
 
-int GPU::command_size[16 * 16] {
-                //0  1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
-                1,  1,  3,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, //0
-                1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, //1
-                4,  4,  4,  4,  7,  7,  7,  7,  5,  5,  5,  5,  9,  9,  9,  9, //2
-                6,  6,  6,  6,  9,  9,  9,  9,  8,  8,  8,  8, 12, 12, 12, 12, //3
-                3,  3,  3,  3,  3,  3,  3,  3, 16, 16, 16, 16, 16, 16, 16, 16, //4
-                4,  4,  4,  4,  4,  4,  4,  4, 16, 16, 16, 16, 16, 16, 16, 16, //5
-                3,  3,  3,  1,  4,  4,  4,  4,  2,  1,  2,  1,  3,  3,  3,  3, //6
-                2,  1,  2,  1,  3,  3,  3,  3,  2,  1,  2,  2,  3,  3,  3,  3, //7
-                4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4, //8
-                4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4, //9
-                3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3, //A
-                3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3, //B
-                3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3, //C
-                3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3, //D
-                1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, //E
-                1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1  //F
-        };
-
-void GPU::write_gp0(uint32_t data) {
-    if (cpu_to_gpu.active) {
-        auto lower = uint16_t(data >> 0);
-        auto upper = uint16_t(data >> 16);
-
-        vram_transfer(lower);
-        vram_transfer(upper);
+struct GP0Command {
+    void (GPU::*handler)();
+    GPUCommand command;
+};
+
+/* Handlers for every opcode. Primitives get their own instantiation per opcode. */
+static constexpr std::array<GP0Command, 256> make_gp0_commands() {
+    std::array<GP0Command, 256> commands;
+    commands.fill({ &GPU::gp0_unknown, GPUCommand::None });
+
+    commands[0x00] = { &GPU::gp0_nop, GPUCommand::Nop };
+    commands[0x01] = { &GPU::gp0_clear_cache, GPUCommand::Render_Attrib };
+    commands[0x02] = { &GPU::gp0_fill_rect, GPUCommand::Fill_Rectangle };
+
+    [&]<uint32_t... i>(std::integer_sequence<uint32_t, i...>) {
+        ((commands[0x20 + i] = { &GPU::gp0_render_polygon<0x20 + i>, GPUCommand::Polygon }), ...);
+        ((commands[0x40 + i] = { &GPU::gp0_render_line<0x40 + i>, GPUCommand::Line }), ...);
+        ((commands[0x60 + i] = { &GPU::gp0_render_rect<0x60 + i>, GPUCommand::Rectangle }), ...);
+    }(std::make_integer_sequence<uint32_t, 32>());
+
+    for (uint32_t opcode = 0x80; opcode < 0xE0; opcode++) {
+        if (opcode < 0xA0)
+            commands[opcode] = { &GPU::gp0_image_transfer, GPUCommand::Vram_Vram };
+        else if (opcode < 0xC0)
+            commands[opcode] = { &GPU::gp0_image_load, GPUCommand::Cpu_Vram };
+        else
+            commands[opcode] = { &GPU::gp0_image_store, GPUCommand::Vram_Cpu };
+    }
+
+    commands[0xE1] = { &GPU::gp0_draw_mode, GPUCommand::Render_Attrib };
+    commands[0xE2] = { &GPU::gp0_texture_window_setting, GPUCommand::Render_Attrib };
+    commands[0xE3] = { &GPU::gp0_draw_area_top_left, GPUCommand::Render_Attrib };
+    commands[0xE4] = { &GPU::gp0_draw_area_bottom_right, GPUCommand::Render_Attrib };
+    commands[0xE5] = { &GPU::gp0_drawing_offset, GPUCommand::Render_Attrib };
+    commands[0xE6] = { &GPU::gp0_mask_bit_setting, GPUCommand::Render_Attrib };
+
+    return commands;
+}
+
+static constexpr std::array<GP0Command, 256> GP0_COMMANDS = make_gp0_commands();
+
+void GPU::execute_gp0(uint32_t data) {
+    if (transfer.uploading()) {
+        transfer.upload(&data, 1);
+        return;
+    }
+
+    if (polyline.active) {
+        gp0_polyline_word(data);
         return;
     }
 
     /* Push command word in the fifo. */
-    fifo.push_back(data);
+    fifo.push(data);
     uint32_t commanda = fifo[0] >> 24;
 
     /* If the command is complete, execute it. */
-    if (fifo.size() == command_size[commanda]) {
-        if (commanda == 0x00) {
-            gp0_nop();
-            command = GPUCommand::Nop;
-        }
-        else if (commanda == 0x01) {
-            gp0_clear_cache();
-            command = GPUCommand::Render_Attrib;
-        }
-        else if (commanda == 0x02) {
-            gp0_fill_rect();
-            command = GPUCommand::Fill_Rectangle;
-        }
-        else if (commanda >= 0x20 && commanda <= 0x3F) {
-            gp0_render_polygon();
-            command = GPUCommand::Polygon;
-        }
-        else if (commanda >= 0x40 && commanda <= 0x5F) {
-            command = GPUCommand::Line;
-        }
-        else if (commanda >= 0x60 && commanda <= 0x7F) {
-            gp0_render_rect();
-            command = GPUCommand::Rectangle;
-        }
-        else if (commanda >= 0x80 && commanda <= 0x9F) {
-            gp0_image_transfer();
-            command = GPUCommand::Vram_Vram;
-        }
-        else if (commanda >= 0xA0 && commanda <= 0xBF) {
-            gp0_image_load();
-            command = GPUCommand::Cpu_Vram;
-        }
-        else if (commanda >= 0xC0 && commanda <= 0xDF) {
-            gp0_image_store();
-            command = GPUCommand::Vram_Cpu;
-        }
-        else if (commanda == 0xE1) {
-            gp0_draw_mode();
-            command = GPUCommand::Render_Attrib;
-        }
-        else if (commanda == 0xE2) {
-            gp0_texture_window_setting();
-            command = GPUCommand::Render_Attrib;
-        }
-        else if (commanda == 0xE3) {
-            gp0_draw_area_top_left();
-            command = GPUCommand::Render_Attrib;
-        }
-        else if (commanda == 0xE4) {
-            gp0_draw_area_bottom_right();
-            command = GPUCommand::Render_Attrib;
-        }
-        else if (commanda == 0xE5) {
-            gp0_drawing_offset();
-            command = GPUCommand::Render_Attrib;
-        }
-        else if (commanda == 0xE6) {
-            gp0_mask_bit_setting();
-            command = GPUCommand::Render_Attrib;
-        }
-        else {
-            printf("[GPU] write_gp0: unknown command: 0x%x\n", commanda);
-            exit(1);
-        }
+    if (fifo.size() == GP0_COMMAND_LENGTH[commanda]) {
+        const GP0Command& entry = GP0_COMMANDS[commanda];
+        (this->*entry.handler)();
+        command = entry.command;
 
         /* Do not forget to clear the fifo! */
         fifo.clear();
     }
 }
 
+void GPU::gp0_unknown() {
+    uint32_t opcode = fifo[0] >> 24;
+    if (unknown_gp0[opcode]++ == 0)
+        printf("[GPU] execute_gp0: unknown command: 0x%x\n", opcode);
+}
+
 void GPU::gp0_nop() {
     return;
 }
 
 void GPU::gp0_fill_rect() {
-    auto color = extract_color(fifo[0]);
-    auto top_left = extract_point(fifo[1]);
-    auto size = extract_point(fifo[2]);
-
-    glm::ivec2 points[4] =
-            {
-                    glm::ivec2(0), glm::ivec2(size.x, 0),
-                    glm::ivec2(0, size.y), size
-            };
-
-    /* Generate vertex data. */
-    for (auto& p : points) {
-        auto vertex = top_left + p;
-
-        Vertex v = {};
-        v.color = color;
-        v.pos = vertex;
-        v.textured = false;
-
-        vertexData.push_back(v);
-    }
+    uint32_t color = fifo[0];
+    uint16_t pixel = (uint16_t)(((color >> 3) & 0x1f) | (((color >> 11) & 0x1f) << 5) | (((color >> 19) & 0x1f) << 10));
 
-    /* Complete the quad. */
-    vertexData.insert(vertexData.end(), { vertexData[1], vertexData[2] });
+    /* The position and width are in 16 pixel steps. */
+    uint32_t x = fifo[1] & 0x3f0;
+    uint32_t y = (fifo[1] >> 16) & 0x1ff;
+    uint32_t width = ((fifo[2] & 0x3ff) + 0xf) & ~0xfu;
+    uint32_t height = (fifo[2] >> 16) & 0x1ff;
 
-    /* Force draw. */
-    /* NOTE: this done as fill commands ignore all */
-    /* mask settings that the batch renderer uses. */
-    //gl_renderer->draw(vertexData);
-    vertexData.clear();
+    rasterizer.fill(x, y, width, height, pixel);
 }
 
 void GPU::gp0_draw_mode() {
@@ -165,23 +114,30 @@ void GPU::gp0_draw_mode() {
 }
 
 void GPU::gp0_draw_area_top_left() {
-    // Empty Implementation
+    uint32_t val = fifo[0];
+    drawing_area_top_left = glm::u16vec2(val & 0x3ff, (val >> 10) & 0x1ff);
 }
 
 void GPU::gp0_draw_area_bottom_right() {
-    // Empty Implementation
+    uint32_t val = fifo[0];
+    drawing_area_bottom_right = glm::u16vec2(val & 0x3ff, (val >> 10) & 0x1ff);
 }
 
 void GPU::gp0_texture_window_setting() {
-    // Empty Implementation
+    uint32_t val = fifo[0];
+    texture_window_mask = glm::u8vec2(val & 0x1f, (val >> 5) & 0x1f);
+    texture_window_offset = glm::u8vec2((val >> 10) & 0x1f, (val >> 15) & 0x1f);
 }
 
 void GPU::gp0_drawing_offset() {
-    // Empty Implementation
+    uint32_t val = fifo[0];
+    draw_offset = glm::i16vec2((int16_t)sl<11>(val), (int16_t)sl<11>(val >> 11));
 }
 
 void GPU::gp0_mask_bit_setting() {
-    // Empty Implementation
+    uint32_t val = fifo[0];
+    GPU_status.force_set_mask_bit = val & 0x1;
+    GPU_status.preserve_masked_pixels = (val >> 1) & 0x1;
 }
 
 void GPU::gp0_clear_cache() {
@@ -189,25 +145,213 @@ void GPU::gp0_clear_cache() {
 }
 
 void GPU::gp0_image_load() {
-    // Empty Implementation
+    /* Transfers see VRAM with every primitive before them drawn. */
+    rasterizer.flush();
+
+    /* Sizes wrap, so 0 means the full 1024 or 512. */
+    uint32_t x = fifo[1] & 0x3ff;
+    uint32_t y = (fifo[1] >> 16) & 0x1ff;
+    uint32_t width = ((fifo[2] - 1) & 0x3ff) + 1;
+    uint32_t height = (((fifo[2] >> 16) - 1) & 0x1ff) + 1;
+
+    transfer.begin_upload(x, y, width, height, GPU_status.preserve_masked_pixels, GPU_status.force_set_mask_bit);
+    rasterizer.invalidate(x, y, width, height);
 }
 
 void GPU::gp0_image_store() {
-    // Empty Implementation
+    rasterizer.flush();
+
+    uint32_t x = fifo[1] & 0x3ff;
+    uint32_t y = (fifo[1] >> 16) & 0x1ff;
+    uint32_t width = ((fifo[2] - 1) & 0x3ff) + 1;
+    uint32_t height = (((fifo[2] >> 16) - 1) & 0x1ff) + 1;
+
+    transfer.begin_download(x, y, width, height);
 }
 
 void GPU::gp0_image_transfer() {
-    // Empty Implementation
+    rasterizer.flush();
+
+    uint32_t src_x = fifo[1] & 0x3ff;
+    uint32_t src_y = (fifo[1] >> 16) & 0x1ff;
+    uint32_t dst_x = fifo[2] & 0x3ff;
+    uint32_t dst_y = (fifo[2] >> 16) & 0x1ff;
+    uint32_t width = ((fifo[3] - 1) & 0x3ff) + 1;
+    uint32_t height = (((fifo[3] >> 16) - 1) & 0x1ff) + 1;
+
+    transfer.blit(src_x, src_y, dst_x, dst_y, width, height,
+                  GPU_status.preserve_masked_pixels, GPU_status.force_set_mask_bit);
+    rasterizer.invalidate(dst_x, dst_y, width, height);
+}
+
+void GPU::update_draw_env() {
+    DrawEnv& env = rasterizer.env;
+
+    env.clip_left = drawing_area_top_left.x;
+    env.clip_top = drawing_area_top_left.y;
+    env.clip_right = drawing_area_bottom_right.x;
+    env.clip_bottom = drawing_area_bottom_right.y;
+
+    env.set_mask = GPU_status.force_set_mask_bit;
+    env.check_mask = GPU_status.preserve_masked_pixels;
+
+    /* The window registers are in 8 texel steps. */
+    env.window_mask_u = texture_window_mask.x * 8;
+    env.window_mask_v = texture_window_mask.y * 8;
+    env.window_offset_u = texture_window_offset.x * 8;
+    env.window_offset_v = texture_window_offset.y * 8;
 }
 
+/* texpage has the layout of GPUSTAT bits 0-8. */
+RasterPrim GPU::texpage_prim(uint32_t texpage, uint32_t clut, bool textured, bool raw) {
+    RasterPrim prim;
+    prim.textured = textured;
+    prim.raw = raw;
+    prim.semi_mode = (texpage >> 5) & 0x3;
+
+    prim.page_x = (texpage & 0xf) * 64;
+    prim.page_y = ((texpage >> 4) & 0x1) * 256;
+    prim.depth = (texpage >> 7) & 0x3;
+    prim.clut_x = (clut & 0x3f) * 16;
+    prim.clut_y = (clut >> 6) & 0x1ff;
+
+    return prim;
+}
+
+RasterVertex GPU::extract_vertex(uint32_t color, uint32_t point, uint32_t coord) {
+    auto pos = extract_point(point);
+    auto rgb = extract_color(color);
+    auto uv = extract_coord(coord);
+
+    RasterVertex v;
+    v.x = pos.x + draw_offset.x;
+    v.y = pos.y + draw_offset.y;
+    v.r = rgb.r;
+    v.g = rgb.g;
+    v.b = rgb.b;
+    v.u = uv.s;
+    v.v = uv.t;
+
+    return v;
+}
+
+template<uint32_t opcode>
 void GPU::gp0_render_polygon() {
-    // Empty Implementation
+    constexpr bool shaded = opcode & 0x10;
+    constexpr bool quad = opcode & 0x08;
+    constexpr bool textured = opcode & 0x04;
+    constexpr bool semi = opcode & 0x02;
+    constexpr bool raw = opcode & 0x01;
+
+    /* Colour, [colour], vertex, [texture coordinate] per vertex. The */
+    /* first coordinate carries the CLUT, the second the texture page. */
+    RasterVertex vertices[4];
+    uint32_t clut = 0;
+    uint32_t texpage = GPU_status.value & 0x1ff;
+    uint32_t color = fifo[0];
+    size_t word = 1;
+
+    for (uint32_t i = 0; i < (quad ? 4u : 3u); i++) {
+        if (i > 0 && shaded)
+            color = fifo[word++];
+
+        uint32_t point = fifo[word++];
+        uint32_t coord = textured ? fifo[word++] : 0;
+
+        if (textured && i == 0)
+            clut = coord >> 16;
+        if (textured && i == 1)
+            texpage = coord >> 16;
+
+        vertices[i] = extract_vertex(color, point, coord);
+    }
+
+    /* Textured polygons change the texture page for everything after them. */
+    if constexpr (textured)
+        GPU_status.value = (GPU_status.value & ~0x1ffu) | (texpage & 0x1ff);
+
+    update_draw_env();
+    RasterPrim prim = texpage_prim(texpage, clut, textured, raw);
+    prim.semi = semi;
+    prim.dither = GPU_status.dithering && (shaded || (textured && !raw));
+
+    rasterizer.triangle(vertices, prim);
+    if constexpr (quad)
+        rasterizer.triangle(vertices + 1, prim);
 }
 
+template<uint32_t opcode>
 void GPU::gp0_render_rect() {
-    // Empty Implementation
+    constexpr bool textured = opcode & 0x04;
+    constexpr bool semi = opcode & 0x02;
+    constexpr bool raw = opcode & 0x01;
+
+    size_t word = 1;
+    uint32_t point = fifo[word++];
+    uint32_t coord = textured ? fifo[word++] : 0;
+
+    constexpr uint32_t size = (opcode >> 3) & 0x3;
+    int32_t width, height;
+    if constexpr (size == 0) {
+        width = fifo[word] & 0x3ff;
+        height = (fifo[word] >> 16) & 0x1ff;
+    } else {
+        width = height = size == 1 ? 1 : size == 2 ? 8 : 16;
+    }
+
+    /* Rectangles use the texture page from GPUSTAT and are never dithered. */
+    update_draw_env();
+    RasterPrim prim = texpage_prim(GPU_status.value & 0x1ff, coord >> 16, textured, raw);
+    prim.semi = semi;
+
+    rasterizer.rectangle(extract_vertex(fifo[0], point, coord), width, height,
+                         textured_rectangle_flip.x, textured_rectangle_flip.y, prim);
 }
 
+template<uint32_t opcode>
 void GPU::gp0_render_line() {
-    // Empty Implementation
-}
\ No newline at end of file
+    constexpr bool shaded = opcode & 0x10;
+    constexpr bool poly = opcode & 0x08;
+    constexpr bool semi = opcode & 0x02;
+
+    update_draw_env();
+    RasterPrim prim = texpage_prim(GPU_status.value & 0x1ff, 0, false, false);
+    prim.semi = semi;
+    prim.dither = GPU_status.dithering && shaded;
+
+    RasterVertex from = extract_vertex(fifo[0], fifo[1], 0);
+    uint32_t color = shaded ? fifo[2] : fifo[0];
+    RasterVertex to = extract_vertex(color, fifo[shaded ? 3 : 2], 0);
+    rasterizer.line(from, to, prim);
+
+    /* The rest of a polyline comes in word by word. */
+    if constexpr (poly) {
+        polyline.active = true;
+        polyline.shaded = shaded;
+        polyline.want_color = shaded;
+        polyline.color = color;
+        polyline.from = to;
+        polyline.prim = prim;
+    }
+}
+
+void GPU::gp0_polyline_word(uint32_t data) {
+    /* Polylines go on until a 0x5xxx5xxx word where a vertex or colour is due. */
+    bool at_start = polyline.want_color || !polyline.shaded;
+    if (at_start && (data & 0xf000f000) == 0x50005000) {
+        polyline.active = false;
+        return;
+    }
+
+    if (polyline.want_color) {
+        polyline.color = data;
+        polyline.want_color = false;
+        return;
+    }
+
+    RasterVertex to = extract_vertex(polyline.color, data, 0);
+    rasterizer.line(polyline.from, to, polyline.prim);
+
+    polyline.from = to;
+    polyline.want_color = polyline.shaded;
+}
@@ -8,6 +8,94 @@
 */
 #include "GPU.h"
 
-void GPU::write_gp1(uint32_t data) {
-    // Empty Implementation
-}
\ No newline at end of file
+void GPU::execute_gp1(uint32_t data) {
+    switch (data >> 24) {
+    case 0x00:
+        reset();
+        break;
+    case 0x01:
+        reset_command_buffer();
+        break;
+    case 0x02:
+        GPU_status.interrupt_req = 0;
+        break;
+    case 0x03:
+        GPU_status.display_disable = data & 1;
+        break;
+    case 0x04:
+        GPU_status.dma_dir = data & 3;
+        break;
+    case 0x05:
+        display_area = glm::u16vec2(data & 0x3ff, (data >> 10) & 0x1ff);
+        break;
+    case 0x06:
+        display_area_top_left.x = data & 0xfff;
+        display_area_bottom_right.x = (data >> 12) & 0xfff;
+        break;
+    case 0x07:
+        display_area_top_left.y = data & 0x3ff;
+        display_area_bottom_right.y = (data >> 10) & 0x3ff;
+        break;
+    case 0x08:
+        GPU_status.hres1 = data & 3;
+        GPU_status.vres = (data >> 2) & 1;
+        GPU_status.video_mode = (data >> 3) & 1;
+        GPU_status.color_depth = (data >> 4) & 1;
+        GPU_status.vertical_interlace = (data >> 5) & 1;
+        GPU_status.hres2 = (data >> 6) & 1;
+        GPU_status.reverse_flag = (data >> 7) & 1;
+        break;
+    default:
+        /* GP1(10) to GP1(1F), the low bits pick the register. */
+        if ((data >> 28) == 1)
+            transfer.set_last_word(gpu_info(data & 0xf));
+        break;
+    }
+}
+
+void GPU::reset() {
+    reset_command_buffer();
+
+    /* GPUSTAT, and with it GP0(E1) and GP0(E6): display off, DMA off, NTSC 256x240. */
+    GPU_status.value = 0x14802000;
+
+    drawing_area_top_left = glm::u16vec2(0, 0);
+    drawing_area_bottom_right = glm::u16vec2(0, 0);
+    draw_offset = glm::i16vec2(0, 0);
+    texture_window_mask = glm::u8vec2(0, 0);
+    texture_window_offset = glm::u8vec2(0, 0);
+    textured_rectangle_flip = glm::bvec2(false, false);
+
+    display_area = glm::u16vec2(0, 0);
+    display_area_top_left = glm::u16vec2(0x200, 0x10);
+    display_area_bottom_right = glm::u16vec2(0xc00, 0x100);
+}
+
+void GPU::reset_command_buffer() {
+    /* Primitives already binned still get drawn, only unfinished commands go. */
+    fifo.clear();
+    polyline.active = false;
+    transfer.cancel();
+    command = GPUCommand::None;
+}
+
+uint32_t GPU::gpu_info(uint32_t index) {
+    switch (index) {
+    case 2:
+        return texture_window_mask.x | (texture_window_mask.y << 5) |
+               (texture_window_offset.x << 10) | (texture_window_offset.y << 15);
+    case 3:
+        return drawing_area_top_left.x | (drawing_area_top_left.y << 10);
+    case 4:
+        return drawing_area_bottom_right.x | (drawing_area_bottom_right.y << 10);
+    case 5:
+        return ((uint32_t)draw_offset.x & 0x7ff) | (((uint32_t)draw_offset.y & 0x7ff) << 11);
+    case 7:
+        return 2; /* GPU version. */
+    case 8:
+        return 0;
+    default:
+        /* Others leave GPUREAD as it was. */
+        return transfer.last_word();
+    }
+}